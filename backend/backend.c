@@ -10,6 +10,7 @@
 #include <wlr/backend/drm.h>
 #include <wlr/backend/libinput.h>
 #include <wlr/backend/wayland.h>
+#include <wlr/backend/headless.h>
 #include <wlr/backend/multi.h>
 #include <wlr/util/log.h>
 #include "backend/udev.h"
@@ -44,22 +45,38 @@ struct wlr_egl *wlr_backend_get_egl(struct wlr_backend *backend) {
 	return NULL;
 }
 
+static int get_env_outputs(const char *name) {
+	int outputs = 1;
+	const char *_outputs = getenv(name);
+	if (_outputs) {
+		char *end;
+		outputs = (int)strtol(_outputs, &end, 10);
+		if (*end) {
+			wlr_log(L_ERROR, "%s specified with invalid integer, ignoring", name);
+			outputs = 1;
+		} else if (outputs < 0) {
+			wlr_log(L_ERROR, "%s specified with negative outputs, ignoring", name);
+			outputs = 1;
+		}
+	}
+	return outputs;
+}
+
+static struct wlr_backend *attempt_headless_backend(struct wl_display *display) {
+	struct wlr_backend *backend = wlr_headless_backend_create(display);
+	if (backend) {
+		int outputs = get_env_outputs("WLR_HEADLESS_OUTPUTS");
+		while (outputs--) {
+			wlr_headless_add_output(backend, 1280, 720, 0);
+		}
+	}
+	return backend;
+}
+
 static struct wlr_backend *attempt_wl_backend(struct wl_display *display) {
 	struct wlr_backend *backend = wlr_wl_backend_create(display);
 	if (backend) {
-		int outputs = 1;
-		const char *_outputs = getenv("WLR_WL_OUTPUTS");
-		if (_outputs) {
-			char *end;
-			outputs = (int)strtol(_outputs, &end, 10);
-			if (*end) {
-				wlr_log(L_ERROR, "WLR_WL_OUTPUTS specified with invalid integer, ignoring");
-				outputs = 1;
-			} else if (outputs < 0) {
-				wlr_log(L_ERROR, "WLR_WL_OUTPUTS specified with negative outputs, ignoring");
-				outputs = 1;
-			}
-		}
+		int outputs = get_env_outputs("WLR_WL_OUTPUTS");
 		while (outputs--) {
 			wlr_wl_output_create(backend);
 		}
@@ -69,6 +86,11 @@ static struct wlr_backend *attempt_wl_backend(struct wl_display *display) {
 
 struct wlr_backend *wlr_backend_autocreate(struct wl_display *display) {
 	struct wlr_backend *backend;
+	if (getenv("WLR_HEADLESS_OUTPUTS")) {
+		// Asked for explicitly, don't fall back to a real display
+		return attempt_headless_backend(display);
+	}
+
 	if (getenv("WAYLAND_DISPLAY") || getenv("_WAYLAND_DISPLAY")) {
 		backend = attempt_wl_backend(display);
 		if (backend) {
@@ -37,6 +37,9 @@ static void wlr_drm_backend_destroy(struct wlr_backend *_backend) {
 	wlr_drm_resources_free(backend);
 	wlr_session_close_file(backend->session, backend->fd);
 	wl_event_source_remove(backend->drm_event);
+	if (backend->deferred_idle) {
+		wl_event_source_remove(backend->deferred_idle);
+	}
 	list_free(backend->outputs);
 	free(backend);
 }
@@ -52,6 +55,25 @@ static struct wlr_backend_impl backend_impl = {
 	.get_egl = wlr_drm_backend_get_egl
 };
 
+void wlr_drm_backend_begin_config(struct wlr_backend *_backend) {
+	assert(wlr_backend_is_drm(_backend));
+	struct wlr_drm_backend *backend = (struct wlr_drm_backend *)_backend;
+	++backend->config_depth;
+}
+
+void wlr_drm_backend_commit_config(struct wlr_backend *_backend) {
+	assert(wlr_backend_is_drm(_backend));
+	struct wlr_drm_backend *backend = (struct wlr_drm_backend *)_backend;
+	assert(backend->config_depth > 0);
+	if (--backend->config_depth == 0) {
+		wlr_drm_modeset_outputs(backend);
+	}
+}
+
+bool wlr_backend_is_drm(struct wlr_backend *b) {
+	return b->impl == &backend_impl;
+}
+
 static void session_signal(struct wl_listener *listener, void *data) {
 	struct wlr_drm_backend *backend =
 		wl_container_of(listener, backend, session_signal);
@@ -60,10 +82,16 @@ static void session_signal(struct wl_listener *listener, void *data) {
 	if (session->active) {
 		wlr_log(L_INFO, "DRM fd resumed");
 
+		// Someone else may have changed everything in the meantime
 		for (size_t i = 0; i < backend->outputs->length; ++i) {
 			struct wlr_output_state *output = backend->outputs->items[i];
-			wlr_drm_output_start_renderer(output);
+			output->modeset_pending =
+				output->state == WLR_DRM_OUTPUT_CONNECTED;
+		}
+		wlr_drm_modeset_outputs(backend);
 
+		for (size_t i = 0; i < backend->outputs->length; ++i) {
+			struct wlr_output_state *output = backend->outputs->items[i];
 			if (!output->crtc) {
 				continue;
 			}
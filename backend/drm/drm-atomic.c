@@ -26,7 +26,8 @@ static void atomic_begin(struct wlr_drm_crtc *crtc, struct atomic *atom) {
 	atom->failed = false;
 }
 
-static bool atomic_end(int drm_fd, struct atomic *atom) {
+// Like atomic_end, for changes which are expected to be rejected sometimes
+static bool atomic_test(int drm_fd, struct atomic *atom) {
 	if (atom->failed) {
 		return false;
 	}
@@ -34,7 +35,6 @@ static bool atomic_end(int drm_fd, struct atomic *atom) {
 	uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_NONBLOCK;
 
 	if (drmModeAtomicCommit(drm_fd, atom->req, flags, NULL)) {
-		wlr_log_errno(L_ERROR, "Atomic test failed");
 		drmModeAtomicSetCursor(atom->req, atom->cursor);
 		return false;
 	}
@@ -42,9 +42,38 @@ static bool atomic_end(int drm_fd, struct atomic *atom) {
 	return true;
 }
 
+static bool atomic_end(int drm_fd, struct atomic *atom) {
+	if (atom->failed) {
+		return false;
+	}
+
+	if (!atomic_test(drm_fd, atom)) {
+		wlr_log_errno(L_ERROR, "Atomic test failed");
+		return false;
+	}
+
+	return true;
+}
+
+// A staged adaptive sync change only takes effect with a successful commit
+static void output_commit_adaptive_sync(struct wlr_output_state *output,
+		bool committed) {
+	if (!output->adaptive_sync_pending) {
+		return;
+	}
+	output->adaptive_sync_pending = false;
+	if (committed) {
+		output->base->adaptive_sync = output->adaptive_sync;
+	} else {
+		output->adaptive_sync = output->base->adaptive_sync;
+	}
+}
+
 static bool atomic_commit(int drm_fd, struct atomic *atom, struct wlr_output_state *output,
 		uint32_t flag) {
 	if (atom->failed) {
+		drmModeAtomicSetCursor(atom->req, 0);
+		output_commit_adaptive_sync(output, false);
 		return false;
 	}
 
@@ -55,7 +84,9 @@ static bool atomic_commit(int drm_fd, struct atomic *atom, struct wlr_output_sta
 		wlr_log_errno(L_ERROR, "Atomic commit failed");
 	}
 
+	// The request is dropped either way
 	drmModeAtomicSetCursor(atom->req, 0);
+	output_commit_adaptive_sync(output, !ret);
 
 	return !ret;
 }
@@ -108,11 +139,207 @@ static bool atomic_crtc_pageflip(struct wlr_drm_backend *backend,
 	atomic_add(&atom, output->connector, output->props.crtc_id, crtc->id);
 	atomic_add(&atom, crtc->id, crtc->props.mode_id, crtc->mode_id);
 	atomic_add(&atom, crtc->id, crtc->props.active, 1);
+	if (mode && crtc->props.vrr_enabled) {
+		// The CRTC may have been used by another output before
+		atomic_add(&atom, crtc->id, crtc->props.vrr_enabled,
+			output->adaptive_sync);
+	}
 	set_plane_props(&atom, crtc->primary, crtc->id, fb_id, true);
 	return atomic_commit(backend->fd, &atom,
 			output, mode ? DRM_MODE_ATOMIC_ALLOW_MODESET : 0);
 }
 
+static bool atomic_crtc_test_fb(struct wlr_drm_backend *backend,
+		struct wlr_output_state *output, struct wlr_drm_crtc *crtc,
+		uint32_t fb_id) {
+	struct atomic atom;
+
+	atomic_begin(crtc, &atom);
+	set_plane_props(&atom, crtc->primary, crtc->id, fb_id, true);
+	if (!atomic_test(backend->fd, &atom)) {
+		return false;
+	}
+
+	// Only a test, so leave the pending request as it was
+	drmModeAtomicSetCursor(atom.req, atom.cursor);
+	return true;
+}
+
+static bool atomic_crtc_set_overlay(struct wlr_drm_backend *backend,
+		struct wlr_drm_crtc *crtc, struct wlr_drm_plane *plane,
+		uint32_t fb_id, int32_t x, int32_t y, uint32_t width, uint32_t height) {
+	uint32_t id = plane->id;
+	const union wlr_drm_plane_props *props = &plane->props;
+	struct atomic atom;
+
+	atomic_begin(crtc, &atom);
+
+	if (fb_id) {
+		// The src_* properties are in 16.16 fixed point
+		atomic_add(&atom, id, props->src_x, 0);
+		atomic_add(&atom, id, props->src_y, 0);
+		atomic_add(&atom, id, props->src_w, (uint64_t)width << 16);
+		atomic_add(&atom, id, props->src_h, (uint64_t)height << 16);
+		atomic_add(&atom, id, props->crtc_x, (uint64_t)x);
+		atomic_add(&atom, id, props->crtc_y, (uint64_t)y);
+		atomic_add(&atom, id, props->crtc_w, width);
+		atomic_add(&atom, id, props->crtc_h, height);
+		atomic_add(&atom, id, props->fb_id, fb_id);
+		atomic_add(&atom, id, props->crtc_id, crtc->id);
+	} else {
+		atomic_add(&atom, id, props->fb_id, 0);
+		atomic_add(&atom, id, props->crtc_id, 0);
+	}
+
+	// Keep the properties in the request on success, so every plane
+	// is tested together with the ones assigned before it
+	return atomic_test(backend->fd, &atom);
+}
+
+static bool atomic_crtc_set_vrr(struct wlr_drm_backend *backend,
+		struct wlr_drm_crtc *crtc, bool enable) {
+	if (!crtc->props.vrr_enabled) {
+		return false;
+	}
+
+	struct atomic atom;
+
+	atomic_begin(crtc, &atom);
+	atomic_add(&atom, crtc->id, crtc->props.vrr_enabled, enable);
+	return atomic_test(backend->fd, &atom);
+}
+
+static bool crtc_is_used(struct wlr_drm_backend *backend,
+		struct wlr_drm_crtc *crtc) {
+	for (size_t i = 0; i < backend->outputs->length; ++i) {
+		struct wlr_output_state *output = backend->outputs->items[i];
+		if (output->state == WLR_DRM_OUTPUT_CONNECTED && output->crtc == crtc) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool plane_is_used(struct wlr_drm_backend *backend,
+		struct wlr_drm_plane *plane) {
+	for (size_t i = 0; i < backend->num_crtcs; ++i) {
+		struct wlr_drm_crtc *crtc = &backend->crtcs[i];
+		if (crtc_is_used(backend, crtc) && (crtc->primary == plane ||
+				crtc->cursor == plane || plane->overlay_crtc == crtc)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool atomic_outputs_modeset(struct wlr_drm_backend *backend,
+		size_t count, struct wlr_output_state **outputs, const uint32_t *fb_ids) {
+	struct atomic atom = {
+		.req = drmModeAtomicAlloc(),
+	};
+	if (!atom.req) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return false;
+	}
+
+	uint32_t mode_ids[count];
+	size_t num_mode_ids = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct wlr_output_state *output = outputs[i];
+		struct wlr_drm_crtc *crtc = output->crtc;
+		drmModeModeInfo *mode = &output->base->current_mode->state->mode;
+
+		if (drmModeCreatePropertyBlob(backend->fd, mode, sizeof(*mode),
+				&mode_ids[i])) {
+			wlr_log_errno(L_ERROR, "Unable to create property blob");
+			goto out;
+		}
+		++num_mode_ids;
+
+		// Changes queued on the CRTC go out along with the modeset
+		if (crtc->atomic && drmModeAtomicGetCursor(crtc->atomic) > 0 &&
+				drmModeAtomicMerge(atom.req, crtc->atomic)) {
+			wlr_log_errno(L_ERROR, "Failed to merge atomic requests");
+			goto out;
+		}
+
+		atomic_add(&atom, output->connector, output->props.crtc_id, crtc->id);
+		atomic_add(&atom, crtc->id, crtc->props.mode_id, mode_ids[i]);
+		atomic_add(&atom, crtc->id, crtc->props.active, 1);
+		if (crtc->props.vrr_enabled) {
+			atomic_add(&atom, crtc->id, crtc->props.vrr_enabled,
+				output->adaptive_sync);
+		}
+		set_plane_props(&atom, crtc->primary, crtc->id, fb_ids[i], true);
+	}
+
+	// The kernel refuses active CRTCs without connectors
+	for (size_t i = 0; i < backend->num_crtcs; ++i) {
+		struct wlr_drm_crtc *crtc = &backend->crtcs[i];
+		if (!crtc->mode_id || crtc_is_used(backend, crtc)) {
+			continue;
+		}
+
+		atomic_add(&atom, crtc->id, crtc->props.mode_id, 0);
+		atomic_add(&atom, crtc->id, crtc->props.active, 0);
+		for (int j = 0; j < 3; ++j) {
+			struct wlr_drm_plane *plane = crtc->planes[j];
+			if (plane && plane->id != 0 && !plane_is_used(backend, plane)) {
+				atomic_add(&atom, plane->id, plane->props.fb_id, 0);
+				atomic_add(&atom, plane->id, plane->props.crtc_id, 0);
+			}
+		}
+	}
+
+	if (atom.failed) {
+		goto out;
+	}
+
+	uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_NONBLOCK;
+	if (drmModeAtomicCommit(backend->fd, atom.req,
+			flags | DRM_MODE_ATOMIC_TEST_ONLY, NULL)) {
+		wlr_log_errno(L_DEBUG, "Atomic modeset test failed");
+		goto out;
+	}
+
+	if (drmModeAtomicCommit(backend->fd, atom.req,
+			flags | DRM_MODE_PAGE_FLIP_EVENT, outputs[0])) {
+		wlr_log_errno(L_ERROR, "Atomic modeset failed");
+		goto out;
+	}
+
+	for (size_t i = 0; i < backend->num_crtcs; ++i) {
+		struct wlr_drm_crtc *crtc = &backend->crtcs[i];
+		if (crtc->mode_id && !crtc_is_used(backend, crtc)) {
+			drmModeDestroyPropertyBlob(backend->fd, crtc->mode_id);
+			crtc->mode_id = 0;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		struct wlr_drm_crtc *crtc = outputs[i]->crtc;
+		if (crtc->mode_id) {
+			drmModeDestroyPropertyBlob(backend->fd, crtc->mode_id);
+		}
+		crtc->mode_id = mode_ids[i];
+		if (crtc->atomic) {
+			drmModeAtomicSetCursor(crtc->atomic, 0);
+		}
+		output_commit_adaptive_sync(outputs[i], true);
+	}
+
+	drmModeAtomicFree(atom.req);
+	return true;
+
+out:
+	for (size_t i = 0; i < num_mode_ids; ++i) {
+		drmModeDestroyPropertyBlob(backend->fd, mode_ids[i]);
+	}
+	drmModeAtomicFree(atom.req);
+	return false;
+}
+
 static void atomic_conn_enable(struct wlr_drm_backend *backend,
 		struct wlr_output_state *output, bool enable) {
 	struct wlr_drm_crtc *crtc = output->crtc;
@@ -143,7 +370,8 @@ static bool atomic_crtc_set_cursor(struct wlr_drm_backend *backend,
 	atomic_begin(crtc, &atom);
 
 	if (bo) {
-		set_plane_props(&atom, plane, crtc->id, get_fb_for_bo(bo), false);
+		uint32_t fb_id = get_fb_for_bo(&backend->renderer.fb_cache, bo);
+		set_plane_props(&atom, plane, crtc->id, fb_id, false);
 	} else {
 		atomic_add(&atom, plane->id, plane->props.fb_id, 0);
 		atomic_add(&atom, plane->id, plane->props.crtc_id, 0);
@@ -174,6 +402,10 @@ static bool atomic_crtc_move_cursor(struct wlr_drm_backend *backend,
 const struct wlr_drm_interface atomic_iface = {
 	.conn_enable = atomic_conn_enable,
 	.crtc_pageflip = atomic_crtc_pageflip,
+	.crtc_test_fb = atomic_crtc_test_fb,
+	.outputs_modeset = atomic_outputs_modeset,
+	.crtc_set_overlay = atomic_crtc_set_overlay,
+	.crtc_set_vrr = atomic_crtc_set_vrr,
 	.crtc_set_cursor = atomic_crtc_set_cursor,
 	.crtc_move_cursor = atomic_crtc_move_cursor,
 };
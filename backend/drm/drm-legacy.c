@@ -13,8 +13,20 @@ static bool legacy_crtc_pageflip(struct wlr_drm_backend *backend,
 			&output->connector, 1, mode);
 	}
 
-	drmModePageFlip(backend->fd, crtc->id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, output);
+	if (drmModePageFlip(backend->fd, crtc->id, fb_id,
+			DRM_MODE_PAGE_FLIP_EVENT, output)) {
+		wlr_log_errno(L_ERROR, "Failed to page flip");
+		return false;
+	}
+
+	return true;
+}
 
+static bool legacy_crtc_test_fb(struct wlr_drm_backend *backend,
+		struct wlr_output_state *output, struct wlr_drm_crtc *crtc,
+		uint32_t fb_id) {
+	// There is no way to test without atomic, we have to rely on the
+	// pageflip failing instead
 	return true;
 }
 
@@ -54,6 +66,7 @@ bool legacy_crtc_move_cursor(struct wlr_drm_backend *backend,
 const struct wlr_drm_interface legacy_iface = {
 	.conn_enable = legacy_conn_enable,
 	.crtc_pageflip = legacy_crtc_pageflip,
+	.crtc_test_fb = legacy_crtc_test_fb,
 	.crtc_set_cursor = legacy_crtc_set_cursor,
 	.crtc_move_cursor = legacy_crtc_move_cursor,
 };
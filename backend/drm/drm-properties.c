@@ -19,9 +19,10 @@ struct prop_info {
 
 static const struct prop_info connector_info[] = {
 #define INDEX(name) (offsetof(union wlr_drm_connector_props, name) / sizeof(uint32_t))
-	{ "CRTC_ID", INDEX(crtc_id) },
-	{ "DPMS",    INDEX(dpms) },
-	{ "EDID",    INDEX(edid) },
+	{ "CRTC_ID",     INDEX(crtc_id) },
+	{ "DPMS",        INDEX(dpms) },
+	{ "EDID",        INDEX(edid) },
+	{ "vrr_capable", INDEX(vrr_capable) },
 #undef INDEX
 };
 
@@ -29,6 +30,7 @@ static const struct prop_info crtc_info[] = {
 #define INDEX(name) (offsetof(union wlr_drm_crtc_props, name) / sizeof(uint32_t))
 	{ "ACTIVE",       INDEX(active) },
 	{ "MODE_ID",      INDEX(mode_id) },
+	{ "VRR_ENABLED",  INDEX(vrr_enabled) },
 	{ "rotation",     INDEX(rotation) },
 	{ "scaling mode", INDEX(scaling_mode) },
 #undef INDEX
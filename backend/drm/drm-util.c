@@ -1,6 +1,10 @@
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <drm.h>
+#include <drm_fourcc.h>
 #include <drm_mode.h>
 #include <gbm.h>
 #include "backend/drm-util.h"
@@ -135,169 +139,193 @@ const char *conn_get_name(uint32_t type_id) {
 	}
 }
 
+// Stored as the user data of the gbm_bo
+struct wlr_drm_fb {
+	struct wlr_drm_fb_cache *cache;
+	uint32_t id; // 0 if the framebuffer couldn't be created
+};
+
 static void free_fb(struct gbm_bo *bo, void *data) {
-	uint32_t id = (uintptr_t)data;
+	struct wlr_drm_fb *fb = data;
 
-	if (id) {
-		struct gbm_device *gbm = gbm_bo_get_device(bo);
-		drmModeRmFB(gbm_device_get_fd(gbm), id);
+	if (fb->id) {
+		drmModeRmFB(fb->cache->fd, fb->id);
+		--fb->cache->live;
 	}
+	free(fb);
 }
 
-uint32_t get_fb_for_bo(struct gbm_bo *bo) {
-	uint32_t id = (uintptr_t)gbm_bo_get_user_data(bo);
-	if (id) {
-		return id;
+uint32_t get_fb_for_bo(struct wlr_drm_fb_cache *cache, struct gbm_bo *bo) {
+	struct wlr_drm_fb *fb = gbm_bo_get_user_data(bo);
+	if (fb) {
+		++cache->hits;
+		return fb->id;
 	}
+	++cache->misses;
 
-	struct gbm_device *gbm = gbm_bo_get_device(bo);
+	fb = calloc(1, sizeof(*fb));
+	if (!fb) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return 0;
+	}
+	fb->cache = cache;
 
-	int fd = gbm_device_get_fd(gbm);
 	uint32_t width = gbm_bo_get_width(bo);
 	uint32_t height = gbm_bo_get_height(bo);
-	uint32_t handles[4] = {gbm_bo_get_handle(bo).u32};
-	uint32_t pitches[4] = {gbm_bo_get_stride(bo)};
-	uint32_t offsets[4] = {gbm_bo_get_offset(bo, 0)};
 	uint32_t format = gbm_bo_get_format(bo);
+	uint64_t modifier = gbm_bo_get_modifier(bo);
+
+	uint32_t handles[4] = {0};
+	uint32_t pitches[4] = {0};
+	uint32_t offsets[4] = {0};
+	uint64_t modifiers[4] = {0};
+	int n_planes = gbm_bo_get_plane_count(bo);
+	for (int i = 0; i < n_planes && i < 4; ++i) {
+		handles[i] = gbm_bo_get_handle_for_plane(bo, i).u32;
+		pitches[i] = gbm_bo_get_stride_for_plane(bo, i);
+		offsets[i] = gbm_bo_get_offset(bo, i);
+		modifiers[i] = modifier;
+	}
 
-	if (drmModeAddFB2(fd, width, height, format, handles, pitches, offsets, &id, 0)) {
-		wlr_log_errno(L_ERROR, "Unable to add DRM framebuffer");
+	int ret = -1;
+	if (modifier != DRM_FORMAT_MOD_INVALID && cache->addfb2_modifiers) {
+		ret = drmModeAddFB2WithModifiers(cache->fd, width, height, format,
+			handles, pitches, offsets, modifiers, &fb->id,
+			DRM_MODE_FB_MODIFIERS);
+	} else if (modifier == DRM_FORMAT_MOD_INVALID ||
+			modifier == DRM_FORMAT_MOD_LINEAR) {
+		ret = drmModeAddFB2(cache->fd, width, height, format,
+			handles, pitches, offsets, &fb->id, 0);
+	} else {
+		wlr_log(L_DEBUG, "Framebuffers with modifiers are unsupported");
 	}
 
-	gbm_bo_set_user_data(bo, (void *)(uintptr_t)id, free_fb);
+	if (ret) {
+		wlr_log_errno(L_ERROR, "Unable to add DRM framebuffer");
+		fb->id = 0;
+	} else {
+		++cache->live;
+	}
 
-	return id;
-}
+	// Failures are remembered too, rather than retried every frame
+	gbm_bo_set_user_data(bo, fb, free_fb);
 
-static inline bool is_taken(size_t n, const uint32_t arr[static n], uint32_t key) {
-	for (size_t i = 0; i < n; ++i) {
-		if (arr[i] == key) {
-			return true;
-		}
-	}
-	return false;
+	return fb->id;
 }
 
 /*
- * Store all of the non-recursive state in a struct, so we aren't literally
- * passing 12 arguments to a function.
- */
-struct match_state {
-	const size_t num_objs;
-	const uint32_t *restrict objs;
-	const size_t num_res;
-	size_t score;
-	size_t replaced;
-	uint32_t *restrict res;
-	uint32_t *restrict best;
-	const uint32_t *restrict orig;
-	bool exit_early;
-};
-
-/*
- * skips: The number of SKIP elements encountered so far.
- * score: The number of resources we've matched so far.
- * replaced: The number of changes from the original solution.
- * i: The index of the current element.
+ * The matching is solved as an assignment problem with the Hungarian
+ * algorithm, in O((num_res + num_objs)^3).
  *
- * This tries to match a solution as close to st->orig as it can.
+ * Rows are the resources followed by one dummy row per object, columns are
+ * the objects followed by one dummy column per resource. Putting a resource
+ * in a dummy column leaves it unmatched, dummy rows soak up the objects which
+ * aren't used.
  *
- * Returns whether we've set a new best element with this solution.
+ * A resource leaving its original object costs 1. Leaving a resource
+ * unmatched costs more than all of those changes together, so the number of
+ * matches is maximised first, and the number of changes minimised second.
  */
-static bool match_obj_(struct match_state *st, size_t skips, size_t score, size_t replaced, size_t i) {
-	// Finished
-	if (i >= st->num_res) {
-		if (score > st->score || (score == st->score && replaced < st->replaced)) {
-			st->score = score;
-			st->replaced = replaced;
-			memcpy(st->best, st->res, sizeof st->best[0] * st->num_res);
-
-			if (st->score == st->num_objs && st->replaced == 0) {
-				st->exit_early = true;
+size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
+		size_t num_res, const uint32_t res[static restrict num_res],
+		uint32_t out[static restrict num_res]) {
+	const size_t n = num_res + num_objs;
+	const int unmatched_cost = n + 1;
+	const int forbidden_cost = 2 * unmatched_cost + 2;
+
+	// Everything is 1-indexed, index 0 is the algorithm's sentinel
+	int cost[n + 1][n + 1];
+	for (size_t i = 1; i <= n; ++i) {
+		for (size_t j = 1; j <= n; ++j) {
+			size_t r = i - 1, o = j - 1;
+
+			if (r >= num_res) {
+				cost[i][j] = 0;
+			} else if (o >= num_objs) {
+				if (res[r] == SKIP) {
+					cost[i][j] = 0;
+				} else {
+					cost[i][j] = unmatched_cost + (res[r] != UNMATCHED);
+				}
+			} else if (res[r] == SKIP || r >= 32 || !(objs[o] & (1u << r))) {
+				cost[i][j] = forbidden_cost;
+			} else {
+				cost[i][j] = res[r] != UNMATCHED && res[r] != o;
 			}
-			st->exit_early = (st->score == st->num_res - skips
-					|| st->score == st->num_objs)
-					&& st->replaced == 0;
-
-			return true;
-		} else {
-			return false;
 		}
 	}
 
-	if (st->orig[i] == SKIP) {
-		st->res[i] = SKIP;
-		return match_obj_(st, skips + 1, score, replaced, i + 1);
-	}
+	// Row and column potentials, the row assigned to each column, and the
+	// previous column on the augmenting path
+	int u[n + 1], v[n + 1];
+	size_t p[n + 1], way[n + 1];
+	memset(u, 0, sizeof(u));
+	memset(v, 0, sizeof(v));
+	memset(p, 0, sizeof(p));
+
+	for (size_t i = 1; i <= n; ++i) {
+		int minv[n + 1];
+		bool used[n + 1];
+		for (size_t j = 0; j <= n; ++j) {
+			minv[j] = INT_MAX;
+			used[j] = false;
+		}
 
-	/*
-	 * Attempt to use the current solution first, to try and avoid
-	 * recalculating everything
-	 */
+		// Grow a shortest augmenting path from row i to a free column
+		size_t j0 = 0;
+		p[0] = i;
+		do {
+			used[j0] = true;
+			size_t i0 = p[j0], j1 = 0;
+			int delta = INT_MAX;
+
+			for (size_t j = 1; j <= n; ++j) {
+				if (used[j]) {
+					continue;
+				}
+
+				int cur = cost[i0][j] - u[i0] - v[j];
+				if (cur < minv[j]) {
+					minv[j] = cur;
+					way[j] = j0;
+				}
+				if (minv[j] < delta) {
+					delta = minv[j];
+					j1 = j;
+				}
+			}
 
-	if (st->orig[i] != UNMATCHED && !is_taken(i, st->res, st->orig[i])) {
-		st->res[i] = st->orig[i];
-		if (match_obj_(st, skips, score + 1, replaced, i + 1)) {
-			return true;
-		}
+			for (size_t j = 0; j <= n; ++j) {
+				if (used[j]) {
+					u[p[j]] += delta;
+					v[j] -= delta;
+				} else {
+					minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (p[j0] != 0);
+
+		// Flip the path
+		do {
+			size_t j1 = way[j0];
+			p[j0] = p[j1];
+			j0 = j1;
+		} while (j0 != 0);
 	}
 
-	if (st->orig[i] != UNMATCHED) {
-		++replaced;
+	for (size_t r = 0; r < num_res; ++r) {
+		out[r] = res[r] == SKIP ? SKIP : UNMATCHED;
 	}
 
-	bool is_best = false;
-	for (st->res[i] = 0; st->res[i] < st->num_objs; ++st->res[i]) {
-		// We tried this earlier
-		if (st->res[i] == st->orig[i]) {
-			continue;
-		}
-
-		// Not compatable
-		if (!(st->objs[st->res[i]] & (1 << i))) {
-			continue;
-		}
-
-		// Already taken
-		if (is_taken(i, st->res, st->res[i])) {
-			continue;
-		}
-
-		if (match_obj_(st, skips, score + 1, replaced, i + 1)) {
-			is_best = true;
-		}
-
-		if (st->exit_early) {
-			return true;
+	size_t score = 0;
+	for (size_t j = 1; j <= num_objs; ++j) {
+		size_t r = p[j] - 1;
+		if (r < num_res && cost[p[j]][j] < forbidden_cost) {
+			out[r] = j - 1;
+			++score;
 		}
 	}
 
-	if (is_best) {
-		return true;
-	}
-
-	// Maybe this resource can't be matched
-	st->res[i] = UNMATCHED;
-	return match_obj_(st, skips, score, replaced, i + 1);
-}
-
-size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
-		size_t num_res, const uint32_t res[static restrict num_res],
-		uint32_t out[static restrict num_res]) {
-	uint32_t solution[num_res];
-
-	struct match_state st = {
-		.num_objs = num_objs,
-		.num_res = num_res,
-		.score = 0,
-		.replaced = SIZE_MAX,
-		.objs = objs,
-		.res = solution,
-		.best = out,
-		.orig = res,
-		.exit_early = false,
-	};
-
-	match_obj_(&st, 0, 0, 0, 0);
-	return st.score;
+	return score;
 }
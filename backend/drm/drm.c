@@ -1,12 +1,16 @@
+#define _POSIX_C_SOURCE 199309L
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_mode.h>
+#include <drm_fourcc.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <gbm.h>
@@ -15,6 +19,8 @@
 #include <wayland-server.h>
 #include <wlr/backend/interface.h>
 #include <wlr/interfaces/wlr_output.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
 #include <wlr/util/log.h>
 #include <wlr/render/matrix.h>
 #include <wlr/render/gles2.h>
@@ -39,6 +45,17 @@ bool wlr_drm_check_features(struct wlr_drm_backend *backend) {
 		backend->iface = &atomic_iface;
 	}
 
+	uint64_t cap;
+	backend->monotonic_timestamps =
+		drmGetCap(backend->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) == 0 && cap;
+	if (!backend->monotonic_timestamps) {
+		wlr_log(L_INFO, "DRM timestamps aren't monotonic, "
+			"presentation times will be approximate");
+	}
+
+	backend->crtc_in_vblank_event =
+		drmGetCap(backend->fd, DRM_CAP_CRTC_IN_VBLANK_EVENT, &cap) == 0 && cap;
+
 	return true;
 }
 
@@ -184,6 +201,12 @@ bool wlr_drm_renderer_init(struct wlr_drm_renderer *renderer, int fd) {
 	}
 
 	renderer->fd = fd;
+
+	uint64_t cap;
+	renderer->fb_cache.fd = fd;
+	renderer->fb_cache.addfb2_modifiers =
+		drmGetCap(fd, DRM_CAP_ADDFB2_MODIFIERS, &cap) == 0 && cap;
+	wl_list_init(&renderer->client_bos);
 	return true;
 }
 
@@ -192,6 +215,20 @@ void wlr_drm_renderer_free(struct wlr_drm_renderer *renderer) {
 		return;
 	}
 
+	struct wlr_drm_client_bo *client_bo, *tmp;
+	wl_list_for_each_safe(client_bo, tmp, &renderer->client_bos, link) {
+		wl_list_remove(&client_bo->buffer_destroy.link);
+		wl_list_remove(&client_bo->link);
+		if (client_bo->bo) {
+			gbm_bo_destroy(client_bo->bo);
+		}
+		free(client_bo);
+	}
+
+	wlr_log(L_DEBUG, "Framebuffers: %zu live, %zu cache hits, %zu misses",
+		renderer->fb_cache.live, renderer->fb_cache.hits,
+		renderer->fb_cache.misses);
+
 	wlr_egl_free(&renderer->egl);
 	gbm_device_destroy(renderer->gbm);
 }
@@ -221,6 +258,166 @@ static bool wlr_drm_plane_renderer_init(struct wlr_drm_renderer *renderer,
 	return true;
 }
 
+static void handle_scanout_buffer_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_drm_scanout *scanout =
+		wl_container_of(listener, scanout, buffer_destroy);
+
+	// The imported bo keeps the storage alive, so we can keep displaying it
+	wl_list_remove(&scanout->buffer_destroy.link);
+	scanout->buffer = NULL;
+}
+
+static struct gbm_bo *import_dmabuf(struct wlr_drm_renderer *renderer,
+		struct wlr_dmabuf_buffer *dmabuf) {
+	struct wlr_dmabuf_buffer_attribs *attribs = &dmabuf->attributes;
+
+	// Planes can't flip the buffer, it has to be composited
+	if (wlr_dmabuf_buffer_has_inverted_y(dmabuf)) {
+		return NULL;
+	}
+
+	if (attribs->n_planes == 1 &&
+			attribs->modifier[0] == DRM_FORMAT_MOD_INVALID) {
+		struct gbm_import_fd_data data = {
+			.fd = attribs->fd[0],
+			.width = attribs->width,
+			.height = attribs->height,
+			.stride = attribs->stride[0],
+			.format = attribs->format,
+		};
+		return gbm_bo_import(renderer->gbm, GBM_BO_IMPORT_FD, &data,
+			GBM_BO_USE_SCANOUT);
+	}
+
+	// All planes share the modifier of the first one
+	struct gbm_import_fd_modifier_data data = {
+		.width = attribs->width,
+		.height = attribs->height,
+		.format = attribs->format,
+		.num_fds = attribs->n_planes,
+		.modifier = attribs->modifier[0],
+	};
+	for (int i = 0; i < attribs->n_planes; ++i) {
+		data.fds[i] = attribs->fd[i];
+		data.strides[i] = attribs->stride[i];
+		data.offsets[i] = attribs->offset[i];
+	}
+	return gbm_bo_import(renderer->gbm, GBM_BO_IMPORT_FD_MODIFIER, &data,
+		GBM_BO_USE_SCANOUT);
+}
+
+static void client_bo_destroy(struct wlr_drm_client_bo *client_bo) {
+	if (client_bo->bo) {
+		gbm_bo_destroy(client_bo->bo);
+	}
+	free(client_bo);
+}
+
+static void handle_client_bo_buffer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_drm_client_bo *client_bo =
+		wl_container_of(listener, client_bo, buffer_destroy);
+
+	wl_list_remove(&client_bo->buffer_destroy.link);
+	wl_list_remove(&client_bo->link);
+	client_bo->buffer = NULL;
+	if (client_bo->n_refs == 0) {
+		client_bo_destroy(client_bo);
+	}
+}
+
+// Returns the import of a client buffer, importing it on first use
+static struct wlr_drm_client_bo *client_bo_ref(
+		struct wlr_drm_renderer *renderer, struct wl_resource *buffer) {
+	struct wlr_drm_client_bo *client_bo;
+	wl_list_for_each(client_bo, &renderer->client_bos, link) {
+		if (client_bo->buffer == buffer) {
+			goto out;
+		}
+	}
+
+	client_bo = calloc(1, sizeof(*client_bo));
+	if (!client_bo) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	// Failed imports are remembered too, rather than retried every frame
+	if (wlr_dmabuf_resource_is_buffer(buffer)) {
+		client_bo->bo = import_dmabuf(renderer,
+			wlr_dmabuf_buffer_from_buffer_resource(buffer));
+	} else {
+		client_bo->bo = gbm_bo_import(renderer->gbm, GBM_BO_IMPORT_WL_BUFFER,
+			buffer, GBM_BO_USE_SCANOUT);
+	}
+
+	client_bo->buffer = buffer;
+	client_bo->buffer_destroy.notify = handle_client_bo_buffer_destroy;
+	wl_resource_add_destroy_listener(buffer, &client_bo->buffer_destroy);
+	wl_list_insert(&renderer->client_bos, &client_bo->link);
+
+out:
+	if (!client_bo->bo) {
+		return NULL;
+	}
+	++client_bo->n_refs;
+	return client_bo;
+}
+
+static void client_bo_unref(struct wlr_drm_client_bo *client_bo) {
+	if (--client_bo->n_refs == 0 && !client_bo->buffer) {
+		client_bo_destroy(client_bo);
+	}
+}
+
+static struct wlr_drm_scanout *wlr_drm_scanout_create(
+		struct wlr_drm_renderer *renderer, struct wl_resource *buffer) {
+	struct wlr_drm_scanout *scanout = calloc(1, sizeof(*scanout));
+	if (!scanout) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	scanout->client_bo = client_bo_ref(renderer, buffer);
+	if (!scanout->client_bo) {
+		free(scanout);
+		return NULL;
+	}
+	scanout->bo = scanout->client_bo->bo;
+
+	scanout->buffer = buffer;
+	scanout->buffer_destroy.notify = handle_scanout_buffer_destroy;
+	wl_resource_add_destroy_listener(buffer, &scanout->buffer_destroy);
+	wlr_buffer_lock(buffer);
+
+	return scanout;
+}
+
+static void wlr_drm_scanout_destroy(struct wlr_drm_scanout *scanout) {
+	if (!scanout) {
+		return;
+	}
+
+	if (scanout->buffer) {
+		wl_list_remove(&scanout->buffer_destroy.link);
+		wlr_buffer_unlock(scanout->buffer);
+	}
+
+	client_bo_unref(scanout->client_bo);
+	free(scanout);
+}
+
+// Our own buffer is about to replace the client buffer on the screen
+static void wlr_drm_plane_retire_scanout(struct wlr_drm_plane *plane) {
+	if (!plane->scanout_back) {
+		return;
+	}
+
+	wlr_drm_scanout_destroy(plane->scanout_front);
+	plane->scanout_front = plane->scanout_back;
+	plane->scanout_back = NULL;
+}
+
 static void wlr_drm_plane_renderer_free(struct wlr_drm_renderer *renderer,
 		struct wlr_drm_plane *plane) {
 	if (!renderer || !plane) {
@@ -236,6 +433,9 @@ static void wlr_drm_plane_renderer_free(struct wlr_drm_renderer *renderer,
 		gbm_surface_release_buffer(plane->gbm, plane->back);
 	}
 
+	wlr_drm_scanout_destroy(plane->scanout_front);
+	wlr_drm_scanout_destroy(plane->scanout_back);
+
 	if (plane->egl) {
 		eglDestroySurface(renderer->egl.display, plane->egl);
 	}
@@ -259,6 +459,10 @@ static void wlr_drm_plane_renderer_free(struct wlr_drm_renderer *renderer,
 	plane->gbm = NULL;
 	plane->front = NULL;
 	plane->back = NULL;
+	plane->scanout_front = NULL;
+	plane->scanout_back = NULL;
+	plane->overlay_crtc = NULL;
+	plane->overlay_used = false;
 	plane->wlr_rend = NULL;
 	plane->wlr_tex = NULL;
 	plane->cursor_bo = NULL;
@@ -282,10 +486,132 @@ static void wlr_drm_plane_swap_buffers(struct wlr_drm_renderer *renderer,
 	plane->back = gbm_surface_lock_front_buffer(plane->gbm);
 }
 
+// Remove the overlays which weren't assigned again for this frame
+static void wlr_drm_output_flush_overlays(struct wlr_output_state *output) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
+	struct wlr_drm_crtc *crtc = output->crtc;
+
+	for (size_t i = 0; i < backend->num_overlay_planes; ++i) {
+		struct wlr_drm_plane *plane = &backend->overlay_planes[i];
+		if (plane->overlay_crtc != crtc) {
+			continue;
+		}
+
+		if (!plane->overlay_used && plane->scanout_back) {
+			backend->iface->crtc_set_overlay(backend, crtc, plane, 0, 0, 0, 0, 0);
+			wlr_drm_plane_retire_scanout(plane);
+		}
+		plane->overlay_used = false;
+	}
+}
+
 static void wlr_drm_output_make_current(struct wlr_output_state *output) {
 	wlr_drm_plane_make_current(output->renderer, output->crtc->primary);
 }
 
+// How long to wait for a page flip before giving up on it
+#define PAGEFLIP_TIMEOUT 1000 // ms
+
+static void send_deferred_events(void *data) {
+	struct wlr_drm_backend *backend = data;
+	backend->deferred_idle = NULL;
+
+	for (size_t i = 0; i < backend->outputs->length; ++i) {
+		struct wlr_output_state *output = backend->outputs->items[i];
+		if (!output->deferred.pending) {
+			continue;
+		}
+		output->deferred.pending = false;
+
+		if (output->state != WLR_DRM_OUTPUT_CONNECTED ||
+				output->pageflip_pending || output->modeset_pending) {
+			// Whatever happened since then sends its own frame event
+			continue;
+		}
+		if (!output->deferred.present) {
+			output->base->frame_pending = false;
+			continue;
+		}
+		wlr_output_send_present(output->base, output->deferred.has_when ?
+			&output->deferred.when : NULL, output->deferred.seq,
+			output->deferred.flags);
+		wlr_output_send_frame(output->base);
+	}
+}
+
+/*
+ * Holds back the frame event of output until the event loop is idle. Without
+ * present, the output is only unblocked for the next frame.
+ */
+static void defer_frame_event(struct wlr_drm_backend *backend,
+		struct wlr_output_state *output, bool present,
+		const struct timespec *when, unsigned seq, uint32_t flags) {
+	output->deferred.pending = true;
+	output->deferred.present = present;
+	output->deferred.has_when = when != NULL;
+	if (when) {
+		output->deferred.when = *when;
+	}
+	output->deferred.seq = seq;
+	output->deferred.flags = flags;
+
+	if (!backend->deferred_idle) {
+		struct wl_event_loop *ev = wl_display_get_event_loop(backend->display);
+		backend->deferred_idle =
+			wl_event_loop_add_idle(ev, send_deferred_events, backend);
+	}
+}
+
+static int64_t monotonic_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Blocks until the pending page flip of output completed. Flip events of
+ * other outputs handled meanwhile have their frame events deferred. If the
+ * flip doesn't arrive in time, it is assumed lost.
+ */
+static void wait_for_pageflip(struct wlr_drm_backend *backend,
+		struct wlr_output_state *output) {
+	if (!output->pageflip_pending) {
+		return;
+	}
+
+	bool draining = backend->draining_flips;
+	backend->draining_flips = true;
+
+	int64_t deadline = monotonic_ms() + PAGEFLIP_TIMEOUT;
+	while (output->pageflip_pending) {
+		int timeout = deadline - monotonic_ms();
+		if (timeout <= 0) {
+			wlr_log(L_ERROR, "%s: timed out waiting for page flip",
+				output->base->name);
+			output->pageflip_pending = false;
+			break;
+		}
+
+		struct pollfd pfd = { .fd = backend->fd, .events = POLLIN };
+		int ret = poll(&pfd, 1, timeout);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			wlr_log_errno(L_ERROR, "%s: failed to wait for page flip",
+				output->base->name);
+			output->pageflip_pending = false;
+			break;
+		}
+		if (ret > 0) {
+			wlr_drm_event(backend->fd, 0, NULL);
+		}
+	}
+
+	backend->draining_flips = draining;
+}
+
 static void wlr_drm_output_swap_buffers(struct wlr_output_state *output) {
 	struct wlr_drm_backend *backend =
 		wl_container_of(output->renderer, backend, renderer);
@@ -294,22 +620,225 @@ static void wlr_drm_output_swap_buffers(struct wlr_output_state *output) {
 	struct wlr_drm_plane *plane = crtc->primary;
 
 	wlr_drm_plane_swap_buffers(renderer, plane);
-
-	backend->iface->crtc_pageflip(backend, output, crtc, get_fb_for_bo(plane->back), NULL);
+	wlr_drm_plane_retire_scanout(plane);
+	wlr_drm_output_flush_overlays(output);
+
+	if (!backend->iface->crtc_pageflip(backend, output, crtc,
+			get_fb_for_bo(&renderer->fb_cache, plane->back), NULL)) {
+		wlr_log(L_ERROR, "%s: page flip failed", output->base->name);
+		// No flip event will come, let damage start the next frame
+		defer_frame_event(backend, output, false, NULL, 0, 0);
+		return;
+	}
 	output->pageflip_pending = true;
 }
 
-void wlr_drm_output_start_renderer(struct wlr_output_state *output) {
+static bool wlr_drm_output_skip_frame(struct wlr_output_state *output) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
 	if (output->state != WLR_DRM_OUTPUT_CONNECTED) {
-		return;
+		return false;
+	}
+	if (output->pageflip_pending) {
+		return true;
+	}
+
+	// Atomic cursor updates only go out with the next commit, so flip to
+	// whatever is on the screen again if there are any. Otherwise the output
+	// goes idle until a frame is scheduled.
+	struct wlr_drm_crtc *crtc = output->crtc;
+	if (!crtc->atomic || drmModeAtomicGetCursor(crtc->atomic) == 0) {
+		return false;
+	}
+
+	struct wlr_drm_plane *plane = crtc->primary;
+	struct gbm_bo *bo = plane->scanout_back ? plane->scanout_back->bo : plane->back;
+	if (!bo) {
+		return false;
+	}
+
+	if (!backend->iface->crtc_pageflip(backend, output, crtc,
+			get_fb_for_bo(&output->renderer->fb_cache, bo), NULL)) {
+		return false;
 	}
+	output->pageflip_pending = true;
+	return true;
+}
+
+static int wlr_drm_output_get_buffer_age(struct wlr_output_state *output) {
+	struct wlr_drm_renderer *renderer = output->renderer;
+	return wlr_egl_get_buffer_age(&renderer->egl, output->crtc->primary->egl);
+}
 
+static bool wlr_drm_output_present_buffer(struct wlr_output_state *output,
+		struct wl_resource *buffer) {
 	struct wlr_drm_backend *backend =
 		wl_container_of(output->renderer, backend, renderer);
-	struct wlr_drm_renderer *renderer = output->renderer;
+	if (output->state != WLR_DRM_OUTPUT_CONNECTED || output->pageflip_pending) {
+		return false;
+	}
+
 	struct wlr_drm_crtc *crtc = output->crtc;
 	struct wlr_drm_plane *plane = crtc->primary;
 
+	// The overlays are only removed along with a flip to the buffer. If it
+	// can't be scanned out, they stay for the compositor to assign again.
+
+	// This buffer is already on the screen, just flip to it again
+	struct wlr_drm_scanout *scanout = plane->scanout_back;
+	if (scanout && scanout->buffer == buffer) {
+		wlr_drm_output_flush_overlays(output);
+		if (!backend->iface->crtc_pageflip(backend, output, crtc,
+				get_fb_for_bo(&output->renderer->fb_cache, scanout->bo),
+				NULL)) {
+			return false;
+		}
+		output->pageflip_pending = true;
+		return true;
+	}
+
+	scanout = wlr_drm_scanout_create(output->renderer, buffer);
+	if (!scanout) {
+		return false;
+	}
+
+	if (gbm_bo_get_width(scanout->bo) != plane->width ||
+			gbm_bo_get_height(scanout->bo) != plane->height) {
+		goto error;
+	}
+
+	uint32_t fb_id = get_fb_for_bo(&output->renderer->fb_cache, scanout->bo);
+	if (!fb_id) {
+		goto error;
+	}
+
+	if (!backend->iface->crtc_test_fb(backend, output, crtc, fb_id)) {
+		wlr_log(L_DEBUG, "%s: buffer rejected for direct scanout",
+			output->base->name);
+		goto error;
+	}
+
+	wlr_drm_output_flush_overlays(output);
+	if (!backend->iface->crtc_pageflip(backend, output, crtc, fb_id, NULL)) {
+		goto error;
+	}
+	output->pageflip_pending = true;
+
+	wlr_drm_scanout_destroy(plane->scanout_front);
+	plane->scanout_front = plane->scanout_back;
+	plane->scanout_back = scanout;
+	return true;
+
+error:
+	wlr_drm_scanout_destroy(scanout);
+	return false;
+}
+
+static bool plane_is_reserved(struct wlr_drm_backend *backend,
+		struct wlr_drm_plane *plane) {
+	for (size_t i = 0; i < backend->num_crtcs; ++i) {
+		if (backend->crtcs[i].overlay == plane) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool wlr_drm_output_assign_overlay(struct wlr_output_state *output,
+		struct wlr_drm_plane *plane, struct wlr_output_overlay *overlay) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
+	struct wlr_drm_crtc *crtc = output->crtc;
+
+	struct wlr_drm_scanout *scanout = plane->scanout_back;
+	bool reuse = scanout && scanout->buffer == overlay->buffer;
+	if (!reuse) {
+		scanout = wlr_drm_scanout_create(output->renderer, overlay->buffer);
+		if (!scanout) {
+			return false;
+		}
+	}
+
+	uint32_t fb_id = get_fb_for_bo(&output->renderer->fb_cache, scanout->bo);
+	if (!fb_id || !backend->iface->crtc_set_overlay(backend, crtc, plane,
+			fb_id, overlay->x, overlay->y,
+			gbm_bo_get_width(scanout->bo), gbm_bo_get_height(scanout->bo))) {
+		if (!reuse) {
+			wlr_drm_scanout_destroy(scanout);
+		}
+		return false;
+	}
+
+	if (!reuse) {
+		wlr_drm_plane_retire_scanout(plane);
+		plane->scanout_back = scanout;
+	}
+	plane->overlay_crtc = crtc;
+	plane->overlay_used = true;
+	return true;
+}
+
+static size_t wlr_drm_output_assign_overlays(struct wlr_output_state *output,
+		size_t count, struct wlr_output_overlay *overlays) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
+	if (output->state != WLR_DRM_OUTPUT_CONNECTED || output->pageflip_pending ||
+			!backend->iface->crtc_set_overlay) {
+		return 0;
+	}
+
+	struct wlr_drm_crtc *crtc = output->crtc;
+	uint32_t crtc_mask = 1 << (crtc - backend->crtcs);
+
+	// Our own overlay plane comes first, then the ones no CRTC was given
+	struct wlr_drm_plane *planes[backend->num_overlay_planes];
+	size_t num_planes = 0;
+	if (crtc->overlay) {
+		planes[num_planes++] = crtc->overlay;
+	}
+	for (size_t i = 0; i < backend->num_overlay_planes; ++i) {
+		struct wlr_drm_plane *plane = &backend->overlay_planes[i];
+		if ((plane->possible_crtcs & crtc_mask) &&
+				(!plane->overlay_crtc || plane->overlay_crtc == crtc) &&
+				!plane_is_reserved(backend, plane)) {
+			planes[num_planes++] = plane;
+		}
+	}
+
+	size_t accepted = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct wlr_output_overlay *overlay = &overlays[i];
+
+		// Keep buffers on the plane they are already on if possible
+		for (size_t j = 0; j < num_planes && !overlay->accepted; ++j) {
+			struct wlr_drm_plane *plane = planes[j];
+			if (!plane->overlay_used && plane->scanout_back &&
+					plane->scanout_back->buffer == overlay->buffer) {
+				overlay->accepted =
+					wlr_drm_output_assign_overlay(output, plane, overlay);
+			}
+		}
+
+		for (size_t j = 0; j < num_planes && !overlay->accepted; ++j) {
+			if (!planes[j]->overlay_used) {
+				overlay->accepted =
+					wlr_drm_output_assign_overlay(output, planes[j], overlay);
+			}
+		}
+
+		if (overlay->accepted) {
+			++accepted;
+		}
+	}
+
+	return accepted;
+}
+
+// Returns the framebuffer to show when the output is modeset
+static uint32_t get_modeset_fb(struct wlr_output_state *output) {
+	struct wlr_drm_renderer *renderer = output->renderer;
+	struct wlr_drm_plane *plane = output->crtc->primary;
+
 	struct gbm_bo *bo = plane->front;
 	if (!bo) {
 		// Render a black frame to start the rendering loop
@@ -321,10 +850,86 @@ void wlr_drm_output_start_renderer(struct wlr_output_state *output) {
 
 		bo = plane->back;
 	}
+	wlr_drm_plane_retire_scanout(plane);
+
+	return get_fb_for_bo(&renderer->fb_cache, bo);
+}
+
+static void output_modeset(struct wlr_output_state *output, uint32_t fb_id) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
 
 	drmModeModeInfo *mode = &output->base->current_mode->state->mode;
-	backend->iface->crtc_pageflip(backend, output, crtc, get_fb_for_bo(bo), mode);
+	backend->iface->crtc_pageflip(backend, output, output->crtc, fb_id, mode);
 	output->pageflip_pending = true;
+	output->base->frame_pending = true;
+}
+
+void wlr_drm_output_start_renderer(struct wlr_output_state *output) {
+	if (output->state != WLR_DRM_OUTPUT_CONNECTED) {
+		return;
+	}
+
+	output_modeset(output, get_modeset_fb(output));
+}
+
+/*
+ * Modesets the outputs marked with modeset_pending. With atomic modesetting
+ * they all go out in one commit, after the kernel accepted it in a test, so
+ * the screens change once and together. Outputs not taking part keep
+ * displaying their frames undisturbed. Otherwise, or if the combined commit
+ * is rejected, the outputs are modeset one by one. Within a configuration
+ * transaction, this waits for it to be committed.
+ */
+void wlr_drm_modeset_outputs(struct wlr_drm_backend *backend) {
+	if (backend->config_depth > 0) {
+		return;
+	}
+
+	size_t len = backend->outputs->length;
+	struct wlr_output_state *outputs[len + 1];
+	uint32_t fb_ids[len + 1];
+	size_t count = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		struct wlr_output_state *output = backend->outputs->items[i];
+		if (output->state != WLR_DRM_OUTPUT_CONNECTED ||
+				!output->modeset_pending) {
+			continue;
+		}
+
+		// Nothing can be committed on top of a pending flip
+		wait_for_pageflip(backend, output);
+
+		outputs[count] = output;
+		fb_ids[count] = get_modeset_fb(output);
+		++count;
+	}
+
+	if (count == 0) {
+		return;
+	}
+
+	bool together = backend->iface->outputs_modeset &&
+		backend->crtc_in_vblank_event;
+	if (together &&
+			backend->iface->outputs_modeset(backend, count, outputs, fb_ids)) {
+		for (size_t i = 0; i < count; ++i) {
+			outputs[i]->modeset_pending = false;
+			outputs[i]->pageflip_pending = true;
+			outputs[i]->base->frame_pending = true;
+		}
+		return;
+	}
+
+	if (together) {
+		wlr_log(L_INFO, "Combined modeset was rejected, "
+			"modesetting outputs one by one");
+	}
+	for (size_t i = 0; i < count; ++i) {
+		outputs[i]->modeset_pending = false;
+		output_modeset(outputs[i], fb_ids[i]);
+	}
 }
 
 static void wlr_drm_output_enable(struct wlr_output_state *output, bool enable) {
@@ -442,6 +1047,9 @@ static void realloc_crtcs(struct wlr_drm_backend *backend,
 
 		if (crtc_res[i] != crtc[i]) {
 			struct wlr_output_state *o = backend->outputs->items[crtc_res[i]];
+			// The flip event has to arrive while the old CRTC is in place
+			o->modeset_pending = true;
+			wait_for_pageflip(backend, o);
 			o->crtc = &backend->crtcs[i];
 		}
 	}
@@ -479,6 +1087,7 @@ static bool wlr_drm_output_set_mode(struct wlr_output_state *output,
 	}
 
 	output->possible_crtc = enc->possible_crtcs;
+	output->modeset_pending = true;
 	realloc_crtcs(backend, output);
 
 	if (!output->crtc) {
@@ -510,16 +1119,24 @@ static bool wlr_drm_output_set_mode(struct wlr_output_state *output,
 			continue;
 		}
 
+		// The primary plane was taken away, so there's nothing to show
+		if (!crtc->primary->gbm) {
+			output->modeset_pending = true;
+		}
+
 		if (!wlr_drm_plane_renderer_init(&backend->renderer, crtc->primary,
 				mode->width, mode->height, GBM_FORMAT_XRGB8888,
 				GBM_BO_USE_SCANOUT)) {
 			wlr_log(L_ERROR, "Failed to initalise renderer for plane");
 			goto error_enc;
 		}
-
-		wlr_drm_output_start_renderer(output);
 	}
 
+	wlr_drm_modeset_outputs(backend);
+	wlr_log(L_DEBUG, "Framebuffers: %zu live, %zu cache hits, %zu misses",
+		backend->renderer.fb_cache.live, backend->renderer.fb_cache.hits,
+		backend->renderer.fb_cache.misses);
+
 	drmModeFreeEncoder(enc);
 	drmModeFreeConnector(conn);
 	return true;
@@ -533,55 +1150,128 @@ error_output:
 	return false;
 }
 
+static bool wlr_drm_output_set_adaptive_sync(struct wlr_output_state *output,
+		bool enable) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
+	if (output->adaptive_sync == enable) {
+		return true;
+	}
+	if (enable && !output->base->adaptive_sync_capable) {
+		return false;
+	}
+	if (!backend->iface->crtc_set_vrr) {
+		return !enable;
+	}
+
+	// Otherwise the setting is applied with the modeset
+	if (output->state != WLR_DRM_OUTPUT_CONNECTED) {
+		output->adaptive_sync = enable;
+		output->adaptive_sync_pending = true;
+		return true;
+	}
+
+	if (!backend->iface->crtc_set_vrr(backend, output->crtc, enable)) {
+		wlr_log(L_ERROR, "Failed to %s adaptive sync on '%s'",
+			enable ? "enable" : "disable", output->base->name);
+		return false;
+	}
+	// base->adaptive_sync follows once the next page flip commits it
+	output->adaptive_sync = enable;
+	output->adaptive_sync_pending = true;
+
+	// Commit the property even if nothing is redrawn
+	wlr_output_schedule_frame(output->base);
+	return true;
+}
+
 static void wlr_drm_output_transform(struct wlr_output_state *output,
 		enum wl_output_transform transform) {
 	output->base->transform = transform;
 }
 
-static bool wlr_drm_output_set_cursor(struct wlr_output_state *output,
-		const uint8_t *buf, int32_t stride, uint32_t width, uint32_t height) {
-	struct wlr_drm_backend *backend
-		= wl_container_of(output->renderer, backend, renderer);
-	struct wlr_drm_renderer *renderer = output->renderer;
-	struct wlr_drm_crtc *crtc = output->crtc;
-	struct wlr_drm_plane *plane = crtc->cursor;
-
-	if (!buf) {
-		return backend->iface->crtc_set_cursor(backend, crtc, NULL);
+// Copies the cursor image into a cursor plane sized buffer, rotated like
+// the output
+static void transform_cursor(uint32_t *dst, uint32_t dst_width,
+		uint32_t dst_height, const uint32_t *src, int32_t src_stride,
+		uint32_t width, uint32_t height, enum wl_output_transform transform) {
+	memset(dst, 0, dst_width * dst_height * sizeof(*dst));
+
+	if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		for (uint32_t y = 0; y < height; ++y) {
+			memcpy(&dst[y * dst_width], &src[y * src_stride],
+				width * sizeof(*dst));
+		}
+		return;
 	}
 
-	// We don't have a real cursor plane, so we make a fake one
-	if (!plane) {
-		plane = calloc(1, sizeof(*plane));
-		if (!plane) {
-			wlr_log_errno(L_ERROR, "Allocation failed");
-			return false;
+	uint32_t w = dst_width - 1, h = dst_height - 1;
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			uint32_t dx, dy;
+			switch (transform) {
+			case WL_OUTPUT_TRANSFORM_90:          dx = w - y; dy = x;     break;
+			case WL_OUTPUT_TRANSFORM_180:         dx = w - x; dy = h - y; break;
+			case WL_OUTPUT_TRANSFORM_270:         dx = y;     dy = h - x; break;
+			case WL_OUTPUT_TRANSFORM_FLIPPED:     dx = w - x; dy = y;     break;
+			case WL_OUTPUT_TRANSFORM_FLIPPED_90:  dx = y;     dy = x;     break;
+			case WL_OUTPUT_TRANSFORM_FLIPPED_180: dx = x;     dy = h - y; break;
+			case WL_OUTPUT_TRANSFORM_FLIPPED_270: dx = w - y; dy = h - x; break;
+			default:                              dx = x;     dy = y;     break;
+			}
+			dst[dy * dst_width + dx] = src[y * src_stride + x];
 		}
-		crtc->cursor = plane;
 	}
+}
 
-	if (!plane->gbm) {
-		int ret;
-		uint64_t w, h;
-		ret = drmGetCap(backend->fd, DRM_CAP_CURSOR_WIDTH, &w);
-		w = ret ? 64 : w;
-		ret = drmGetCap(backend->fd, DRM_CAP_CURSOR_HEIGHT, &h);
-		h = ret ? 64 : h;
+// Writes the cursor image straight into the cursor bo, without the GPU
+static bool upload_cursor_cpu(struct gbm_bo *bo, const uint8_t *buf,
+		int32_t stride, uint32_t width, uint32_t height,
+		enum wl_output_transform transform) {
+	uint32_t bo_width = gbm_bo_get_width(bo);
+	uint32_t bo_height = gbm_bo_get_height(bo);
+	// gbm_bo_write expects tightly packed rows
+	if (gbm_bo_get_stride(bo) != bo_width * 4) {
+		return false;
+	}
+	// The image is rotated into the bo for 90 and 270 degree transforms, and
+	// the cursor caps may give it a different width and height
+	if (transform % 2 == 1 ? (height > bo_width || width > bo_height) :
+			(width > bo_width || height > bo_height)) {
+		return false;
+	}
 
-		if (width > w || height > h) {
-			wlr_log(L_INFO, "Cursor too large (max %dx%d)", (int)w, (int)h);
-			return false;
-		}
+	uint32_t *pixels = malloc(bo_width * bo_height * 4);
+	if (!pixels) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return false;
+	}
 
-		if (!wlr_drm_plane_renderer_init(renderer, plane, w, h, GBM_FORMAT_ARGB8888, 0)) {
-			wlr_log(L_ERROR, "Cannot allocate cursor resources");
-			return false;
-		}
+	transform_cursor(pixels, bo_width, bo_height, (const uint32_t *)buf,
+		stride, width, height, transform);
+	int ret = gbm_bo_write(bo, pixels, bo_width * bo_height * 4);
+	free(pixels);
+	if (ret) {
+		wlr_log_errno(L_DEBUG, "Failed to write cursor bo");
+		return false;
+	}
+	return true;
+}
 
-		plane->cursor_bo = gbm_bo_create(renderer->gbm, w, h, GBM_FORMAT_ARGB8888,
-			GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
-		if (!plane->cursor_bo) {
-			wlr_log_errno(L_ERROR, "Failed to create cursor bo");
+// Renders the cursor with GLES2 and reads it back into the cursor bo, for
+// drivers which don't support writing to it directly
+static bool upload_cursor_gl(struct wlr_drm_backend *backend,
+		struct wlr_output_state *output, struct wlr_drm_plane *plane,
+		const uint8_t *buf, int32_t stride, uint32_t width, uint32_t height) {
+	struct wlr_drm_renderer *renderer = output->renderer;
+	struct gbm_bo *bo = plane->cursor_bo;
+	uint32_t bo_width = gbm_bo_get_width(bo);
+	uint32_t bo_height = gbm_bo_get_height(bo);
+
+	if (!plane->wlr_tex) {
+		if (!wlr_drm_plane_renderer_init(renderer, plane, bo_width, bo_height,
+				GBM_FORMAT_ARGB8888, 0)) {
+			wlr_log(L_ERROR, "Cannot allocate cursor resources");
 			return false;
 		}
 
@@ -601,12 +1291,8 @@ static bool wlr_drm_output_set_cursor(struct wlr_output_state *output,
 		}
 	}
 
-	struct gbm_bo *bo = plane->cursor_bo;
-	uint32_t bo_width = gbm_bo_get_width(bo);
-	uint32_t bo_height = gbm_bo_get_height(bo);
 	uint32_t bo_stride;
 	void *bo_data;
-
 	if (!gbm_bo_map(bo, 0, 0, bo_width, bo_height,
 			GBM_BO_TRANSFER_WRITE, &bo_stride, &bo_data)) {
 		wlr_log_errno(L_ERROR, "Unable to map buffer");
@@ -634,6 +1320,62 @@ static bool wlr_drm_output_set_cursor(struct wlr_output_state *output,
 	wlr_drm_plane_swap_buffers(renderer, plane);
 
 	gbm_bo_unmap(bo, bo_data);
+	return true;
+}
+
+static bool wlr_drm_output_set_cursor(struct wlr_output_state *output,
+		const uint8_t *buf, int32_t stride, uint32_t width, uint32_t height) {
+	struct wlr_drm_backend *backend
+		= wl_container_of(output->renderer, backend, renderer);
+	struct wlr_drm_renderer *renderer = output->renderer;
+	struct wlr_drm_crtc *crtc = output->crtc;
+	struct wlr_drm_plane *plane = crtc->cursor;
+
+	if (!buf) {
+		return backend->iface->crtc_set_cursor(backend, crtc, NULL);
+	}
+
+	// We don't have a real cursor plane, so we make a fake one
+	if (!plane) {
+		plane = calloc(1, sizeof(*plane));
+		if (!plane) {
+			wlr_log_errno(L_ERROR, "Allocation failed");
+			return false;
+		}
+		crtc->cursor = plane;
+	}
+
+	if (!plane->cursor_bo) {
+		int ret;
+		uint64_t w, h;
+		ret = drmGetCap(backend->fd, DRM_CAP_CURSOR_WIDTH, &w);
+		w = ret ? 64 : w;
+		ret = drmGetCap(backend->fd, DRM_CAP_CURSOR_HEIGHT, &h);
+		h = ret ? 64 : h;
+
+		plane->cursor_bo = gbm_bo_create(renderer->gbm, w, h, GBM_FORMAT_ARGB8888,
+			GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+		if (!plane->cursor_bo) {
+			wlr_log_errno(L_ERROR, "Failed to create cursor bo");
+			return false;
+		}
+	}
+
+	struct gbm_bo *bo = plane->cursor_bo;
+	if (width > gbm_bo_get_width(bo) || height > gbm_bo_get_height(bo)) {
+		wlr_log(L_INFO, "Cursor too large (max %ux%u)",
+			gbm_bo_get_width(bo), gbm_bo_get_height(bo));
+		return false;
+	}
+
+	// Once the GPU path was needed, it's kept for good
+	if (plane->wlr_tex || !upload_cursor_cpu(bo, buf, stride, width, height,
+			output->base->transform)) {
+		if (!upload_cursor_gl(backend, output, plane, buf, stride,
+				width, height)) {
+			return false;
+		}
+	}
 
 	return backend->iface->crtc_set_cursor(backend, crtc, bo);
 }
@@ -659,6 +1401,11 @@ static struct wlr_output_impl output_impl = {
 	.destroy = wlr_drm_output_destroy,
 	.make_current = wlr_drm_output_make_current,
 	.swap_buffers = wlr_drm_output_swap_buffers,
+	.skip_frame = wlr_drm_output_skip_frame,
+	.get_buffer_age = wlr_drm_output_get_buffer_age,
+	.present_buffer = wlr_drm_output_present_buffer,
+	.assign_overlays = wlr_drm_output_assign_overlays,
+	.set_adaptive_sync = wlr_drm_output_set_adaptive_sync,
 };
 
 static int find_id(const void *item, const void *cmp_to) {
@@ -692,6 +1439,8 @@ void wlr_drm_scan_connectors(struct wlr_drm_backend *backend) {
 		return;
 	}
 
+	// Modes set by the output_add handlers go out together
+	wlr_drm_backend_begin_config(&backend->backend);
 	for (int i = 0; i < res->count_connectors; ++i) {
 		drmModeConnector *conn = drmModeGetConnector(backend->fd,
 			res->connectors[i]);
@@ -776,6 +1525,15 @@ void wlr_drm_scan_connectors(struct wlr_drm_backend *backend) {
 				list_add(output->base->modes, mode);
 			}
 
+			uint64_t vrr_capable = 0;
+			if (output->props.vrr_capable) {
+				wlr_drm_get_prop(backend->fd, output->connector,
+					output->props.vrr_capable, &vrr_capable);
+			}
+			output->base->adaptive_sync_capable = vrr_capable;
+			wlr_log(L_INFO, "%s: Adaptive sync %ssupported",
+				output->base->name, vrr_capable ? "" : "not ");
+
 			output->state = WLR_DRM_OUTPUT_NEEDS_MODESET;
 			wlr_log(L_INFO, "Sending modesetting signal for '%s'", output->base->name);
 			wl_signal_emit(&backend->backend.events.output_add, output->base);
@@ -788,36 +1546,94 @@ void wlr_drm_scan_connectors(struct wlr_drm_backend *backend) {
 
 		drmModeFreeConnector(conn);
 	}
+	wlr_drm_backend_commit_config(&backend->backend);
 
 	drmModeFreeResources(res);
 }
 
+static struct wlr_output_state *find_output_by_crtc(
+		struct wlr_drm_backend *backend, uint32_t crtc_id) {
+	for (size_t i = 0; i < backend->outputs->length; ++i) {
+		struct wlr_output_state *output = backend->outputs->items[i];
+		if (output->crtc && output->crtc->id == crtc_id) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
 static void page_flip_handler(int fd, unsigned seq,
-		unsigned tv_sec, unsigned tv_usec, void *user) {
+		unsigned tv_sec, unsigned tv_usec, unsigned crtc_id, void *user) {
 	struct wlr_output_state *output = user;
 	struct wlr_drm_backend *backend =
 		wl_container_of(output->renderer, backend, renderer);
 
+	// Commits of several CRTCs send one event per CRTC with the same user
+	// data. Old kernels don't tell the CRTC, but then we don't do those.
+	if (crtc_id != 0) {
+		struct wlr_output_state *o = find_output_by_crtc(backend, crtc_id);
+		if (o) {
+			output = o;
+		} else if (output->crtc) {
+			// A CRTC which was turned off
+			return;
+		}
+	}
+
 	output->pageflip_pending = false;
 	if (output->state != WLR_DRM_OUTPUT_CONNECTED) {
 		return;
 	}
 
 	struct wlr_drm_plane *plane = output->crtc->primary;
+	uint32_t present_flags = WLR_OUTPUT_PRESENT_VSYNC |
+		WLR_OUTPUT_PRESENT_HW_CLOCK | WLR_OUTPUT_PRESENT_HW_COMPLETION;
+	// scanout_back is what was just flipped to, scanout_front is retired
+	if (plane->scanout_back) {
+		present_flags |= WLR_OUTPUT_PRESENT_ZERO_COPY;
+	}
 	if (plane->front) {
 		gbm_surface_release_buffer(plane->gbm, plane->front);
 		plane->front = NULL;
 	}
+	wlr_drm_scanout_destroy(plane->scanout_front);
+	plane->scanout_front = NULL;
+
+	for (size_t i = 0; i < backend->num_overlay_planes; ++i) {
+		struct wlr_drm_plane *overlay = &backend->overlay_planes[i];
+		if (overlay->overlay_crtc != output->crtc) {
+			continue;
+		}
 
-	if (backend->session->active) {
-		wl_signal_emit(&output->base->events.frame, output->base);
+		wlr_drm_scanout_destroy(overlay->scanout_front);
+		overlay->scanout_front = NULL;
+		if (!overlay->scanout_back) {
+			overlay->overlay_crtc = NULL;
+		}
+	}
+
+	if (backend->session->active && !output->modeset_pending) {
+		struct timespec when = {
+			.tv_sec = tv_sec,
+			.tv_nsec = tv_usec * 1000,
+		};
+		struct timespec *whenp = backend->monotonic_timestamps ? &when : NULL;
+		if (backend->draining_flips) {
+			// Don't run frame handlers in the middle of a modeset
+			defer_frame_event(backend, output, true, whenp, seq, present_flags);
+			return;
+		}
+		wlr_output_send_present(output->base, whenp, seq, present_flags);
+		wlr_output_send_frame(output->base);
+	} else {
+		output->base->frame_pending = false;
 	}
 }
 
 int wlr_drm_event(int fd, uint32_t mask, void *data) {
 	drmEventContext event = {
 		.version = DRM_EVENT_CONTEXT_VERSION,
-		.page_flip_handler = page_flip_handler,
+		.page_flip_handler2 = page_flip_handler,
 	};
 
 	drmHandleEvent(fd, &event);
@@ -825,10 +1641,11 @@ int wlr_drm_event(int fd, uint32_t mask, void *data) {
 }
 
 static void restore_output(struct wlr_output_state *output, int fd) {
+	struct wlr_drm_backend *backend =
+		wl_container_of(output->renderer, backend, renderer);
+
 	// Wait for any pending pageflips to finish
-	while (output->pageflip_pending) {
-		wlr_drm_event(fd, 0, NULL);
-	}
+	wait_for_pageflip(backend, output);
 
 	drmModeCrtc *crtc = output->old_crtc;
 	if (!crtc) {
@@ -858,6 +1675,12 @@ void wlr_drm_output_cleanup(struct wlr_output_state *output, bool restore) {
 		}
 
 		struct wlr_drm_crtc *crtc = output->crtc;
+		for (size_t i = 0; i < backend->num_overlay_planes; ++i) {
+			struct wlr_drm_plane *plane = &backend->overlay_planes[i];
+			if (plane->overlay_crtc == crtc) {
+				wlr_drm_plane_renderer_free(renderer, plane);
+			}
+		}
 		for (int i = 0; i < 3; ++i) {
 			wlr_drm_plane_renderer_free(renderer, crtc->planes[i]);
 			if (crtc->planes[i] && crtc->planes[i]->id == 0) {
@@ -868,6 +1691,8 @@ void wlr_drm_output_cleanup(struct wlr_output_state *output, bool restore) {
 
 		output->crtc = NULL;
 		output->possible_crtc = 0;
+		output->modeset_pending = false;
+		output->deferred.pending = false;
 		/* Fallthrough */
 	case WLR_DRM_OUTPUT_NEEDS_MODESET:
 		output->state = WLR_DRM_OUTPUT_DISCONNECTED;
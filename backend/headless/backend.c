@@ -0,0 +1,118 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <wayland-server.h>
+#include <wlr/egl.h>
+#include <wlr/backend/interface.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/pixman.h>
+#include <wlr/util/log.h>
+#include "backend/headless.h"
+
+static bool wlr_headless_backend_init(struct wlr_backend *_backend) {
+	struct wlr_headless_backend *backend =
+		(struct wlr_headless_backend *)_backend;
+	wlr_log(L_INFO, "Initializing headless backend");
+
+	// Outputs added before now couldn't be announced yet
+	backend->started = true;
+	for (size_t i = 0; i < backend->outputs->length; ++i) {
+		struct wlr_output *output = backend->outputs->items[i];
+		wl_signal_emit(&backend->backend.events.output_add, output);
+		wl_event_source_timer_update(output->state->frame_timer,
+			output->state->frame_delay);
+	}
+	return true;
+}
+
+static void wlr_headless_backend_destroy(struct wlr_backend *_backend) {
+	struct wlr_headless_backend *backend =
+		(struct wlr_headless_backend *)_backend;
+	if (!_backend) {
+		return;
+	}
+
+	// Destroying an output removes it from the list
+	while (backend->outputs->length > 0) {
+		wlr_output_destroy(backend->outputs->items[0]);
+	}
+	list_free(backend->outputs);
+
+	if (backend->has_egl) {
+		wlr_egl_free(&backend->egl);
+	}
+	free(backend);
+}
+
+static struct wlr_egl *wlr_headless_backend_get_egl(
+		struct wlr_backend *_backend) {
+	struct wlr_headless_backend *backend =
+		(struct wlr_headless_backend *)_backend;
+	return backend->has_egl ? &backend->egl : NULL;
+}
+
+static struct wlr_backend_impl backend_impl = {
+	.init = wlr_headless_backend_init,
+	.destroy = wlr_headless_backend_destroy,
+	.get_egl = wlr_headless_backend_get_egl,
+};
+
+void wlr_headless_backend_set_pixman_renderer(struct wlr_backend *_backend,
+		struct wlr_renderer *renderer) {
+	assert(wlr_backend_is_headless(_backend));
+	struct wlr_headless_backend *backend =
+		(struct wlr_headless_backend *)_backend;
+	if (backend->pixman_renderer && backend->pixman_renderer != renderer) {
+		// Don't leave it pointing at an output's framebuffer
+		wlr_pixman_renderer_bind_buffer(backend->pixman_renderer, NULL,
+			WL_SHM_FORMAT_XRGB8888, 0, 0, 0);
+	}
+	backend->pixman_renderer = renderer;
+
+	// EGL outputs get their pbuffers back the next time they're made current
+	for (size_t i = 0; renderer && i < backend->outputs->length; ++i) {
+		struct wlr_output *output = backend->outputs->items[i];
+		headless_output_destroy_pbuffer(output->state);
+	}
+}
+
+bool wlr_backend_is_headless(struct wlr_backend *b) {
+	return b->impl == &backend_impl;
+}
+
+struct wlr_backend *wlr_headless_backend_create(struct wl_display *display) {
+	wlr_log(L_INFO, "Creating headless backend");
+
+	struct wlr_headless_backend *backend =
+		calloc(1, sizeof(struct wlr_headless_backend));
+	if (!backend) {
+		wlr_log(L_ERROR, "Allocation failed: %s", strerror(errno));
+		return NULL;
+	}
+	wlr_backend_create(&backend->backend, &backend_impl);
+	backend->display = display;
+
+	if (!(backend->outputs = list_create())) {
+		wlr_log(L_ERROR, "Could not allocate outputs list");
+		goto error;
+	}
+
+	backend->has_egl = wlr_egl_init(&backend->egl,
+		EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY);
+	if (backend->has_egl) {
+		wlr_egl_bind_display(&backend->egl, display);
+	} else {
+		wlr_log(L_INFO, "Could not initialize surfaceless EGL, "
+			"outputs can only be rendered with pixman");
+	}
+
+	return &backend->backend;
+
+error:
+	list_free(backend->outputs);
+	free(backend);
+	return NULL;
+}
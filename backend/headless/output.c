@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <wayland-server.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/pixman.h>
+#include <wlr/util/log.h>
+#include "backend/headless.h"
+
+/*
+ * Stands in for the vblank: a frame event follows each swap one refresh
+ * period later.
+ */
+static int handle_frame_timer(void *data) {
+	struct wlr_output_state *output = data;
+	wlr_output_send_present(output->wlr_output, NULL, 0, 0);
+	wlr_output_send_frame(output->wlr_output);
+	return 0;
+}
+
+static int refresh_to_delay(int32_t refresh) {
+	int delay = 1000 * 1000 / refresh;
+	// A zero delay would disarm the timer
+	return delay > 0 ? delay : 1;
+}
+
+static EGLSurface create_pbuffer(struct wlr_egl *egl,
+		int32_t width, int32_t height) {
+	const EGLint attribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_NONE,
+	};
+	EGLSurface surf = eglCreatePbufferSurface(egl->display, egl->config,
+		attribs);
+	if (surf == EGL_NO_SURFACE) {
+		wlr_log(L_ERROR, "Failed to create pbuffer: %s", egl_error());
+	}
+	return surf;
+}
+
+void headless_output_destroy_pbuffer(struct wlr_output_state *output) {
+	if (output->egl_surface != EGL_NO_SURFACE) {
+		eglDestroySurface(output->backend->egl.display, output->egl_surface);
+		output->egl_surface = EGL_NO_SURFACE;
+	}
+}
+
+// Outputs only have a pbuffer while they're rendered to with EGL
+static bool uses_egl(struct wlr_headless_backend *backend) {
+	return backend->has_egl && !backend->pixman_renderer;
+}
+
+static bool wlr_headless_output_set_mode(struct wlr_output_state *output,
+		struct wlr_output_mode *mode) {
+	struct wlr_headless_backend *backend = output->backend;
+	EGLSurface surf = EGL_NO_SURFACE;
+	if (uses_egl(backend)) {
+		surf = create_pbuffer(&backend->egl, mode->width, mode->height);
+		if (surf == EGL_NO_SURFACE) {
+			return false;
+		}
+	}
+	headless_output_destroy_pbuffer(output);
+	output->egl_surface = surf;
+
+	struct wlr_output *wlr_output = output->wlr_output;
+	wlr_output->width = mode->width;
+	wlr_output->height = mode->height;
+	wlr_output->current_mode = mode;
+	output->frame_delay = refresh_to_delay(mode->refresh);
+	wlr_output_update_matrix(wlr_output);
+	wl_signal_emit(&wlr_output->events.resolution, wlr_output);
+	return true;
+}
+
+/*
+ * Binds the output's framebuffer to the pixman renderer, allocating it for
+ * the current size if needed. On failure nothing is left bound, so the frame
+ * isn't drawn.
+ */
+static void bind_pixman_buffer(struct wlr_output_state *output) {
+	struct wlr_renderer *renderer = output->backend->pixman_renderer;
+	struct wlr_output *wlr_output = output->wlr_output;
+	int width = wlr_output->width, height = wlr_output->height;
+	if (!output->pixels || output->pixels_width != width ||
+			output->pixels_height != height) {
+		// The renderer may still wrap the old buffer
+		void *pixels = calloc((size_t)width * height, 4);
+		if (!pixels) {
+			wlr_log_errno(L_ERROR, "Allocation failed");
+			goto error;
+		}
+		free(output->pixels);
+		output->pixels = pixels;
+		output->pixels_width = width;
+		output->pixels_height = height;
+	}
+	if (wlr_pixman_renderer_bind_buffer(renderer, output->pixels,
+			WL_SHM_FORMAT_XRGB8888, width, height, width * 4)) {
+		return;
+	}
+
+error:
+	wlr_pixman_renderer_bind_buffer(renderer, NULL,
+		WL_SHM_FORMAT_XRGB8888, 0, 0, 0);
+}
+
+static void wlr_headless_output_make_current(struct wlr_output_state *output) {
+	struct wlr_headless_backend *backend = output->backend;
+	if (backend->pixman_renderer) {
+		bind_pixman_buffer(output);
+		return;
+	}
+	if (!backend->has_egl) {
+		wlr_log(L_ERROR, "No EGL display and no pixman renderer to render "
+			"headless outputs with");
+		return;
+	}
+	if (output->egl_surface == EGL_NO_SURFACE) {
+		struct wlr_output *wlr_output = output->wlr_output;
+		output->egl_surface = create_pbuffer(&backend->egl,
+			wlr_output->width, wlr_output->height);
+		if (output->egl_surface == EGL_NO_SURFACE) {
+			return;
+		}
+	}
+	if (!eglMakeCurrent(output->backend->egl.display,
+			output->egl_surface, output->egl_surface,
+			output->backend->egl.context)) {
+		wlr_log(L_ERROR, "eglMakeCurrent failed: %s", egl_error());
+	}
+}
+
+static void wlr_headless_output_swap_buffers(struct wlr_output_state *output) {
+	// Nothing is presented, but the commands still have to run for the
+	// frame to cost what it would on a real output. The pixman renderer
+	// is done by the time it returns.
+	struct wlr_headless_backend *backend = output->backend;
+	if (output->egl_surface != EGL_NO_SURFACE && uses_egl(backend) &&
+			!eglSwapBuffers(backend->egl.display, output->egl_surface)) {
+		wlr_log(L_ERROR, "eglSwapBuffers failed: %s", egl_error());
+	}
+	wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+}
+
+static void wlr_headless_output_transform(struct wlr_output_state *output,
+		enum wl_output_transform transform) {
+	output->wlr_output->transform = transform;
+}
+
+static void wlr_headless_output_destroy(struct wlr_output_state *output) {
+	struct wlr_headless_backend *backend = output->backend;
+	for (size_t i = 0; i < backend->outputs->length; ++i) {
+		if (backend->outputs->items[i] == output->wlr_output) {
+			list_del(backend->outputs, i);
+			break;
+		}
+	}
+	if (backend->started) {
+		wl_signal_emit(&backend->backend.events.output_remove,
+			output->wlr_output);
+	}
+	wl_event_source_remove(output->frame_timer);
+	headless_output_destroy_pbuffer(output);
+	if (output->pixels && backend->pixman_renderer) {
+		// The renderer may still have it bound
+		wlr_pixman_renderer_bind_buffer(backend->pixman_renderer, NULL,
+			WL_SHM_FORMAT_XRGB8888, 0, 0, 0);
+	}
+	free(output->pixels);
+	free(output);
+}
+
+static struct wlr_output_impl output_impl = {
+	.set_mode = wlr_headless_output_set_mode,
+	.transform = wlr_headless_output_transform,
+	.destroy = wlr_headless_output_destroy,
+	.make_current = wlr_headless_output_make_current,
+	.swap_buffers = wlr_headless_output_swap_buffers,
+};
+
+struct wlr_output *wlr_headless_add_output(struct wlr_backend *_backend,
+		int32_t width, int32_t height, int32_t refresh) {
+	assert(wlr_backend_is_headless(_backend));
+	struct wlr_headless_backend *backend =
+		(struct wlr_headless_backend *)_backend;
+	if (refresh <= 0) {
+		refresh = HEADLESS_DEFAULT_REFRESH;
+	}
+
+	struct wlr_output_state *ostate;
+	if (!(ostate = calloc(sizeof(struct wlr_output_state), 1))) {
+		wlr_log(L_ERROR, "Failed to allocate wlr_output_state");
+		return NULL;
+	}
+	ostate->backend = backend;
+
+	ostate->egl_surface = EGL_NO_SURFACE;
+	if (uses_egl(backend)) {
+		ostate->egl_surface = create_pbuffer(&backend->egl, width, height);
+		if (ostate->egl_surface == EGL_NO_SURFACE) {
+			goto error_state;
+		}
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(backend->display);
+	ostate->frame_timer = wl_event_loop_add_timer(loop,
+		handle_frame_timer, ostate);
+	if (!ostate->frame_timer) {
+		wlr_log(L_ERROR, "Failed to create frame timer");
+		goto error_surface;
+	}
+	ostate->frame_delay = refresh_to_delay(refresh);
+
+	struct wlr_output_mode *mode = calloc(1, sizeof(struct wlr_output_mode));
+	if (!mode) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		goto error_timer;
+	}
+	mode->flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+	mode->width = width;
+	mode->height = height;
+	mode->refresh = refresh;
+
+	struct wlr_output *wlr_output = wlr_output_create(&output_impl, ostate);
+	if (!wlr_output) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		free(mode);
+		goto error_timer;
+	}
+	ostate->wlr_output = wlr_output;
+	list_add(wlr_output->modes, mode);
+	wlr_output->current_mode = mode;
+
+	wlr_output->width = width;
+	wlr_output->height = height;
+	wlr_output->scale = 1;
+	strncpy(wlr_output->make, "headless", sizeof(wlr_output->make));
+	strncpy(wlr_output->model, "headless", sizeof(wlr_output->model));
+	snprintf(wlr_output->name, sizeof(wlr_output->name), "HEADLESS-%zd",
+			backend->outputs->length + 1);
+	wlr_output_update_matrix(wlr_output);
+
+	wlr_output_create_global(wlr_output, backend->display);
+	list_add(backend->outputs, wlr_output);
+	if (backend->started) {
+		wl_signal_emit(&backend->backend.events.output_add, wlr_output);
+		// Start the frame loop, later frames follow each swap
+		wl_event_source_timer_update(ostate->frame_timer, ostate->frame_delay);
+	}
+	return wlr_output;
+
+error_timer:
+	wl_event_source_remove(ostate->frame_timer);
+error_surface:
+	headless_output_destroy_pbuffer(ostate);
+error_state:
+	free(ostate);
+	return NULL;
+}
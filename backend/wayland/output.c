@@ -16,8 +16,11 @@ static void surface_frame_callback(void *data, struct wl_callback *cb, uint32_t
 	assert(output);
 
 	struct wlr_output *wlr_output = output->wlr_output;
-	wl_signal_emit(&wlr_output->events.frame, wlr_output);
 	wl_callback_destroy(cb);
+	output->frame_callback = NULL;
+	// The parent compositor only tells us it is a good time to draw
+	wlr_output_send_present(wlr_output, NULL, 0, 0);
+	wlr_output_send_frame(wlr_output);
 }
 
 static struct wl_callback_listener frame_listener = {
@@ -40,6 +43,10 @@ static void wlr_wl_output_swap_buffers(struct wlr_output_state *output) {
 	}
 }
 
+static int wlr_wl_output_get_buffer_age(struct wlr_output_state *output) {
+	return wlr_egl_get_buffer_age(&output->backend->egl, output->egl_surface);
+}
+
 static void wlr_wl_output_transform(struct wlr_output_state *output,
 		enum wl_output_transform transform) {
 	output->wlr_output->transform = transform;
@@ -62,6 +69,7 @@ static struct wlr_output_impl output_impl = {
 	.destroy = wlr_wl_output_destroy,
 	.make_current = wlr_wl_output_make_current,
 	.swap_buffers = wlr_wl_output_swap_buffers,
+	.get_buffer_age = wlr_wl_output_get_buffer_age,
 };
 
 void handle_ping(void* data, struct wl_shell_surface* ssurface, uint32_t serial) {
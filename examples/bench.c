@@ -0,0 +1,433 @@
+#define _POSIX_C_SOURCE 199309L
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <wayland-server.h>
+#include <wayland-server-protocol.h>
+#include <xkbcommon/xkbcommon.h>
+#include <GLES2/gl2.h>
+#include <wlr/render/matrix.h>
+#include <wlr/render/gles2.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "shared.h"
+#include "cat.h"
+
+/*
+ * Renders synthetic workloads and reports how long frames take. Run it with
+ * WLR_HEADLESS_OUTPUTS=1 to measure without a display, or nested. The pixman
+ * renderer needs the headless backend.
+ */
+
+#define CLIENT_SIZE 256
+#define CLIENT_DAMAGE 64
+#define CURSOR_SIZE 64
+#define WARMUP_FRAMES 30
+
+enum workload {
+	WORKLOAD_SHM, // clients uploading damaged parts of their buffers
+	WORKLOAD_QUADS, // textured quads all over the output
+	WORKLOAD_CURSOR, // a storm of cursor motion over a static scene
+};
+
+static const char *workload_names[] = {
+	[WORKLOAD_SHM] = "shm",
+	[WORKLOAD_QUADS] = "quads",
+	[WORKLOAD_CURSOR] = "cursor",
+};
+
+enum renderer_type {
+	RENDERER_GLES2,
+	RENDERER_PIXMAN,
+};
+
+static const char *renderer_names[] = {
+	[RENDERER_GLES2] = "gles2",
+	[RENDERER_PIXMAN] = "pixman",
+};
+
+struct bench_client {
+	struct wlr_texture *texture;
+	int x, y;
+};
+
+struct sample_state {
+	enum workload workload;
+	enum renderer_type renderer_type;
+	int count;
+	int frames;
+
+	struct wlr_renderer *renderer;
+	struct wlr_texture *cat_texture;
+	struct wlr_output *output; // the one being measured
+	struct bench_client *clients;
+	uint32_t *pixels; // CPU copy of a client buffer
+	int frame;
+	int cursor_x, cursor_y;
+
+	double *frame_ms;
+	double *cpu_ms;
+	size_t draws, uploads;
+	size_t heap_start;
+};
+
+static double timespec_to_ms(const struct timespec *ts) {
+	return ts->tv_sec * 1000.0 + ts->tv_nsec / 1000000.0;
+}
+
+static double now_ms(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return timespec_to_ms(&ts);
+}
+
+static size_t heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+static int compare_doubles(const void *_a, const void *_b) {
+	double a = *(const double *)_a, b = *(const double *)_b;
+	return (a > b) - (a < b);
+}
+
+static double percentile(const double *sorted, int n, int p) {
+	return sorted[(n - 1) * p / 100];
+}
+
+static void report(struct sample_state *sample) {
+	int n = sample->frames;
+	double cpu_total = 0;
+	for (int i = 0; i < n; ++i) {
+		cpu_total += sample->cpu_ms[i];
+	}
+	qsort(sample->frame_ms, n, sizeof(double), compare_doubles);
+
+	printf("workload %s, %d objects, %d frames on %s with %s\n",
+		workload_names[sample->workload], sample->count, n,
+		sample->output->name, renderer_names[sample->renderer_type]);
+	printf("frame time ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+		percentile(sample->frame_ms, n, 50),
+		percentile(sample->frame_ms, n, 90),
+		percentile(sample->frame_ms, n, 99),
+		sample->frame_ms[n - 1]);
+	printf("cpu time per frame ms: %.3f\n", cpu_total / n);
+	printf("draws per frame: %.1f, uploads per frame: %.1f\n",
+		(double)sample->draws / n, (double)sample->uploads / n);
+	if (sample->renderer_type == RENDERER_GLES2) {
+		struct wlr_gles2_stats stats;
+		wlr_gles2_get_stats(&stats);
+		printf("GL state calls per frame: %.1f (%.1f skipped), "
+			"draw calls per frame: %.1f, quads per draw call: %.1f\n",
+			(double)stats.state_calls / n, (double)stats.skipped_calls / n,
+			(double)stats.draw_calls / n, stats.draw_calls ?
+				(double)stats.quads / stats.draw_calls : 0.0);
+	}
+	printf("heap growth: %zd bytes\n",
+		(ssize_t)(heap_in_use() - sample->heap_start));
+}
+
+/*
+ * Moves a damaged band across each client, as a scrolling or animating
+ * client would.
+ */
+static void update_clients(struct sample_state *sample) {
+	struct wlr_output *output = sample->output;
+	int offset = (sample->frame * 8) % (CLIENT_SIZE - CLIENT_DAMAGE);
+	for (int i = 0; i < sample->count; ++i) {
+		struct bench_client *client = &sample->clients[i];
+		for (int y = offset; y < offset + CLIENT_DAMAGE; ++y) {
+			for (int x = offset; x < offset + CLIENT_DAMAGE; ++x) {
+				sample->pixels[y * CLIENT_SIZE + x] =
+					0xFF000000 | (sample->frame * 0x010203 + i);
+			}
+		}
+		wlr_texture_update_pixels(client->texture, WL_SHM_FORMAT_ARGB8888,
+			CLIENT_SIZE, offset, offset, CLIENT_DAMAGE, CLIENT_DAMAGE,
+			(unsigned char *)sample->pixels);
+		++sample->uploads;
+
+		pixman_region32_t damage;
+		pixman_region32_init_rect(&damage, client->x + offset,
+			client->y + offset, CLIENT_DAMAGE, CLIENT_DAMAGE);
+		wlr_output_add_damage(output, &damage);
+		pixman_region32_fini(&damage);
+	}
+}
+
+static void move_cursor(struct sample_state *sample) {
+	int width, height;
+	wlr_output_effective_resolution(sample->output, &width, &height);
+	for (int i = 0; i < sample->count; ++i) {
+		sample->cursor_x = (sample->cursor_x + 7) % width;
+		sample->cursor_y = (sample->cursor_y + 3) % height;
+		wlr_output_move_cursor(sample->output,
+			sample->cursor_x, sample->cursor_y);
+	}
+	// The scene itself stays put, only keep the frames coming
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, 0, 0, 1, 1);
+	wlr_output_add_damage(sample->output, &damage);
+	pixman_region32_fini(&damage);
+}
+
+static void render_texture(struct sample_state *sample,
+		struct wlr_texture *texture, int x, int y) {
+	float matrix[16];
+	wlr_texture_get_matrix(texture, &matrix,
+		&sample->output->transform_matrix, x, y);
+	wlr_render_with_matrix(sample->renderer, texture, &matrix);
+	++sample->draws;
+}
+
+static void render_scene(struct sample_state *sample) {
+	int width, height;
+	wlr_output_effective_resolution(sample->output, &width, &height);
+
+	switch (sample->workload) {
+	case WORKLOAD_SHM:
+		for (int i = 0; i < sample->count; ++i) {
+			struct bench_client *client = &sample->clients[i];
+			render_texture(sample, client->texture, client->x, client->y);
+		}
+		break;
+	case WORKLOAD_QUADS:
+		for (int i = 0; i < sample->count; ++i) {
+			// Deterministic scatter, shifted a bit every frame
+			int x = (i * 97 + sample->frame) % width;
+			int y = (i * 61 + sample->frame) % height;
+			render_texture(sample, sample->cat_texture, x, y);
+		}
+		break;
+	case WORKLOAD_CURSOR:
+		render_texture(sample, sample->cat_texture, 0, 0);
+		break;
+	}
+}
+
+static void handle_output_frame(struct output_state *output,
+		struct timespec *ts) {
+	struct compositor_state *state = output->compositor;
+	struct sample_state *sample = state->data;
+	struct wlr_output *wlr_output = output->output;
+	if (wlr_output != sample->output) {
+		wlr_output_skip_frame(wlr_output);
+		return;
+	}
+
+	double start = now_ms(CLOCK_MONOTONIC);
+	double cpu_start = now_ms(CLOCK_PROCESS_CPUTIME_ID);
+	if (sample->frame == WARMUP_FRAMES) {
+		sample->draws = sample->uploads = 0;
+		if (sample->renderer_type == RENDERER_GLES2) {
+			wlr_gles2_reset_stats();
+		}
+		sample->heap_start = heap_in_use();
+	}
+
+	switch (sample->workload) {
+	case WORKLOAD_SHM:
+		update_clients(sample);
+		break;
+	case WORKLOAD_QUADS:
+		wlr_output_add_damage_whole(wlr_output);
+		break;
+	case WORKLOAD_CURSOR:
+		move_cursor(sample);
+		break;
+	}
+
+	wlr_output_make_current(wlr_output);
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	wlr_output_get_frame_damage(wlr_output, &damage);
+
+	wlr_renderer_begin(sample->renderer, wlr_output);
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+	for (int i = 0; i < nrects; ++i) {
+		wlr_renderer_scissor(sample->renderer, &rects[i]);
+		wlr_renderer_clear(sample->renderer, &(float[]){0.25f, 0.25f, 0.25f, 1});
+		render_scene(sample);
+	}
+	wlr_renderer_scissor(sample->renderer, NULL);
+	wlr_renderer_end(sample->renderer);
+	if (sample->renderer_type == RENDERER_GLES2) {
+		// Wait for the GPU so frame times include the rendering itself
+		glFinish();
+	}
+	wlr_output_swap_buffers(wlr_output);
+	pixman_region32_fini(&damage);
+
+	int i = sample->frame - WARMUP_FRAMES;
+	if (i >= 0) {
+		sample->frame_ms[i] = now_ms(CLOCK_MONOTONIC) - start;
+		sample->cpu_ms[i] = now_ms(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	}
+	if (++sample->frame == WARMUP_FRAMES + sample->frames) {
+		report(sample);
+		wl_display_terminate(state->display);
+	}
+}
+
+static void handle_output_add(struct output_state *output) {
+	struct sample_state *sample = output->compositor->data;
+	if (sample->output) {
+		return;
+	}
+	sample->output = output->output;
+
+	if (sample->workload == WORKLOAD_CURSOR) {
+		uint8_t *cursor = calloc(CURSOR_SIZE * CURSOR_SIZE, 4);
+		memset(cursor, 0xFF, CURSOR_SIZE * 4 * 4);
+		wlr_output_set_cursor(sample->output, cursor, CURSOR_SIZE,
+			CURSOR_SIZE, CURSOR_SIZE);
+		free(cursor);
+	}
+}
+
+static void handle_output_remove(struct output_state *output) {
+	struct sample_state *sample = output->compositor->data;
+	if (sample->output == output->output) {
+		wlr_log(L_ERROR, "Benchmarked output removed");
+		wl_display_terminate(output->compositor->display);
+	}
+}
+
+static void init_clients(struct sample_state *sample) {
+	sample->clients = calloc(sample->count, sizeof(struct bench_client));
+	sample->pixels = calloc(CLIENT_SIZE * CLIENT_SIZE, sizeof(uint32_t));
+	for (int i = 0; i < sample->count; ++i) {
+		struct bench_client *client = &sample->clients[i];
+		client->texture = wlr_render_texture_init(sample->renderer);
+		wlr_texture_upload_pixels(client->texture, WL_SHM_FORMAT_ARGB8888,
+			CLIENT_SIZE, CLIENT_SIZE, CLIENT_SIZE,
+			(unsigned char *)sample->pixels);
+		// Cascade them like stacked windows
+		client->x = 32 * (i % 16);
+		client->y = 24 * (i % 16) + 8 * (i / 16);
+	}
+}
+
+static void usage(const char *name, int ret) {
+	fprintf(stderr,
+		"usage: %s [-w <workload>] [-r <renderer>] [-n <count>] "
+			"[-f <frames>]\n"
+		"\n"
+		" -w <workload>  One of shm, quads, cursor. Defaults to shm.\n"
+		" -r <renderer>  One of gles2, pixman. Defaults to gles2.\n"
+		" -n <count>     Clients, quads or cursor moves per frame.\n"
+		" -f <frames>    Frames to measure, after %d warmup frames.\n",
+		name, WARMUP_FRAMES);
+
+	exit(ret);
+}
+
+static void parse_args(int argc, char *argv[], struct sample_state *sample) {
+	int c;
+	while ((c = getopt(argc, argv, "w:r:n:f:h")) != -1) {
+		switch (c) {
+		case 'w':
+			for (size_t i = 0; i < sizeof(workload_names) /
+					sizeof(workload_names[0]); ++i) {
+				if (strcmp(optarg, workload_names[i]) == 0) {
+					sample->workload = i;
+					goto next;
+				}
+			}
+			fprintf(stderr, "Unknown workload '%s'\n", optarg);
+			usage(argv[0], 1);
+		case 'r':
+			for (size_t i = 0; i < sizeof(renderer_names) /
+					sizeof(renderer_names[0]); ++i) {
+				if (strcmp(optarg, renderer_names[i]) == 0) {
+					sample->renderer_type = i;
+					goto next;
+				}
+			}
+			fprintf(stderr, "Unknown renderer '%s'\n", optarg);
+			usage(argv[0], 1);
+		case 'n':
+			sample->count = atoi(optarg);
+			break;
+		case 'f':
+			sample->frames = atoi(optarg);
+			break;
+		case 'h':
+		case '?':
+			usage(argv[0], c != 'h');
+		}
+next:;
+	}
+	if (sample->count <= 0 || sample->frames <= 0) {
+		usage(argv[0], 1);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	struct sample_state state = {
+		.workload = WORKLOAD_SHM,
+		.count = 16,
+		.frames = 1000,
+	};
+	parse_args(argc, argv, &state);
+	state.frame_ms = calloc(state.frames, sizeof(double));
+	state.cpu_ms = calloc(state.frames, sizeof(double));
+
+	struct compositor_state compositor = { 0 };
+	compositor.data = &state;
+	compositor.output_add_cb = handle_output_add;
+	compositor.output_remove_cb = handle_output_remove;
+	compositor.output_frame_cb = handle_output_frame;
+	compositor_init(&compositor);
+
+	switch (state.renderer_type) {
+	case RENDERER_GLES2:
+		state.renderer = wlr_gles2_renderer_init(compositor.backend);
+		break;
+	case RENDERER_PIXMAN:
+		if (!wlr_backend_is_headless(compositor.backend)) {
+			wlr_log(L_ERROR, "The pixman renderer needs the headless "
+				"backend, set WLR_HEADLESS_OUTPUTS");
+			exit(1);
+		}
+		state.renderer = wlr_pixman_renderer_init();
+		wlr_headless_backend_set_pixman_renderer(compositor.backend,
+			state.renderer);
+		break;
+	}
+	if (!state.renderer) {
+		wlr_log(L_ERROR, "Failed to create the renderer");
+		exit(1);
+	}
+	state.cat_texture = wlr_render_texture_init(state.renderer);
+	wlr_texture_upload_pixels(state.cat_texture, WL_SHM_FORMAT_ABGR8888,
+		cat_tex.width, cat_tex.width, cat_tex.height, cat_tex.pixel_data);
+	if (state.workload == WORKLOAD_SHM) {
+		init_clients(&state);
+	}
+
+	compositor_run(&compositor);
+
+	for (int i = 0; state.clients && i < state.count; ++i) {
+		wlr_texture_destroy(state.clients[i].texture);
+	}
+	free(state.clients);
+	free(state.pixels);
+	wlr_texture_destroy(state.cat_texture);
+	wlr_renderer_destroy(state.renderer);
+	free(state.frame_ms);
+	free(state.cpu_ms);
+}
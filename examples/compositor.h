@@ -3,12 +3,18 @@
 #include <wayland-server.h>
 #include <wlr/render.h>
 
+struct wlr_surface;
+
 struct wl_compositor_state {
 	struct wl_global *wl_global;
 	struct wl_list wl_resources;
 	struct wlr_renderer *renderer;
 	struct wl_list surfaces;
 	struct wl_listener destroy_surface_listener;
+
+	void (*surface_commit_cb)(struct wlr_surface *surface, void *data);
+	void (*surface_destroy_cb)(struct wlr_surface *surface, void *data);
+	void *data;
 };
 
 void wl_compositor_init(struct wl_display *display,
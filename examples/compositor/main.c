@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <inttypes.h>
+#include <drm_fourcc.h>
 #include <wayland-server.h>
 #include <wlr/backend.h>
 #include <wlr/backend/session.h>
@@ -12,18 +13,48 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_xdg_shell_v6.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
+#include <wlr/types/wlr_presentation.h>
 #include <xkbcommon/xkbcommon.h>
 #include <wlr/util/log.h>
 #include "shared.h"
 #include "compositor.h"
 
 struct sample_state {
+	struct compositor_state *state;
 	struct wlr_renderer *renderer;
 	struct wl_compositor_state compositor;
 	struct wl_shell_state shell;
 	struct wlr_xdg_shell_v6 *xdg_shell;
+	struct wlr_linux_dmabuf *linux_dmabuf;
+	struct wlr_presentation *presentation;
 };
 
+struct output_data {
+	// Surface shown on the overlay plane in the last frame, and where
+	struct wlr_surface *overlay;
+	pixman_box32_t overlay_box;
+	// Sends the frame callbacks of commits without damage, at most once per
+	// refresh period, since no frame is drawn for them
+	struct wl_event_source *frame_done_timer;
+	bool frame_done_armed;
+	struct timespec last_frame_done;
+};
+
+/*
+ * A surface the size of an output covers it from 0,0, so it can be scanned
+ * out. Everything else is drawn at 200,200.
+ */
+static void surface_get_position(struct wlr_surface *surface,
+		struct wlr_output *wlr_output, int32_t *x, int32_t *y) {
+	if (surface->current.width == wlr_output->width &&
+			surface->current.height == wlr_output->height) {
+		*x = *y = 0;
+	} else {
+		*x = *y = 200;
+	}
+}
+
 /*
  * Convert timespec to milliseconds
  */
@@ -31,49 +62,433 @@ static inline int64_t timespec_to_msec(const struct timespec *a) {
 	return (int64_t)a->tv_sec * 1000 + a->tv_nsec / 1000000;
 }
 
+static inline int64_t timespec_to_nsec(const struct timespec *a) {
+	return (int64_t)a->tv_sec * 1000000000 + a->tv_nsec;
+}
+
+static void send_frame_done(struct wlr_surface *surface, struct timespec *ts) {
+	struct wlr_frame_callback *cb, *cnext;
+	wl_list_for_each_safe(cb, cnext, &surface->current.frame_callback_list, link) {
+		wl_callback_send_done(cb->resource, timespec_to_msec(ts));
+		wl_resource_destroy(cb->resource);
+	}
+}
+
+static int handle_frame_done_timer(void *data) {
+	struct output_state *output = data;
+	struct sample_state *sample = output->compositor->data;
+	struct output_data *odata = output->data;
+	odata->frame_done_armed = false;
+	clock_gettime(CLOCK_MONOTONIC, &odata->last_frame_done);
+
+	struct wl_resource *_res;
+	wl_list_for_each(_res, &sample->compositor.surfaces, link) {
+		send_frame_done(wl_resource_get_user_data(_res),
+			&odata->last_frame_done);
+	}
+	return 0;
+}
+
+/*
+ * Sends the pending frame callbacks one refresh period after the last frame
+ * of the output, as if a frame had been drawn. Firing them right away would
+ * let a client committing nothing but a frame callback spin.
+ */
+static void schedule_frame_done(struct output_state *output) {
+	struct output_data *odata = output->data;
+	struct wlr_output *wlr_output = output->output;
+	// A frame on its way sends them anyway
+	if (odata->frame_done_armed || wlr_output->frame_pending ||
+			wlr_output->idle_frame) {
+		return;
+	}
+
+	int32_t refresh = wlr_output->current_mode &&
+		wlr_output->current_mode->refresh > 0 ?
+		wlr_output->current_mode->refresh : 60000;
+	int64_t last = timespec_to_nsec(&output->last_frame);
+	if (timespec_to_nsec(&odata->last_frame_done) > last) {
+		last = timespec_to_nsec(&odata->last_frame_done);
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t delay = last + 1000000000000LL / refresh - timespec_to_nsec(&now);
+
+	// A delay of 0 would disarm the timer
+	int delay_ms = delay > 0 ? (delay + 999999) / 1000000 : 1;
+	wl_event_source_timer_update(odata->frame_done_timer, delay_ms);
+	odata->frame_done_armed = true;
+}
+
+/*
+ * Planes show buffers as they are, so they can only be used if the surface
+ * doesn't rotate or scale its buffer.
+ */
+static bool surface_buffer_is_untransformed(struct wlr_surface *surface) {
+	return surface->current.transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		surface->current.scale == 1;
+}
+
+/*
+ * Checks whether the surface hides everything below it, either because its
+ * buffer format has no alpha channel or because its opaque region covers it.
+ */
+static bool surface_is_opaque(struct wlr_surface *surface) {
+	struct wl_resource *buffer = surface->current.buffer;
+	if (wlr_dmabuf_resource_is_buffer(buffer)) {
+		struct wlr_dmabuf_buffer *dmabuf =
+			wlr_dmabuf_buffer_from_buffer_resource(buffer);
+		switch (dmabuf->attributes.format) {
+		case DRM_FORMAT_XRGB8888:
+		case DRM_FORMAT_XBGR8888:
+		case DRM_FORMAT_RGBX8888:
+		case DRM_FORMAT_BGRX8888:
+		case DRM_FORMAT_RGB565:
+		case DRM_FORMAT_NV12:
+			return true;
+		}
+	}
+
+	pixman_box32_t box = {
+		.x1 = 0,
+		.y1 = 0,
+		.x2 = surface->current.width,
+		.y2 = surface->current.height,
+	};
+	return pixman_region32_contains_rectangle(&surface->current.opaque,
+		&box) == PIXMAN_REGION_IN;
+}
+
+/*
+ * If a single client buffer covers exactly the whole output, try to put it on
+ * the screen as is.
+ */
+static bool scanout_surface(struct sample_state *sample,
+		struct wlr_output *wlr_output, struct timespec *ts) {
+	if (wl_list_length(&sample->compositor.surfaces) != 1) {
+		return false;
+	}
+
+	struct wl_resource *_res =
+		wl_resource_from_link(sample->compositor.surfaces.next);
+	struct wlr_surface *surface = wl_resource_get_user_data(_res);
+	struct wl_resource *buffer = surface->current.buffer;
+	// The primary plane shows the buffer at 0,0
+	int32_t x, y;
+	surface_get_position(surface, wlr_output, &x, &y);
+	if (x != 0 || y != 0) {
+		return false;
+	}
+	if (!buffer || wl_shm_buffer_get(buffer) ||
+			!surface_buffer_is_untransformed(surface) ||
+			!wlr_output_present_buffer(wlr_output, buffer)) {
+		return false;
+	}
+
+	wlr_presentation_surface_sampled_on_output(sample->presentation, surface,
+		wlr_output);
+	send_frame_done(surface, ts);
+	return true;
+}
+
+/*
+ * Try to put the topmost client buffer on an overlay plane, so it doesn't
+ * need to be composited. Returns the surface if it worked.
+ */
+static struct wlr_surface *assign_overlay(struct sample_state *sample,
+		struct wlr_output *wlr_output) {
+	if (wl_list_empty(&sample->compositor.surfaces)) {
+		return NULL;
+	}
+
+	struct wl_resource *_res =
+		wl_resource_from_link(sample->compositor.surfaces.prev);
+	struct wlr_surface *surface = wl_resource_get_user_data(_res);
+	struct wl_resource *buffer = surface->current.buffer;
+	// Whatever is below the overlay plane isn't composited, so the surface
+	// must hide it completely
+	if (!buffer || wl_shm_buffer_get(buffer) ||
+			!surface_buffer_is_untransformed(surface) ||
+			!surface_is_opaque(surface)) {
+		return NULL;
+	}
+
+	struct wlr_output_overlay overlay = {
+		.buffer = buffer,
+	};
+	surface_get_position(surface, wlr_output, &overlay.x, &overlay.y);
+	if (!wlr_output_assign_overlays(wlr_output, 1, &overlay)) {
+		return NULL;
+	}
+	wlr_presentation_surface_sampled_on_output(sample->presentation, surface,
+		wlr_output);
+	return surface;
+}
+
+static void handle_surface_commit(struct wlr_surface *surface, void *data) {
+	struct sample_state *sample = data;
+
+	// The surface damage already covers the old extents on resize
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	pixman_box32_t *extents =
+		pixman_region32_extents(&surface->current.surface_damage);
+
+	// Damage schedules a frame, which also sends the frame callbacks
+	struct output_state *output;
+	wl_list_for_each(output, &sample->state->outputs, link) {
+		struct wlr_output *wlr_output = output->output;
+		int32_t x, y;
+		surface_get_position(surface, wlr_output, &x, &y);
+		if ((x != 0 || y != 0) && extents->x2 >= wlr_output->width &&
+				extents->y2 >= wlr_output->height) {
+			// The surface may have shrunk from the output size, which moves
+			// it away from 0,0 and exposes the whole output
+			wlr_output_add_damage_whole(wlr_output);
+			continue;
+		}
+		pixman_region32_copy(&damage, &surface->current.surface_damage);
+		pixman_region32_translate(&damage, x, y);
+		wlr_output_add_damage(wlr_output, &damage);
+		if (!pixman_region32_not_empty(&damage) &&
+				!wl_list_empty(&surface->current.frame_callback_list)) {
+			schedule_frame_done(output);
+		}
+	}
+	pixman_region32_fini(&damage);
+}
+
+static void handle_surface_destroy(struct wlr_surface *surface, void *data) {
+	struct sample_state *sample = data;
+
+	// Whatever the surface covered is exposed now
+	struct output_state *output;
+	wl_list_for_each(output, &sample->state->outputs, link) {
+		struct output_data *odata = output->data;
+		if (odata->overlay == surface) {
+			odata->overlay = NULL;
+		}
+		int32_t x, y;
+		surface_get_position(surface, output->output, &x, &y);
+		pixman_region32_t damage;
+		pixman_region32_init_rect(&damage, x, y,
+			surface->current.width, surface->current.height);
+		wlr_output_add_damage(output->output, &damage);
+		pixman_region32_fini(&damage);
+	}
+}
+
+/*
+ * Gets the opaque region of a surface in output-local coordinates.
+ */
+static void surface_get_opaque(struct wlr_surface *surface,
+		struct wlr_output *wlr_output, pixman_region32_t *opaque) {
+	int32_t x, y;
+	surface_get_position(surface, wlr_output, &x, &y);
+	pixman_region32_copy(opaque, &surface->current.opaque);
+	pixman_region32_translate(opaque, x, y);
+	pixman_region32_intersect_rect(opaque, opaque, x, y,
+		surface->texture->width, surface->texture->height);
+}
+
+static void render_surface_region(struct wlr_renderer *renderer,
+		struct wlr_surface *surface, const float (*matrix)[16],
+		pixman_region32_t *region) {
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	for (int i = 0; i < nrects; ++i) {
+		wlr_renderer_scissor(renderer, &rects[i]);
+		wlr_render_with_matrix(renderer, surface->texture, matrix);
+	}
+}
+
 void handle_output_frame(struct output_state *output, struct timespec *ts) {
 	struct compositor_state *state = output->compositor;
 	struct sample_state *sample = state->data;
+	struct output_data *odata = output->data;
 	struct wlr_output *wlr_output = output->output;
+	struct wl_resource *_res;
 
 	wlr_output_make_current(wlr_output);
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	if (!wlr_output_get_frame_damage(wlr_output, &damage)) {
+		// Nothing changed, but clients still expect their frame callbacks
+		wl_list_for_each(_res, &sample->compositor.surfaces, link) {
+			send_frame_done(wl_resource_get_user_data(_res), ts);
+		}
+		wlr_output_skip_frame(wlr_output);
+		goto out;
+	}
+
+	if (scanout_surface(sample, wlr_output, ts)) {
+		// Scanout replaces all planes and leaves the output fully damaged
+		odata->overlay = NULL;
+		goto out;
+	}
+
+	struct wlr_surface *overlay = assign_overlay(sample, wlr_output);
+	if (odata->overlay && odata->overlay != overlay) {
+		// The area below the plane was only cleared, so the surface that
+		// left it has to be composited there in full. The damage is added
+		// to the output too, so older buffers get it repainted as well.
+		pixman_box32_t *box = &odata->overlay_box;
+		pixman_region32_t lost;
+		pixman_region32_init_rect(&lost, box->x1, box->y1,
+			box->x2 - box->x1, box->y2 - box->y1);
+		wlr_output_add_damage(wlr_output, &lost);
+		pixman_region32_union(&damage, &damage, &lost);
+		pixman_region32_fini(&lost);
+	}
+	odata->overlay = overlay;
+	if (overlay) {
+		int32_t x, y;
+		surface_get_position(overlay, wlr_output, &x, &y);
+		odata->overlay_box = (pixman_box32_t){
+			.x1 = x,
+			.y1 = y,
+			.x2 = x + overlay->current.width,
+			.y2 = y + overlay->current.height,
+		};
+	}
+
+	wl_list_for_each(_res, &sample->compositor.surfaces, link) {
+		struct wlr_surface *surface = wl_resource_get_user_data(_res);
+		if (surface != overlay) {
+			wlr_surface_flush_damage(surface);
+		}
+	}
+
+	// Walk the surfaces front to back, so whatever an opaque surface hides
+	// is never drawn
+	size_t nsurfaces = wl_list_length(&sample->compositor.surfaces);
+	pixman_region32_t *visible = calloc(nsurfaces, sizeof(pixman_region32_t));
+	if (nsurfaces > 0 && !visible) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		wlr_output_skip_frame(wlr_output);
+		goto out;
+	}
+	pixman_region32_t uncovered;
+	pixman_region32_init(&uncovered);
+	pixman_region32_copy(&uncovered, &damage);
+	size_t i = nsurfaces;
+	wl_list_for_each_reverse(_res, &sample->compositor.surfaces, link) {
+		struct wlr_surface *surface = wl_resource_get_user_data(_res);
+		pixman_region32_t *region = &visible[--i];
+		pixman_region32_init(region);
+		if (surface == overlay || !surface->texture->valid) {
+			continue;
+		}
+		int32_t x, y;
+		surface_get_position(surface, wlr_output, &x, &y);
+		pixman_region32_intersect_rect(region, &uncovered, x, y,
+			surface->texture->width, surface->texture->height);
+
+		pixman_region32_t opaque;
+		pixman_region32_init(&opaque);
+		surface_get_opaque(surface, wlr_output, &opaque);
+		pixman_region32_subtract(&uncovered, &uncovered, &opaque);
+		pixman_region32_fini(&opaque);
+	}
+
 	wlr_renderer_begin(sample->renderer, wlr_output);
 
-	struct wl_resource *_res;
-	float matrix[16];
+	// Only what no opaque surface covers needs clearing
+	float clear_color[] = {0.25f, 0.25f, 0.25f, 1};
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&uncovered, &nrects);
+	for (int j = 0; j < nrects; ++j) {
+		wlr_renderer_scissor(sample->renderer, &rects[j]);
+		wlr_renderer_clear(sample->renderer, &clear_color);
+	}
+	pixman_region32_fini(&uncovered);
+
+	i = 0;
 	wl_list_for_each(_res, &sample->compositor.surfaces, link) {
 		struct wlr_surface *surface = wl_resource_get_user_data(_res);
-		wlr_surface_flush_damage(surface);
-		if (surface->texture->valid) {
-			wlr_texture_get_matrix(surface->texture, &matrix,
-					&wlr_output->transform_matrix, 200, 200);
-			wlr_render_with_matrix(sample->renderer, surface->texture, &matrix);
-
-			struct wlr_frame_callback *cb, *cnext;
-			wl_list_for_each_safe(cb, cnext, &surface->frame_callback_list, link) {
-				wl_callback_send_done(cb->resource, timespec_to_msec(ts));
-				wl_resource_destroy(cb->resource);
-			}
+		pixman_region32_t *region = &visible[i++];
+		if (!pixman_region32_not_empty(region)) {
+			pixman_region32_fini(region);
+			continue;
+		}
+
+		int32_t x, y;
+		surface_get_position(surface, wlr_output, &x, &y);
+		float matrix[16];
+		wlr_texture_get_matrix(surface->texture, &matrix,
+				&wlr_output->transform_matrix, x, y);
+
+		pixman_region32_t opaque;
+		pixman_region32_init(&opaque);
+		surface_get_opaque(surface, wlr_output, &opaque);
+		pixman_region32_intersect(&opaque, &opaque, region);
+		pixman_region32_subtract(region, region, &opaque);
+
+		wlr_renderer_set_blending(sample->renderer, false);
+		render_surface_region(sample->renderer, surface, &matrix, &opaque);
+		wlr_renderer_set_blending(sample->renderer, true);
+		render_surface_region(sample->renderer, surface, &matrix, region);
+		wlr_presentation_surface_sampled_on_output(sample->presentation,
+			surface, wlr_output);
+
+		pixman_region32_fini(&opaque);
+		pixman_region32_fini(region);
+	}
+	free(visible);
+	wlr_renderer_scissor(sample->renderer, NULL);
+
+	wl_list_for_each(_res, &sample->compositor.surfaces, link) {
+		struct wlr_surface *surface = wl_resource_get_user_data(_res);
+		if (surface == overlay || surface->texture->valid) {
+			send_frame_done(surface, ts);
 		}
 	}
 
 	wlr_renderer_end(sample->renderer);
 	wlr_output_swap_buffers(wlr_output);
+
+out:
+	pixman_region32_fini(&damage);
+}
+
+static void handle_output_add(struct output_state *output) {
+	struct output_data *odata = calloc(1, sizeof(struct output_data));
+	odata->frame_done_timer = wl_event_loop_add_timer(
+		output->compositor->event_loop, handle_frame_done_timer, output);
+	output->data = odata;
+	// Render each frame just in time for the vblank
+	wlr_output_set_frame_scheduling(output->output, true);
+}
+
+static void handle_output_remove(struct output_state *output) {
+	struct output_data *odata = output->data;
+	wl_event_source_remove(odata->frame_done_timer);
+	free(odata);
 }
 
 int main() {
 	struct sample_state state = { 0 };
-	struct compositor_state compositor = { 0,
+	struct compositor_state compositor = {
 		.data = &state,
+		.output_add_cb = handle_output_add,
+		.output_remove_cb = handle_output_remove,
 		.output_frame_cb = handle_output_frame,
 	};
+	state.state = &compositor;
 	compositor_init(&compositor);
 
 	state.renderer = wlr_gles2_renderer_init(compositor.backend);
 	wl_display_init_shm(compositor.display);
 	wl_compositor_init(compositor.display, &state.compositor, state.renderer);
+	state.compositor.surface_commit_cb = handle_surface_commit;
+	state.compositor.surface_destroy_cb = handle_surface_destroy;
+	state.compositor.data = &state;
 	wl_shell_init(compositor.display, &state.shell);
 	state.xdg_shell = wlr_xdg_shell_v6_init(compositor.display);
+	state.linux_dmabuf = wlr_linux_dmabuf_create(compositor.display,
+		wlr_backend_get_egl(compositor.backend));
+	state.presentation = wlr_presentation_create(compositor.display);
 
 	compositor_run(&compositor);
 }
@@ -6,10 +6,27 @@
 #include <wlr/types/wlr_region.h>
 #include "compositor.h"
 
+static void surface_commit_listener(struct wl_listener *listener, void *data) {
+	struct wlr_surface *surface = data;
+	struct wl_compositor_state *state = surface->compositor_data;
+
+	if (state->surface_commit_cb) {
+		state->surface_commit_cb(surface, state->data);
+	}
+}
+
 static void destroy_surface_listener(struct wl_listener *listener, void *data) {
 	struct wlr_surface *surface = wl_resource_get_user_data(data);
 	struct wl_compositor_state *state = surface->compositor_data;
 
+	if (state->surface_destroy_cb) {
+		state->surface_destroy_cb(surface, state->data);
+	}
+
+	struct wl_listener *commit_listener = surface->data;
+	wl_list_remove(&commit_listener->link);
+	free(commit_listener);
+
 	struct wl_resource *res = NULL;
 	wl_list_for_each(res, &state->surfaces, link) {
 		if (res == surface->resource) {
@@ -25,10 +42,19 @@ static void wl_compositor_create_surface(struct wl_client *client,
 	struct wl_resource *surface_resource = wl_resource_create(client,
 			&wl_surface_interface, wl_resource_get_version(resource), id);
 	struct wlr_surface *surface = wlr_surface_create(surface_resource, state->renderer);
+	if (!surface) {
+		wl_resource_destroy(surface_resource);
+		return;
+	}
 	surface->compositor_data = state;
 	surface->compositor_listener.notify = &destroy_surface_listener;
 	wl_resource_add_destroy_listener(surface_resource, &surface->compositor_listener);
 
+	struct wl_listener *commit_listener = calloc(1, sizeof(struct wl_listener));
+	commit_listener->notify = surface_commit_listener;
+	wl_signal_add(&surface->signals.commit, commit_listener);
+	surface->data = commit_listener;
+
 	wl_list_insert(&state->surfaces, wl_resource_get_link(surface_resource));
 }
 
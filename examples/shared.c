@@ -418,8 +418,14 @@ static void output_frame_notify(struct wl_listener *listener, void *data) {
 	struct output_state *output = wl_container_of(listener, output, frame);
 	struct compositor_state *compositor = output->compositor;
 
+	// Prefer the time the previous frame actually hit the screen
 	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (output->has_present) {
+		now = output->last_present;
+		output->has_present = false;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	}
 	if (compositor->output_frame_cb) {
 		compositor->output_frame_cb(output, &now);
 	}
@@ -428,6 +434,13 @@ static void output_frame_notify(struct wl_listener *listener, void *data) {
 	compositor->last_frame = now;
 }
 
+static void output_present_notify(struct wl_listener *listener, void *data) {
+	struct wlr_output_event_present *event = data;
+	struct output_state *output = wl_container_of(listener, output, present);
+	output->last_present = event->when;
+	output->has_present = true;
+}
+
 static void output_add_notify(struct wl_listener *listener, void *data) {
 	struct wlr_output *output = data;
 	struct compositor_state *state = wl_container_of(listener, state, output_add);
@@ -444,6 +457,8 @@ static void output_add_notify(struct wl_listener *listener, void *data) {
 	ostate->frame.notify = output_frame_notify;
 	wl_list_init(&ostate->frame.link);
 	wl_signal_add(&output->events.frame, &ostate->frame);
+	ostate->present.notify = output_present_notify;
+	wl_signal_add(&output->events.present, &ostate->present);
 	wl_list_insert(&state->outputs, &ostate->link);
 	if (state->output_add_cb) {
 		state->output_add_cb(ostate);
@@ -468,6 +483,7 @@ static void output_remove_notify(struct wl_listener *listener, void *data) {
 	}
 	wl_list_remove(&ostate->link);
 	wl_list_remove(&ostate->frame.link);
+	wl_list_remove(&ostate->present.link);
 	free(ostate);
 }
 
@@ -16,7 +16,11 @@ struct output_state {
 	struct compositor_state *compositor;
 	struct wlr_output *output;
 	struct wl_listener frame;
+	struct wl_listener present;
 	struct timespec last_frame;
+	// Time the last frame was shown, valid until the next frame event
+	struct timespec last_present;
+	bool has_present;
 	struct wl_list link;
 	void *data;
 };
@@ -1,19 +1,36 @@
 #ifndef WLR_DRM_UTIL_H
 #define WLR_DRM_UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <wlr/types/wlr_output.h>
 
+struct gbm_bo;
+
 // Calculates a more accurate refresh rate (mHz) than what mode itself provides
 int32_t calculate_refresh_rate(drmModeModeInfo *mode);
 // Populates the make/model/phys_{width,height} of output from the edid data
 void parse_edid(struct wlr_output *restrict output, size_t len, const uint8_t *data);
 // Returns the string representation of a DRM output type
 const char *conn_get_name(uint32_t type_id);
-// Returns the DRM framebuffer id for a gbm_bo
-uint32_t get_fb_for_bo(struct gbm_bo *bo);
+
+/*
+ * Framebuffers are created the first time a gbm_bo is displayed and live as
+ * long as the bo, whether it's one of ours or an imported client buffer.
+ */
+struct wlr_drm_fb_cache {
+	int fd;
+	bool addfb2_modifiers; // DRM_CAP_ADDFB2_MODIFIERS
+	// Lookups which found the framebuffer of the bo, or had to create it
+	size_t hits, misses;
+	size_t live; // Framebuffers currently registered with DRM
+};
+
+// Returns the DRM framebuffer id for a gbm_bo, or 0 if it can't be displayed
+uint32_t get_fb_for_bo(struct wlr_drm_fb_cache *cache, struct gbm_bo *bo);
 
 // Part of match_obj
 enum {
@@ -28,9 +45,11 @@ enum {
  * objs contains a bit array which resources it can be matched with.
  * e.g. Bit 0 set means can be matched with res[0]
  *
- * res contains an index of which objs it is matched with or UNMATCHED.
+ * res contains an index of which objs it is matched with, UNMATCHED, or SKIP
+ * for resources which must be left alone.
  *
- * This solution is left in out.
+ * The solution matches as many resources as possible, and among those keeps
+ * as many of the matches in res as possible. It is left in out.
  * Returns the total number of matched solutions.
  */
 size_t match_obj(size_t num_objs, const uint32_t objs[static restrict num_objs],
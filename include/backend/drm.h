@@ -16,8 +16,33 @@
 #include <wlr/util/list.h>
 
 #include <backend/udev.h>
+#include "backend/drm-util.h"
 #include "drm-properties.h"
 
+/*
+ * A client buffer imported into GBM. It is kept until the wl_buffer is
+ * destroyed, so that the import and its framebuffer are reused when the
+ * client shows the buffer again, and until no scanout uses it anymore.
+ */
+struct wlr_drm_client_bo {
+	struct gbm_bo *bo; // NULL if the buffer couldn't be imported
+	struct wl_resource *buffer; // NULL once the wl_buffer is gone
+	struct wl_listener buffer_destroy;
+	size_t n_refs;
+	struct wl_list link; // wlr_drm_renderer::client_bos
+};
+
+/*
+ * A client buffer imported for direct scanout. It holds a lock on the
+ * wl_buffer until the buffer has been flipped off the screen.
+ */
+struct wlr_drm_scanout {
+	struct wlr_drm_client_bo *client_bo;
+	struct gbm_bo *bo; // client_bo->bo
+	struct wl_resource *buffer;
+	struct wl_listener buffer_destroy;
+};
+
 struct wlr_drm_plane {
 	uint32_t type;
 	uint32_t id;
@@ -32,6 +57,15 @@ struct wlr_drm_plane {
 	struct gbm_bo *front;
 	struct gbm_bo *back;
 
+	// Client buffers scanned out in place of our own, same scheme as
+	// front/back: back is on screen, front is unlocked after the next flip
+	struct wlr_drm_scanout *scanout_front;
+	struct wlr_drm_scanout *scanout_back;
+
+	// Only used by overlays
+	struct wlr_drm_crtc *overlay_crtc; // Showing client buffers on this CRTC
+	bool overlay_used; // Assigned for the upcoming frame
+
 	// Only used by cursor
 	float matrix[16];
 	struct wlr_renderer *wlr_rend;
@@ -74,6 +108,9 @@ struct wlr_drm_renderer {
 	int fd;
 	struct gbm_device *gbm;
 	struct wlr_egl egl;
+
+	struct wlr_drm_fb_cache fb_cache;
+	struct wl_list client_bos;
 };
 
 bool wlr_drm_renderer_init(struct wlr_drm_renderer *renderer, int fd);
@@ -85,6 +122,11 @@ struct wlr_drm_backend {
 	struct wlr_backend backend;
 
 	const struct wlr_drm_interface *iface;
+	// Page flip timestamps use CLOCK_MONOTONIC rather than the wall clock
+	bool monotonic_timestamps;
+	// Page flip events say which CRTC flipped, needed to commit several
+	// CRTCs at once
+	bool crtc_in_vblank_event;
 
 	int fd;
 	dev_t dev;
@@ -114,12 +156,19 @@ struct wlr_drm_backend {
 
 	struct wl_display *display;
 	struct wl_event_source *drm_event;
+	// Set while waiting for page flips outside of the event loop, the frame
+	// events are then sent from deferred_idle
+	bool draining_flips;
+	struct wl_event_source *deferred_idle;
 
 	struct wl_listener session_signal;
 	struct wl_listener drm_invalidated;
 
 	uint32_t taken_crtcs;
 	list_t *outputs;
+	// Nesting depth of output configuration transactions. While non-zero,
+	// wlr_drm_modeset_outputs only leaves the outputs marked
+	int config_depth;
 
 	struct wlr_drm_renderer renderer;
 	struct wlr_session *session;
@@ -155,6 +204,23 @@ struct wlr_output_state {
 	struct wlr_drm_renderer *renderer;
 
 	bool pageflip_pending;
+	// Waiting for wlr_drm_modeset_outputs, no frames are sent until then
+	bool modeset_pending;
+
+	// Requested adaptive sync setting. While pending, it is staged in the
+	// CRTC's atomic request and base->adaptive_sync still has the old one
+	bool adaptive_sync;
+	bool adaptive_sync_pending;
+
+	// Frame events held back by a page flip wait or a failed page flip
+	struct {
+		bool pending;
+		bool present; // Otherwise only the frame is unblocked
+		bool has_when;
+		struct timespec when;
+		unsigned seq;
+		uint32_t flags;
+	} deferred;
 };
 
 // Used to provide atomic or legacy DRM functions
@@ -166,6 +232,26 @@ struct wlr_drm_interface {
 	bool (*crtc_pageflip)(struct wlr_drm_backend *backend,
 			struct wlr_output_state *output, struct wlr_drm_crtc *crtc,
 			uint32_t fb_id, drmModeModeInfo *mode);
+	// Check if fb_id can be displayed on the primary plane of crtc,
+	// without changing anything
+	bool (*crtc_test_fb)(struct wlr_drm_backend *backend,
+			struct wlr_output_state *output, struct wlr_drm_crtc *crtc,
+			uint32_t fb_id);
+	// Show fb_id on an overlay plane of crtc, if a test commit accepts it.
+	// The change is applied with the next pageflip. Set fb_id to 0 to disable
+	bool (*crtc_set_overlay)(struct wlr_drm_backend *backend,
+			struct wlr_drm_crtc *crtc, struct wlr_drm_plane *plane,
+			uint32_t fb_id, int32_t x, int32_t y, uint32_t width, uint32_t height);
+	// Modeset all the given outputs in a single commit, showing fb_ids[i] on
+	// the primary plane of outputs[i], and turn off the CRTCs no connected
+	// output uses anymore. The commit is tested first, nothing changes if it
+	// is rejected. May be NULL if unsupported
+	bool (*outputs_modeset)(struct wlr_drm_backend *backend, size_t count,
+			struct wlr_output_state **outputs, const uint32_t *fb_ids);
+	// Enable or disable variable refresh on crtc. The change is applied with
+	// the next pageflip. May be NULL if unsupported
+	bool (*crtc_set_vrr)(struct wlr_drm_backend *backend,
+			struct wlr_drm_crtc *crtc, bool enable);
 	// Enable the cursor buffer on crtc. Set bo to NULL to disable
 	bool (*crtc_set_cursor)(struct wlr_drm_backend *backend,
 			struct wlr_drm_crtc *crtc, struct gbm_bo *bo);
@@ -183,5 +269,6 @@ void wlr_drm_scan_connectors(struct wlr_drm_backend *state);
 int wlr_drm_event(int fd, uint32_t mask, void *data);
 
 void wlr_drm_output_start_renderer(struct wlr_output_state *output);
+void wlr_drm_modeset_outputs(struct wlr_drm_backend *backend);
 
 #endif
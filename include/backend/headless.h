@@ -0,0 +1,33 @@
+#ifndef _WLR_INTERNAL_BACKEND_HEADLESS_H
+#define _WLR_INTERNAL_BACKEND_HEADLESS_H
+
+#include <wayland-server.h>
+#include <wlr/egl.h>
+#include <wlr/backend/headless.h>
+#include <wlr/util/list.h>
+
+#define HEADLESS_DEFAULT_REFRESH (60 * 1000) // 60 Hz
+
+struct wlr_headless_backend {
+	struct wlr_backend backend;
+	struct wl_display *display;
+	struct wlr_egl egl;
+	bool has_egl; // Only the pixman renderer can be used without
+	list_t *outputs;
+	bool started;
+	struct wlr_renderer *pixman_renderer; // NULL when rendering with EGL
+};
+
+struct wlr_output_state {
+	struct wlr_headless_backend *backend;
+	struct wlr_output *wlr_output;
+	EGLSurface egl_surface; // pbuffer the size of the output, if using EGL
+	void *pixels; // XRGB8888 framebuffer, only for the pixman renderer
+	int pixels_width, pixels_height;
+	struct wl_event_source *frame_timer;
+	int frame_delay; // ms
+};
+
+void headless_output_destroy_pbuffer(struct wlr_output_state *output);
+
+#endif
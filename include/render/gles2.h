@@ -13,6 +13,9 @@
 #include <wlr/util/log.h>
 
 extern PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+// Core in GLES3, NULL when pixel buffer objects can't be used
+extern PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRangeEXT;
+extern PFNGLUNMAPBUFFEROESPROC glUnmapBufferOES;
 
 struct pixel_format {
 	uint32_t wl_format;
@@ -21,17 +24,49 @@ struct pixel_format {
 	GLuint *shader;
 };
 
+// Vertex attribute locations shared by all shaders
+enum gles2_attrib {
+	GLES2_ATTRIB_POS = 0,
+	GLES2_ATTRIB_TEXCOORD,
+	GLES2_ATTRIB_COLOR,
+};
+
+struct gles2_vertex {
+	GLfloat x, y;
+	GLfloat s, t;
+	GLfloat color[4];
+};
+
+// Keeps the indices within GL_UNSIGNED_SHORT
+#define GLES2_BATCH_MAX_QUADS 1024
+
 struct wlr_renderer_state {
 	struct wlr_renderer *renderer;
 	struct wlr_egl *egl;
+	struct wlr_output *output; // Being rendered, between begin and end
+	bool blending;
+
+	GLuint vbo, ibo;
+	GLuint pbo; // Staging buffer for SHM uploads, 0 without PBO support
+	// Consecutive quads drawn with the same shader and texture
+	struct {
+		GLuint program;
+		GLenum target;
+		GLuint tex_id;
+		size_t quads;
+		struct gles2_vertex verts[GLES2_BATCH_MAX_QUADS * 4];
+	} batch;
 };
 
 struct wlr_texture_state {
 	struct wlr_texture *wlr_texture;
+	struct wlr_renderer_state *renderer; // Must outlive the texture
 	struct wlr_egl *egl;
 	GLuint tex_id;
+	GLenum target;
 	const struct pixel_format *pixel_format;
 	EGLImageKHR image;
+	bool inverted_y; // The first row is the bottom one
 };
 
 struct shaders {
@@ -46,9 +81,8 @@ extern struct shaders shaders;
 
 const struct pixel_format *gl_format_for_wl_format(enum wl_shm_format fmt);
 
-struct wlr_texture *gles2_texture_init();
+struct wlr_texture *gles2_texture_init(struct wlr_renderer_state *renderer);
 
-extern const GLchar quad_vertex_src[];
 extern const GLchar quad_fragment_src[];
 extern const GLchar ellipse_fragment_src[];
 extern const GLchar vertex_src[];
@@ -56,10 +90,41 @@ extern const GLchar fragment_src_rgba[];
 extern const GLchar fragment_src_rgbx[];
 extern const GLchar fragment_src_external[];
 
+/*
+ * Tracked GL state. Between gles2_state_begin and gles2_state_end, changes to
+ * the current value are skipped. Code that changes the same state with plain
+ * GL calls in between has to do so outside of a begin/end pair.
+ */
+void gles2_state_begin(void);
+void gles2_state_end(void);
+void gles2_use_program(GLuint program);
+void gles2_active_texture(GLenum unit);
+void gles2_bind_texture(GLenum target, GLuint tex_id);
+// Must be called when deleting a texture or buffer that may be bound
+void gles2_forget_texture(GLuint tex_id);
+void gles2_forget_buffer(GLuint buffer);
+// Binds the buffers and sets up the gles2_vertex attributes to read from them
+void gles2_bind_vertex_buffers(GLuint vbo, GLuint ibo);
+void gles2_set_blend(bool enabled);
+void gles2_blend_func(GLenum src, GLenum dst);
+void gles2_set_scissor(bool enabled);
+void gles2_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+// Counts a draw call for wlr_gles2_get_stats
+void gles2_count_draw(size_t quads);
+
 bool _gles2_flush_errors(const char *file, int line);
 #define gles2_flush_errors(...) \
 	_gles2_flush_errors(_strip_path(__FILE__), __LINE__)
 
+// Logs the messages of the current context through GL_KHR_debug, if present
+void gles2_init_debug(void);
+
+// glGetError stalls on many drivers, so it's only polled after every call in
+// debug builds. Otherwise errors are only seen through GL_KHR_debug.
+#ifdef WLR_GL_DEBUG
 #define GL_CALL(func) func; gles2_flush_errors()
+#else
+#define GL_CALL(func) func
+#endif
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef _WLR_RENDER_PIXMAN_INTERNAL_H
+#define _WLR_RENDER_PIXMAN_INTERNAL_H
+#include <stdbool.h>
+#include <pixman.h>
+#include <wayland-server-protocol.h>
+#include <wlr/render.h>
+#include <wlr/util/log.h>
+
+struct wlr_renderer_state {
+	struct wlr_renderer *renderer;
+	pixman_image_t *target; // bound with wlr_pixman_renderer_bind_buffer
+	struct wlr_output *output; // Being rendered, between begin and end
+	pixman_op_t op; // PIXMAN_OP_OVER unless blending is disabled
+	bool scissored;
+	pixman_box32_t scissor; // in target pixels
+};
+
+struct wlr_texture_state {
+	struct wlr_texture *wlr_texture;
+	pixman_image_t *image;
+};
+
+/**
+ * Returns the pixman format matching a wl_shm format, or 0 if there is none.
+ */
+pixman_format_code_t pixman_format_for_wl_format(enum wl_shm_format fmt);
+
+struct wlr_texture *pixman_texture_init(void);
+
+#endif
@@ -8,5 +8,21 @@
 
 struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 		struct wlr_session *session, struct wlr_udev *udev, int gpu_fd);
+/**
+ * Starts an output configuration transaction. Until the matching
+ * wlr_drm_backend_commit_config, modes set with wlr_output_set_mode are only
+ * recorded. Transactions may be nested, the outermost one applies them.
+ */
+void wlr_drm_backend_begin_config(struct wlr_backend *backend);
+/**
+ * Ends an output configuration transaction. The CRTCs, planes and connectors
+ * of all outputs configured since it began are then set in a single atomic
+ * commit where possible, so the screens change once and together.
+ */
+void wlr_drm_backend_commit_config(struct wlr_backend *backend);
+/**
+ * True if the given backend is a DRM backend.
+ */
+bool wlr_backend_is_drm(struct wlr_backend *backend);
 
 #endif
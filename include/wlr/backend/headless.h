@@ -0,0 +1,37 @@
+#ifndef WLR_BACKEND_HEADLESS_H
+#define WLR_BACKEND_HEADLESS_H
+
+#include <wayland-server.h>
+#include <wlr/backend.h>
+#include <wlr/render.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Creates a headless backend. Outputs render into offscreen EGL pbuffers, so
+ * no GPU or display is needed; Mesa's software rasterizer will do. Without
+ * surfaceless EGL, outputs can only be rendered with a pixman renderer. The
+ * backend is created with no outputs, add them with wlr_headless_add_output.
+ */
+struct wlr_backend *wlr_headless_backend_create(struct wl_display *display);
+/**
+ * Adds a virtual output. Frame events are driven by a timer firing at the
+ * given refresh rate, in mHz, or 60Hz if zero. You may remove outputs by
+ * destroying them.
+ */
+struct wlr_output *wlr_headless_add_output(struct wlr_backend *backend,
+		int32_t width, int32_t height, int32_t refresh);
+/**
+ * Makes the outputs render into memory with the given pixman renderer rather
+ * than into EGL pbuffers, which are freed: making an output current binds its
+ * buffer to the renderer. Pass NULL to go back to EGL. The renderer must outlive the
+ * backend, or be unset before it is destroyed.
+ */
+void wlr_headless_backend_set_pixman_renderer(struct wlr_backend *backend,
+		struct wlr_renderer *renderer);
+/**
+ * True if the given backend is a headless backend.
+ */
+bool wlr_backend_is_headless(struct wlr_backend *backend);
+
+#endif
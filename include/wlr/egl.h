@@ -4,6 +4,12 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
 
 struct wlr_egl {
 	EGLDisplay display;
@@ -18,10 +24,18 @@ struct wlr_egl {
 	PFNEGLQUERYWAYLANDBUFFERWL eglQueryWaylandBufferWL;
 	PFNEGLBINDWAYLANDDISPLAYWL eglBindWaylandDisplayWL;
 	PFNEGLUNBINDWAYLANDDISPLAYWL eglUnbindWaylandDisplayWL;
+	PFNEGLQUERYDMABUFFORMATSEXTPROC eglQueryDmaBufFormatsEXT;
+	PFNEGLQUERYDMABUFMODIFIERSEXTPROC eglQueryDmaBufModifiersEXT;
 
 	const char *egl_exts;
 	const char *gl_exts;
 
+	struct {
+		bool buffer_age;
+		bool dmabuf_import;
+		bool dmabuf_import_modifiers;
+	} exts;
+
 	struct wl_display *wl_display;
 };
 
@@ -56,12 +70,46 @@ bool wlr_egl_query_buffer(struct wlr_egl *egl, struct wl_resource *buf,
  */
 EGLSurface wlr_egl_create_surface(struct wlr_egl *egl, void *window);
 
+/**
+ * Returns the age of the back buffer of surface, as in EGL_EXT_buffer_age, or
+ * -1 if unknown. The surface must be current.
+ */
+int wlr_egl_get_buffer_age(struct wlr_egl *egl, EGLSurface surface);
+
 /**
  * Creates an egl image from the given client buffer and attributes.
  */
 EGLImageKHR wlr_egl_create_image(struct wlr_egl *egl,
 		EGLenum target, EGLClientBuffer buffer, const EGLint *attribs);
 
+/**
+ * Creates an egl image from the given dmabuf attributes. Check usability
+ * of the dmabuf with wlr_egl_check_import_dmabuf once first.
+ */
+EGLImageKHR wlr_egl_create_image_from_dmabuf(struct wlr_egl *egl,
+		struct wlr_dmabuf_buffer_attribs *attributes);
+
+/**
+ * Try to import the given dmabuf. On success return true false otherwise.
+ * If this succeeds the dmabuf can be used for rendering on a texture.
+ */
+bool wlr_egl_check_import_dmabuf(struct wlr_egl *egl,
+		struct wlr_dmabuf_buffer_attribs *attributes);
+
+/**
+ * Get the available dmabuf formats. Returns the number of formats, or -1 if
+ * dmabufs can't be imported at all. The caller frees the array.
+ */
+int wlr_egl_get_dmabuf_formats(struct wlr_egl *egl, int **formats);
+
+/**
+ * Get the available modifiers for the given dmabuf format. Returns the number
+ * of modifiers, 0 if only implicit modifiers are supported, or -1 on error.
+ * The caller frees the array.
+ */
+int wlr_egl_get_dmabuf_modifiers(struct wlr_egl *egl, int format,
+		uint64_t **modifiers);
+
 /**
  * Destroys an egl image created with the given wlr_egl.
  */
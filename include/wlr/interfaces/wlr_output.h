@@ -15,6 +15,17 @@ struct wlr_output_impl {
 	void (*destroy)(struct wlr_output_state *state);
 	void (*make_current)(struct wlr_output_state *state);
 	void (*swap_buffers)(struct wlr_output_state *state);
+	// Returns true if a frame event will still follow, e.g. because pending
+	// changes had to be committed
+	bool (*skip_frame)(struct wlr_output_state *state);
+	// Returns the age of the back buffer as in EGL_EXT_buffer_age, or -1
+	int (*get_buffer_age)(struct wlr_output_state *state);
+	bool (*present_buffer)(struct wlr_output_state *state,
+			struct wl_resource *buffer);
+	size_t (*assign_overlays)(struct wlr_output_state *state,
+			size_t count, struct wlr_output_overlay *overlays);
+	// Sets wlr_output::adaptive_sync itself, once the change is applied
+	bool (*set_adaptive_sync)(struct wlr_output_state *state, bool enable);
 };
 
 struct wlr_output *wlr_output_create(struct wlr_output_impl *impl,
@@ -23,5 +34,17 @@ void wlr_output_free(struct wlr_output *output);
 void wlr_output_update_matrix(struct wlr_output *output);
 struct wl_global *wlr_output_create_global(
 		struct wlr_output *wlr_output, struct wl_display *display);
+/**
+ * Emits the present event. If when is NULL, the current time is used and the
+ * hardware clock flag is cleared. The refresh interval is derived from the
+ * current mode when not given.
+ */
+void wlr_output_send_present(struct wlr_output *output, struct timespec *when,
+		unsigned seq, uint32_t flags);
+/**
+ * Emits the frame event. Backends must use this rather than emitting the
+ * signal themselves.
+ */
+void wlr_output_send_frame(struct wlr_output *output);
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef _WLR_RENDER_H
 #define _WLR_RENDER_H
 #include <stdint.h>
+#include <stdbool.h>
+#include <pixman.h>
 #include <wayland-server-protocol.h>
 #include <wlr/types/wlr_output.h>
 
@@ -9,6 +11,21 @@ struct wlr_renderer;
 
 void wlr_renderer_begin(struct wlr_renderer *r, struct wlr_output *output);
 void wlr_renderer_end(struct wlr_renderer *r);
+/**
+ * Clears the output, or only the scissor box if one is set.
+ */
+void wlr_renderer_clear(struct wlr_renderer *r, const float (*color)[4]);
+/**
+ * Restricts rendering to a box in output-local coordinates, used to repaint
+ * only the damaged parts of the output. Set box to NULL to render everywhere.
+ */
+void wlr_renderer_scissor(struct wlr_renderer *r, pixman_box32_t *box);
+/**
+ * Enables or disables alpha blending for the following draws. Blending is
+ * enabled by wlr_renderer_begin. Content known to be opaque is cheaper to draw
+ * with blending disabled, since the destination doesn't need to be read.
+ */
+void wlr_renderer_set_blending(struct wlr_renderer *r, bool blending);
 /**
  * Requests a texture handle from this renderer.
  */
@@ -25,6 +42,10 @@ struct wlr_texture *wlr_render_texture_init(struct wlr_renderer *r);
  * 	wlr_render_with_matrix(renderer, texture, &matrix);
  *
  * This will render the texture at <123, 321>.
+ *
+ * Between wlr_renderer_begin and wlr_renderer_end, renderers may defer the
+ * actual drawing to batch it with following draws. The texture must not be
+ * modified or destroyed until wlr_renderer_end.
  */
 bool wlr_render_with_matrix(struct wlr_renderer *r,
 		struct wlr_texture *texture, const float (*matrix)[16]);
@@ -48,6 +69,11 @@ const enum wl_shm_format *wlr_renderer_get_formats(
  */
 bool wlr_renderer_buffer_is_drm(struct wlr_renderer *renderer,
 		struct wl_resource *buffer);
+/**
+ * Gets the size of a DRM buffer. Returns false if it isn't one.
+ */
+bool wlr_renderer_drm_buffer_get_size(struct wlr_renderer *renderer,
+		struct wl_resource *buffer, int *width, int *height);
 /**
  * Destroys this wlr_renderer. Textures must be destroyed separately.
  */
@@ -96,6 +122,14 @@ bool wlr_texture_upload_shm(struct wlr_texture *tex, uint32_t format,
  bool wlr_texture_upload_drm(struct wlr_texture *tex,
  	struct wl_resource *drm_buffer);
 
+/**
+ * Attaches the contents of the given linux-dmabuf wl_buffer resource onto the
+ * texture without copying. Will fail (return false) if the buffer can't be
+ * imported.
+ */
+bool wlr_texture_upload_dmabuf(struct wlr_texture *tex,
+		struct wl_resource *dmabuf_resource);
+
 /**
  * Copies a rectangle of pixels from a wl_shm_buffer onto the texture. The
  * buffer is not accessed after this function returns. Under some circumstances,
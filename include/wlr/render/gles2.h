@@ -1,9 +1,24 @@
 #ifndef _WLR_GLES2_RENDERER_H
 #define _WLR_GLES2_RENDERER_H
+#include <stddef.h>
 #include <wlr/render.h>
 #include <wlr/backend.h>
 
 struct wlr_egl;
 struct wlr_renderer *wlr_gles2_renderer_init(struct wlr_backend *backend);
 
+struct wlr_gles2_stats {
+	size_t state_calls; // GL state changes issued
+	size_t skipped_calls; // state changes dropped as redundant
+	size_t draw_calls;
+	size_t quads; // drawn by the draw calls
+};
+
+/**
+ * Gets the GL calls made by the GLES2 renderers since the last reset. The GL
+ * state is tracked for all of them together, so are the counts.
+ */
+void wlr_gles2_get_stats(struct wlr_gles2_stats *stats);
+void wlr_gles2_reset_stats(void);
+
 #endif
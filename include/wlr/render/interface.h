@@ -2,6 +2,7 @@
 #define _WLR_RENDER_INTERFACE_H
 #include <wayland-server-protocol.h>
 #include <stdbool.h>
+#include <pixman.h>
 #include <wlr/render.h>
 #include <wlr/types/wlr_output.h>
 
@@ -16,6 +17,9 @@ struct wlr_renderer {
 struct wlr_renderer_impl {
 	void (*begin)(struct wlr_renderer_state *state, struct wlr_output *output);
 	void (*end)(struct wlr_renderer_state *state);
+	void (*clear)(struct wlr_renderer_state *state, const float (*color)[4]);
+	void (*scissor)(struct wlr_renderer_state *state, pixman_box32_t *box);
+	void (*set_blending)(struct wlr_renderer_state *state, bool blending);
 	struct wlr_texture *(*texture_init)(struct wlr_renderer_state *state);
 	bool (*render_with_matrix)(struct wlr_renderer_state *state,
 		struct wlr_texture *texture, const float (*matrix)[16]);
@@ -27,6 +31,8 @@ struct wlr_renderer_impl {
 		struct wlr_renderer_state *state, size_t *len);
 	bool (*buffer_is_drm)(struct wlr_renderer_state *state,
 		struct wl_resource *buffer);
+	bool (*drm_buffer_get_size)(struct wlr_renderer_state *state,
+		struct wl_resource *buffer, int *width, int *height);
 	void (*destroy)(struct wlr_renderer_state *state);
 };
 
@@ -46,6 +52,8 @@ struct wlr_texture_impl {
 		int x, int y, int width, int height, struct wl_shm_buffer *shm);
 	bool (*upload_drm)(struct wlr_texture_state *state,
 		struct wl_resource *drm_buf);
+	bool (*upload_dmabuf)(struct wlr_texture_state *state,
+		struct wl_resource *dmabuf_resource);
 	void (*get_matrix)(struct wlr_texture_state *state,
 		float (*matrix)[16], const float (*projection)[16], int x, int y);
 	void (*bind)(struct wlr_texture_state *state);
@@ -0,0 +1,22 @@
+#ifndef _WLR_PIXMAN_RENDERER_H
+#define _WLR_PIXMAN_RENDERER_H
+#include <stdbool.h>
+#include <wayland-server-protocol.h>
+#include <wlr/render.h>
+
+/**
+ * Creates a software renderer compositing with pixman. Only SHM buffers can
+ * be used as textures.
+ */
+struct wlr_renderer *wlr_pixman_renderer_init(void);
+/**
+ * Sets the memory following frames are rendered into, such as a mapped DRM
+ * dumb buffer, with the stride given in bytes. It must stay valid until
+ * another buffer is bound or the renderer is destroyed. Pass NULL data to
+ * unbind.
+ */
+bool wlr_pixman_renderer_bind_buffer(struct wlr_renderer *renderer,
+		void *data, enum wl_shm_format format, int width, int height,
+		int stride);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _WLR_TYPES_WLR_BUFFER_H
+#define _WLR_TYPES_WLR_BUFFER_H
+
+struct wl_resource;
+
+// Client buffers are released once the last lock on them is dropped. Anything
+// still reading from a buffer, like a surface or a plane scanning it out,
+// holds a lock.
+void wlr_buffer_lock(struct wl_resource *buffer);
+void wlr_buffer_unlock(struct wl_resource *buffer);
+
+#endif
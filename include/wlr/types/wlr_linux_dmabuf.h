@@ -0,0 +1,64 @@
+#ifndef _WLR_LINUX_DMABUF_H
+#define _WLR_LINUX_DMABUF_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <wayland-server.h>
+
+#define WLR_LINUX_DMABUF_MAX_PLANES 4
+
+struct wlr_egl;
+
+struct wlr_dmabuf_buffer_attribs {
+	int32_t width, height;
+	uint32_t format;
+	uint32_t flags; // enum zwp_linux_buffer_params_v1_flags
+	uint64_t modifier[WLR_LINUX_DMABUF_MAX_PLANES];
+
+	int n_planes;
+	uint32_t offset[WLR_LINUX_DMABUF_MAX_PLANES];
+	uint32_t stride[WLR_LINUX_DMABUF_MAX_PLANES];
+	int fd[WLR_LINUX_DMABUF_MAX_PLANES];
+};
+
+struct wlr_dmabuf_buffer {
+	struct wlr_egl *egl;
+	struct wl_resource *buffer_resource;
+	struct wl_resource *params_resource;
+	struct wlr_dmabuf_buffer_attribs attributes;
+};
+
+struct wlr_linux_dmabuf {
+	struct wl_global *wl_global;
+	struct wl_list wl_resources;
+	struct wlr_egl *egl;
+};
+
+/**
+ * Returns true if the given resource was created via the linux-dmabuf
+ * buffer protocol, false otherwise.
+ */
+bool wlr_dmabuf_resource_is_buffer(struct wl_resource *buffer_resource);
+
+/**
+ * Returns the wlr_dmabuf_buffer if the given resource was created
+ * via the linux-dmabuf buffer protocol.
+ */
+struct wlr_dmabuf_buffer *wlr_dmabuf_buffer_from_buffer_resource(
+		struct wl_resource *buffer_resource);
+
+/**
+ * Returns true if the client asked for the buffer contents to be shown upside
+ * down. Such buffers can't be scanned out as they are.
+ */
+bool wlr_dmabuf_buffer_has_inverted_y(struct wlr_dmabuf_buffer *dmabuf);
+
+/**
+ * Creates the zwp_linux_dmabuf_v1 global. The formats and modifiers the given
+ * EGL display can import are advertised to clients.
+ */
+struct wlr_linux_dmabuf *wlr_linux_dmabuf_create(struct wl_display *display,
+		struct wlr_egl *egl);
+
+void wlr_linux_dmabuf_destroy(struct wlr_linux_dmabuf *linux_dmabuf);
+
+#endif
@@ -1,8 +1,15 @@
 #ifndef _WLR_TYPES_OUTPUT_H
 #define _WLR_TYPES_OUTPUT_H
 #include <wayland-server.h>
+#include <pixman.h>
 #include <wlr/util/list.h>
 #include <stdbool.h>
+#include <time.h>
+
+// Number of previous frames whose damage is remembered for buffer age
+#define WLR_OUTPUT_DAMAGE_HISTORY 4
+// Number of previous frames whose render time predicts the next one
+#define WLR_OUTPUT_RENDER_HISTORY 16
 
 struct wlr_output_mode_state;
 
@@ -16,12 +23,38 @@ struct wlr_output_mode {
 struct wlr_output_impl;
 struct wlr_output_state;
 
+struct wlr_output_overlay {
+	struct wl_resource *buffer;
+	int32_t x, y; // position on the output
+	bool accepted; // set by wlr_output_assign_overlays
+};
+
+enum wlr_output_present_flag {
+	// The presentation was synchronized to the vertical retrace
+	WLR_OUTPUT_PRESENT_VSYNC = 0x1,
+	// The timestamp comes from the display hardware
+	WLR_OUTPUT_PRESENT_HW_CLOCK = 0x2,
+	// The hardware signalled that the presentation completed
+	WLR_OUTPUT_PRESENT_HW_COMPLETION = 0x4,
+	// A client buffer was scanned out directly
+	WLR_OUTPUT_PRESENT_ZERO_COPY = 0x8,
+};
+
+struct wlr_output_event_present {
+	struct wlr_output *output;
+	struct timespec when; // CLOCK_MONOTONIC
+	unsigned seq; // vblank counter, 0 if unknown
+	int refresh; // refresh interval in ns, 0 if unknown
+	uint32_t flags; // enum wlr_output_present_flag
+};
+
 struct wlr_output {
 	const struct wlr_output_impl *impl;
 	struct wlr_output_state *state;
 	void *user_data;
 	struct wl_global *wl_global;
 	struct wl_list wl_resources;
+	struct wl_display *display;
 
 	uint32_t flags;
 	char name[16];
@@ -35,13 +68,49 @@ struct wlr_output {
 
 	float transform_matrix[16];
 
+	// Damage accumulated for the next frame, in output-local coordinates
+	pixman_region32_t damage;
+	// Damage of the previous frames, damage_history[damage_history_idx]
+	// being the most recent
+	pixman_region32_t damage_history[WLR_OUTPUT_DAMAGE_HISTORY];
+	size_t damage_history_idx;
+
+	// A frame event will follow without having to schedule one
+	bool frame_pending;
+	struct wl_event_source *idle_frame;
+
+	// Delays frame events towards the next vblank, see
+	// wlr_output_set_frame_scheduling
+	struct {
+		bool enabled;
+		struct wl_event_source *timer;
+		// Present time and refresh interval of the last frame, valid until
+		// the next frame event
+		struct timespec last_present;
+		int refresh; // ns
+		bool has_present;
+		bool delayed; // The frame being rendered was delayed
+		bool rendering;
+		struct timespec frame_start;
+		int render_time[WLR_OUTPUT_RENDER_HISTORY]; // ns
+		size_t render_time_idx, render_time_count;
+	} frame_scheduler;
+
+	// Variable refresh rate, see wlr_output_enable_adaptive_sync
+	bool adaptive_sync_capable;
+	bool adaptive_sync;
+
 	/* Note: some backends may have zero modes */
 	list_t *modes;
 	struct wlr_output_mode *current_mode;
 
 	struct {
 		struct wl_signal frame;
+		// Emitted when a new frame was shown, before the next frame event,
+		// with a struct wlr_output_event_present
+		struct wl_signal present;
 		struct wl_signal resolution;
+		struct wl_signal destroy;
 	} events;
 
 	struct {
@@ -68,5 +137,68 @@ void wlr_output_effective_resolution(struct wlr_output *output,
 		int *width, int *height);
 void wlr_output_make_current(struct wlr_output *output);
 void wlr_output_swap_buffers(struct wlr_output *output);
+/**
+ * Adds damage to the next frame, in output-local coordinates.
+ */
+void wlr_output_add_damage(struct wlr_output *output,
+		pixman_region32_t *damage);
+void wlr_output_add_damage_whole(struct wlr_output *output);
+/**
+ * Computes which part of the back buffer needs to be repainted, taking its
+ * age into account. Must be called after wlr_output_make_current. Returns
+ * false if nothing was damaged, in which case the frame should be skipped
+ * with wlr_output_skip_frame.
+ */
+bool wlr_output_get_frame_damage(struct wlr_output *output,
+		pixman_region32_t *damage);
+/**
+ * Keeps the current contents on the screen. No frame event is emitted until
+ * something calls wlr_output_schedule_frame, so idle outputs stop rendering
+ * altogether.
+ */
+void wlr_output_skip_frame(struct wlr_output *output);
+/**
+ * Makes sure a frame event is emitted soon, restarting the frame loop if the
+ * last frame was skipped. Adding damage and cursor changes schedule a frame
+ * on their own; compositors should call this when clients commit.
+ */
+void wlr_output_schedule_frame(struct wlr_output *output);
+/**
+ * Enables deadline based frame scheduling. Rather than right after the last
+ * frame was presented, the frame event is emitted as late as the render times
+ * of the previous frames allow to still make the next vblank. This shortens
+ * the time between rendering and the contents reaching the screen. It needs
+ * present events from the backend; frames which miss their vblank make the
+ * scheduler fall back to rendering early until they leave the history.
+ */
+void wlr_output_set_frame_scheduling(struct wlr_output *output, bool enable);
+/**
+ * Enables or disables adaptive sync (variable refresh rate). The display then
+ * waits for each new frame instead of refreshing at a fixed rate, within the
+ * limits of the monitor. Only outputs with adaptive_sync_capable set support
+ * it. Returns false if the change was rejected. adaptive_sync is updated once
+ * the change reaches the display, usually with the next frame. Deadline frame
+ * scheduling doesn't delay frames while adaptive sync is enabled.
+ */
+bool wlr_output_enable_adaptive_sync(struct wlr_output *output, bool enable);
+/**
+ * Displays a client buffer directly on the output, skipping composition.
+ * The buffer must cover the whole output. This is used for fullscreen
+ * surfaces: if it returns false, the buffer can't be scanned out and the
+ * caller should render the frame as usual.
+ */
+bool wlr_output_present_buffer(struct wlr_output *output,
+		struct wl_resource *buffer);
+/**
+ * Tries to put client buffers on hardware overlay planes for the next frame,
+ * in the order given. Candidates must not overlap each other and nothing
+ * composited may be stacked above them, which in practice means opaque
+ * toplevel surfaces. Accepted buffers must be left out of composition. This
+ * needs to be called every frame: overlays which aren't assigned again are
+ * removed with the next wlr_output_swap_buffers or wlr_output_present_buffer.
+ * Returns the number of accepted buffers.
+ */
+size_t wlr_output_assign_overlays(struct wlr_output *output,
+		size_t count, struct wlr_output_overlay *overlays);
 
 #endif
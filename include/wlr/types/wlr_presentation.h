@@ -0,0 +1,43 @@
+#ifndef _WLR_TYPES_WLR_PRESENTATION_H
+#define _WLR_TYPES_WLR_PRESENTATION_H
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+
+struct wlr_presentation {
+	struct wl_global *wl_global;
+	struct wl_list resources;
+	struct wl_list feedbacks; // wlr_presentation_feedback::link
+	clockid_t clock;
+};
+
+struct wlr_presentation_feedback {
+	struct wlr_presentation *presentation;
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	bool committed; // the content update it is about has been committed
+	struct wlr_output *output; // the output it was sampled for, if any
+
+	struct wl_listener surface_commit;
+	struct wl_listener surface_destroy;
+	struct wl_listener output_present;
+	struct wl_listener output_destroy;
+
+	struct wl_list link; // wlr_presentation::feedbacks
+};
+
+struct wlr_presentation *wlr_presentation_create(struct wl_display *display);
+void wlr_presentation_destroy(struct wlr_presentation *presentation);
+/**
+ * Tells the presentation interface that the current contents of the surface
+ * went into the frame being rendered for the output. Clients get their
+ * feedback with the output's next present event, or a discarded event if the
+ * output goes away first.
+ */
+void wlr_presentation_surface_sampled_on_output(
+		struct wlr_presentation *presentation, struct wlr_surface *surface,
+		struct wlr_output *output);
+
+#endif
@@ -3,6 +3,7 @@
 #include <wayland-server.h>
 #include <pixman.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 struct wlr_frame_callback {
 	struct wl_resource *resource;
@@ -20,18 +21,43 @@ struct wlr_frame_callback {
 struct wlr_surface_state {
 	uint32_t invalid;
 	struct wl_resource *buffer;
-	int32_t sx, sy;
+	struct wl_listener buffer_destroy;
+	int32_t sx, sy; // offset given with the last attach
+	// In the current state, surface_damage is what the last commit damaged
+	// in surface coordinates, including the old extents on a resize, and
+	// buffer_damage is what still has to be uploaded, in buffer coordinates
 	pixman_region32_t surface_damage, buffer_damage;
 	pixman_region32_t opaque, input;
-	uint32_t transform;
+	enum wl_output_transform transform;
 	int32_t scale;
+	int width, height; // in surface coordinates
+	int buffer_width, buffer_height;
+
+	struct wl_list frame_callback_list; // wl_surface.frame
+};
+
+// Textures imported from GPU buffers stay around for as long as the buffer,
+// so clients cycling through a few buffers don't get re-imported every frame
+#define WLR_SURFACE_BUFFER_TEXTURES 4
+
+struct wlr_surface_buffer_texture {
+	struct wlr_surface *surface;
+	struct wl_resource *buffer; // NULL once the client destroyed it
+	struct wlr_texture *texture;
+	struct wl_listener buffer_destroy;
+	struct wl_list link; // wlr_surface::buffer_textures
 };
 
 struct wlr_surface {
 	struct wl_resource *resource;
 	struct wlr_renderer *renderer;
-	struct wlr_texture *texture;
+	struct wlr_texture *texture; // of the current buffer
+	struct wlr_texture *shm_texture;
+	struct wl_list buffer_textures; // most recently used first
 	struct wlr_surface_state current, pending;
+	// The current buffer is held until it is replaced, or for SHM buffers
+	// until its contents have been copied
+	bool buffer_locked;
 	const char *role; // the lifetime-bound role or null
 
 	float buffer_to_surface_matrix[16];
@@ -41,8 +67,6 @@ struct wlr_surface {
 		struct wl_signal commit;
 	} signals;
 
-	struct wl_list frame_callback_list; // wl_surface.frame
-
 	struct wl_listener compositor_listener; // destroy listener used by compositor
 	void *compositor_data;
 
@@ -52,6 +76,10 @@ struct wlr_surface {
 struct wlr_renderer;
 struct wlr_surface *wlr_surface_create(struct wl_resource *res,
 		struct wlr_renderer *renderer);
+/**
+ * Uploads the damaged parts of the current buffer to the surface texture, if
+ * needed. SHM buffers are released right after.
+ */
 void wlr_surface_flush_damage(struct wlr_surface *surface);
 
 #endif
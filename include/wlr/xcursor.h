@@ -45,15 +45,30 @@ struct wlr_cursor {
 	struct wlr_cursor_image **images;
 	char *name;
 	uint32_t total_delay; /* length of the animation in ms */
+	void *xcursor_images; /* owns the image buffers, if loaded from a file */
 };
 
+struct wlr_cursor_theme_entry;
+
 struct wlr_cursor_theme {
-	unsigned int cursor_count;
-	struct wlr_cursor **cursors;
+	unsigned int cursor_count; /* number of cursor names in the index */
 	char *name;
 	int size;
+
+	/* hash table of cursor names, each decoded on first use */
+	struct wlr_cursor_theme_entry **buckets;
+	unsigned int bucket_count;
+
+	void *cache; /* mapped theme cache the cursors come from, if any */
 };
 
+/*
+ * Lists the cursors of the theme and the themes it inherits from. The cursor
+ * files are only read when wlr_cursor_theme_get_cursor asks for them.
+ *
+ * If WLR_CURSOR_CACHE names a directory, the decoded theme is cached there
+ * and used by later calls instead, until the theme directories change.
+ */
 struct wlr_cursor_theme *wlr_cursor_theme_load(const char *name, int size);
 
 void wlr_cursor_theme_destroy(struct wlr_cursor_theme *theme);
@@ -0,0 +1,77 @@
+#ifndef XCURSOR_CACHE_H
+#define XCURSOR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "xcursor/xcursor.h"
+
+/*
+ * A cursor theme cache holds the decoded images of every cursor in a theme at
+ * one size, in a single file that is mapped and used in place. It remembers
+ * the modification times of the theme directories it was built from, and is
+ * only used while none of them changed.
+ *
+ * Offsets are from the start of the file, and all values are in host byte
+ * order. Pixels are premultiplied ARGB, as in cursor files.
+ */
+
+struct xcursor_cache_image {
+	uint32_t width, height;
+	uint32_t hotspot_x, hotspot_y;
+	uint32_t delay;
+	uint32_t pixels; // offset
+};
+
+struct xcursor_cache_cursor {
+	uint32_t name; // string offset
+	uint32_t image_count;
+	uint32_t images; // index of the first image
+	uint32_t total_delay;
+};
+
+struct xcursor_cache {
+	void *data;
+	size_t size;
+
+	const struct xcursor_cache_cursor *cursors;
+	uint32_t cursor_count;
+	const struct xcursor_cache_image *images;
+	bool uncacheable; // no cursors, see xcursor_cache_write_uncacheable
+};
+
+/*
+ * Maps the cache for the theme at the given size if it exists and is up to
+ * date. Returns false otherwise.
+ */
+bool xcursor_cache_open(struct xcursor_cache *cache, const char *path,
+		const char *theme, int size);
+
+void xcursor_cache_close(struct xcursor_cache *cache);
+
+const char *xcursor_cache_cursor_name(struct xcursor_cache *cache,
+		const struct xcursor_cache_cursor *cursor);
+
+const struct xcursor_cache_image *xcursor_cache_cursor_images(
+		struct xcursor_cache *cache, const struct xcursor_cache_cursor *cursor);
+
+const uint8_t *xcursor_cache_image_pixels(struct xcursor_cache *cache,
+		const struct xcursor_cache_image *image);
+
+/*
+ * Writes a cache of the given cursors. dirs are the theme directories the
+ * cursors were found in, as reported by xcursor_scan_theme. The file is
+ * replaced atomically.
+ */
+bool xcursor_cache_write(const char *path, const char *theme, int size,
+		const char **dirs, size_t dir_count,
+		XcursorImages **cursors, size_t cursor_count);
+
+/*
+ * Writes a cache with no cursors that records that the theme can't be
+ * cached, so it isn't decoded in full again until the theme changes.
+ */
+bool xcursor_cache_write_uncacheable(const char *path, const char *theme,
+		int size, const char **dirs, size_t dir_count);
+
+#endif
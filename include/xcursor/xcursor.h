@@ -26,6 +26,8 @@
 #ifndef XCURSOR_H
 #define XCURSOR_H
 
+#include <stddef.h>
+
 typedef int		XcursorBool;
 typedef unsigned int	XcursorUInt;
 
@@ -58,8 +60,15 @@ XcursorLibraryLoadImages (const char *file, const char *theme, int size);
 void
 XcursorImagesDestroy (XcursorImages *images);
 
+const char *
+xcursor_library_path(void);
+
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data);
+xcursor_scan_theme(const char *theme,
+		   void (*dir_callback)(const char *, void *),
+		   void (*scan_callback)(const char *, const char *, void *),
+		   void *user_data);
+
+XcursorImages *
+xcursor_load_file(const char *path, const char *name, int size);
 #endif
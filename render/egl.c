@@ -2,13 +2,17 @@
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <gbm.h> // GBM_FORMAT_XRGB8888
+#include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 #include <wlr/egl.h>
 
 // Extension documentation
 // https://www.khronos.org/registry/EGL/extensions/KHR/EGL_KHR_image_base.txt.
 // https://cgit.freedesktop.org/mesa/mesa/tree/docs/specs/WL_bind_wayland_display.spec
+// https://www.khronos.org/registry/EGL/extensions/EXT/EGL_EXT_image_dma_buf_import.txt
+// https://www.khronos.org/registry/EGL/extensions/EXT/EGL_EXT_image_dma_buf_import_modifiers.txt
 
 const char *egl_error(void) {
 	switch (eglGetError()) {
@@ -79,7 +83,22 @@ static bool egl_get_config(EGLDisplay disp, EGLConfig *out, EGLenum platform) {
 
 	EGLConfig configs[count];
 
-	ret = eglChooseConfig(disp, NULL, configs, count, &matched);
+	// Without a native window system, rendering goes to pbuffers
+	static const EGLint pbuffer_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE,
+	};
+	const EGLint *attribs = NULL;
+	if (platform == EGL_PLATFORM_SURFACELESS_MESA) {
+		attribs = pbuffer_attribs;
+	}
+
+	ret = eglChooseConfig(disp, attribs, configs, count, &matched);
 	if (ret == EGL_FALSE) {
 		wlr_log(L_ERROR, "eglChooseConfig failed");
 		return false;
@@ -88,7 +107,8 @@ static bool egl_get_config(EGLDisplay disp, EGLConfig *out, EGLenum platform) {
 	for (int i = 0; i < matched; ++i) {
 		EGLint gbm_format;
 
-		if (platform == EGL_PLATFORM_WAYLAND_EXT) {
+		if (platform == EGL_PLATFORM_WAYLAND_EXT ||
+				platform == EGL_PLATFORM_SURFACELESS_MESA) {
 			*out = configs[i];
 			return true;
 		}
@@ -150,11 +170,21 @@ bool wlr_egl_init(struct wlr_egl *egl, EGLenum platform,
 
 	eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl->context);
 	egl->egl_exts = eglQueryString(egl->display, EGL_EXTENSIONS);
-	if (strstr(egl->egl_exts, "EGL_WL_bind_wayland_display") == NULL ||
-		strstr(egl->egl_exts, "EGL_KHR_image_base") == NULL) {
+	if (strstr(egl->egl_exts, "EGL_KHR_image_base") == NULL) {
 		wlr_log(L_ERROR, "Required egl extensions not supported");
 		goto error;
 	}
+	if (strstr(egl->egl_exts, "EGL_WL_bind_wayland_display") == NULL) {
+		// Software rasterizers usually lack it, clients can still use SHM
+		wlr_log(L_INFO, "EGL_WL_bind_wayland_display not supported, "
+			"wl_drm buffers won't be accepted");
+	}
+
+	egl->exts.buffer_age = strstr(egl->egl_exts, "EGL_EXT_buffer_age") != NULL;
+	egl->exts.dmabuf_import =
+		strstr(egl->egl_exts, "EGL_EXT_image_dma_buf_import") != NULL;
+	egl->exts.dmabuf_import_modifiers =
+		strstr(egl->egl_exts, "EGL_EXT_image_dma_buf_import_modifiers") != NULL;
 
 	egl->eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)
 		eglGetProcAddress("eglCreateImageKHR");
@@ -166,6 +196,15 @@ bool wlr_egl_init(struct wlr_egl *egl, EGLenum platform,
 		(void*) eglGetProcAddress("eglBindWaylandDisplayWL");
 	egl->eglUnbindWaylandDisplayWL = (PFNEGLUNBINDWAYLANDDISPLAYWL)
 		(void*) eglGetProcAddress("eglUnbindWaylandDisplayWL");
+	if (egl->exts.dmabuf_import_modifiers) {
+		egl->eglQueryDmaBufFormatsEXT = (PFNEGLQUERYDMABUFFORMATSEXTPROC)
+			eglGetProcAddress("eglQueryDmaBufFormatsEXT");
+		egl->eglQueryDmaBufModifiersEXT = (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)
+			eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+		if (!egl->eglQueryDmaBufFormatsEXT || !egl->eglQueryDmaBufModifiersEXT) {
+			egl->exts.dmabuf_import_modifiers = false;
+		}
+	}
 
 	egl->gl_exts = (const char*) glGetString(GL_EXTENSIONS);
 	wlr_log(L_INFO, "Using EGL %d.%d", (int)major, (int)minor);
@@ -223,6 +262,174 @@ EGLImage wlr_egl_create_image(struct wlr_egl *egl, EGLenum target,
 		buffer, attribs);
 }
 
+EGLImageKHR wlr_egl_create_image_from_dmabuf(struct wlr_egl *egl,
+		struct wlr_dmabuf_buffer_attribs *attributes) {
+	if (!egl->eglCreateImageKHR || !egl->exts.dmabuf_import) {
+		return NULL;
+	}
+
+	bool has_modifier = false;
+	if (attributes->modifier[0] != DRM_FORMAT_MOD_INVALID) {
+		if (!egl->exts.dmabuf_import_modifiers) {
+			return NULL;
+		}
+		has_modifier = true;
+	}
+
+	unsigned int atti = 0;
+	EGLint attribs[7 + 10 * WLR_LINUX_DMABUF_MAX_PLANES];
+	attribs[atti++] = EGL_WIDTH;
+	attribs[atti++] = attributes->width;
+	attribs[atti++] = EGL_HEIGHT;
+	attribs[atti++] = attributes->height;
+	attribs[atti++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[atti++] = attributes->format;
+
+	static const struct {
+		EGLint fd, offset, pitch, mod_lo, mod_hi;
+	} attr_names[WLR_LINUX_DMABUF_MAX_PLANES] = {
+		{
+			EGL_DMA_BUF_PLANE0_FD_EXT,
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE0_PITCH_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE1_FD_EXT,
+			EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE1_PITCH_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE2_FD_EXT,
+			EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE2_PITCH_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+		}, {
+			EGL_DMA_BUF_PLANE3_FD_EXT,
+			EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+			EGL_DMA_BUF_PLANE3_PITCH_EXT,
+			EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+			EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT,
+		}
+	};
+
+	for (int i = 0; i < attributes->n_planes; ++i) {
+		attribs[atti++] = attr_names[i].fd;
+		attribs[atti++] = attributes->fd[i];
+		attribs[atti++] = attr_names[i].offset;
+		attribs[atti++] = attributes->offset[i];
+		attribs[atti++] = attr_names[i].pitch;
+		attribs[atti++] = attributes->stride[i];
+		if (has_modifier) {
+			attribs[atti++] = attr_names[i].mod_lo;
+			attribs[atti++] = attributes->modifier[i] & 0xFFFFFFFF;
+			attribs[atti++] = attr_names[i].mod_hi;
+			attribs[atti++] = attributes->modifier[i] >> 32;
+		}
+	}
+	attribs[atti++] = EGL_NONE;
+
+	// dmabuf imports must not be bound to a context
+	return egl->eglCreateImageKHR(egl->display, EGL_NO_CONTEXT,
+		EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+}
+
+bool wlr_egl_check_import_dmabuf(struct wlr_egl *egl,
+		struct wlr_dmabuf_buffer_attribs *attributes) {
+	EGLImageKHR image = wlr_egl_create_image_from_dmabuf(egl, attributes);
+	if (!image) {
+		wlr_log(L_ERROR, "Failed to import dmabuf: %s", egl_error());
+		return false;
+	}
+	wlr_egl_destroy_image(egl, image);
+	return true;
+}
+
+int wlr_egl_get_dmabuf_formats(struct wlr_egl *egl, int **formats) {
+	if (!egl->exts.dmabuf_import) {
+		wlr_log(L_DEBUG, "dmabuf import extension not present");
+		return -1;
+	}
+
+	// Without the modifiers extension the formats can't be queried, assume
+	// the ones every driver supports
+	if (!egl->exts.dmabuf_import_modifiers) {
+		static const int fallback_formats[] = {
+			DRM_FORMAT_ARGB8888,
+			DRM_FORMAT_XRGB8888,
+		};
+		size_t num = sizeof(fallback_formats) / sizeof(fallback_formats[0]);
+		*formats = calloc(num, sizeof(int));
+		if (!*formats) {
+			wlr_log_errno(L_ERROR, "Allocation failed");
+			return -1;
+		}
+		memcpy(*formats, fallback_formats, sizeof(fallback_formats));
+		return num;
+	}
+
+	EGLint num;
+	if (!egl->eglQueryDmaBufFormatsEXT(egl->display, 0, NULL, &num)) {
+		wlr_log(L_ERROR, "Failed to query number of dmabuf formats: %s",
+			egl_error());
+		return -1;
+	}
+
+	*formats = calloc(num, sizeof(int));
+	if (!*formats) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return -1;
+	}
+
+	if (!egl->eglQueryDmaBufFormatsEXT(egl->display, num, *formats, &num)) {
+		wlr_log(L_ERROR, "Failed to query dmabuf formats: %s", egl_error());
+		free(*formats);
+		*formats = NULL;
+		return -1;
+	}
+	return num;
+}
+
+int wlr_egl_get_dmabuf_modifiers(struct wlr_egl *egl, int format,
+		uint64_t **modifiers) {
+	*modifiers = NULL;
+	if (!egl->exts.dmabuf_import) {
+		wlr_log(L_DEBUG, "dmabuf import extension not present");
+		return -1;
+	}
+	if (!egl->exts.dmabuf_import_modifiers) {
+		return 0;
+	}
+
+	EGLint num;
+	if (!egl->eglQueryDmaBufModifiersEXT(egl->display, format, 0,
+			NULL, NULL, &num)) {
+		wlr_log(L_ERROR, "Failed to query dmabuf number of modifiers: %s",
+			egl_error());
+		return -1;
+	}
+	if (num == 0) {
+		return 0;
+	}
+
+	*modifiers = calloc(num, sizeof(uint64_t));
+	if (!*modifiers) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return -1;
+	}
+
+	if (!egl->eglQueryDmaBufModifiersEXT(egl->display, format, num,
+			*modifiers, NULL, &num)) {
+		wlr_log(L_ERROR, "Failed to query dmabuf modifiers: %s", egl_error());
+		free(*modifiers);
+		*modifiers = NULL;
+		return -1;
+	}
+	return num;
+}
+
 bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImage image) {
 	if (!egl->eglDestroyImageKHR) {
 		return false;
@@ -232,6 +439,20 @@ bool wlr_egl_destroy_image(struct wlr_egl *egl, EGLImage image) {
 	return true;
 }
 
+int wlr_egl_get_buffer_age(struct wlr_egl *egl, EGLSurface surface) {
+	if (!egl->exts.buffer_age) {
+		return -1;
+	}
+
+	EGLint buffer_age;
+	if (!eglQuerySurface(egl->display, surface, EGL_BUFFER_AGE_EXT, &buffer_age)) {
+		wlr_log(L_ERROR, "Failed to get buffer age: %s", egl_error());
+		return -1;
+	}
+
+	return buffer_age;
+}
+
 EGLSurface wlr_egl_create_surface(struct wlr_egl *egl, void *window) {
 	EGLSurface surf = egl->create_platform_window_surface(egl->display, egl->config,
 		window, NULL);
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
@@ -14,6 +15,8 @@
 #include "render/gles2.h"
 
 PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES = NULL;
+PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRangeEXT = NULL;
+PFNGLUNMAPBUFFEROESPROC glUnmapBufferOES = NULL;
 struct shaders shaders;
 
 static bool compile_shader(GLuint type, const GLchar *src, GLuint *shader) {
@@ -49,6 +52,9 @@ static bool compile_program(const GLchar *vert_src,
 	*program = GL_CALL(glCreateProgram());
 	GL_CALL(glAttachShader(*program, vertex));
 	GL_CALL(glAttachShader(*program, fragment));
+	GL_CALL(glBindAttribLocation(*program, GLES2_ATTRIB_POS, "pos"));
+	GL_CALL(glBindAttribLocation(*program, GLES2_ATTRIB_TEXCOORD, "texcoord"));
+	GL_CALL(glBindAttribLocation(*program, GLES2_ATTRIB_COLOR, "color"));
 	GL_CALL(glLinkProgram(*program));
 	GLint success;
 	GL_CALL(glGetProgramiv(*program, GL_LINK_STATUS, &success));
@@ -82,18 +88,19 @@ static void init_default_shaders() {
 	if (!compile_program(vertex_src, fragment_src_rgbx, &shaders.rgbx)) {
 		goto error;
 	}
-	if (!compile_program(quad_vertex_src, quad_fragment_src, &shaders.quad)) {
+	if (!compile_program(vertex_src, quad_fragment_src, &shaders.quad)) {
 		goto error;
 	}
-	if (!compile_program(quad_vertex_src, ellipse_fragment_src, &shaders.ellipse)) {
+	if (!compile_program(vertex_src, ellipse_fragment_src, &shaders.ellipse)) {
 		goto error;
 	}
 	if (glEGLImageTargetTexture2DOES) {
-		if (!compile_program(quad_vertex_src, fragment_src_external, &shaders.external)) {
+		if (!compile_program(vertex_src, fragment_src_external, &shaders.external)) {
 			goto error;
 		}
 	}
 
+	shaders.initialized = true;
 	wlr_log(L_DEBUG, "Compiled default shaders");
 	return;
 error:
@@ -116,60 +123,178 @@ static void init_image_ext() {
 	}
 }
 
+static void init_pbo_ext() {
+	if (glMapBufferRangeEXT) {
+		return;
+	}
+
+	const char *version = (const char*) glGetString(GL_VERSION);
+	const char *exts = (const char*) glGetString(GL_EXTENSIONS);
+	if (strncmp(version, "OpenGL ES 3", strlen("OpenGL ES 3")) == 0) {
+		glMapBufferRangeEXT = (PFNGLMAPBUFFERRANGEEXTPROC)
+			eglGetProcAddress("glMapBufferRange");
+		glUnmapBufferOES = (PFNGLUNMAPBUFFEROESPROC)
+			eglGetProcAddress("glUnmapBuffer");
+	} else if (strstr(exts, "GL_NV_pixel_buffer_object")
+			&& strstr(exts, "GL_EXT_map_buffer_range")
+			&& strstr(exts, "GL_OES_mapbuffer")) {
+		glMapBufferRangeEXT = (PFNGLMAPBUFFERRANGEEXTPROC)
+			eglGetProcAddress("glMapBufferRangeEXT");
+		glUnmapBufferOES = (PFNGLUNMAPBUFFEROESPROC)
+			eglGetProcAddress("glUnmapBufferOES");
+	}
+
+	if (!glMapBufferRangeEXT || !glUnmapBufferOES) {
+		glMapBufferRangeEXT = NULL;
+		glUnmapBufferOES = NULL;
+		wlr_log(L_INFO, "Pixel buffer objects not supported, "
+			"SHM buffers will be uploaded synchronously");
+	}
+}
+
 static void init_globals() {
 	init_image_ext();
+	init_pbo_ext();
 	init_default_shaders();
 }
 
+static void flush_batch(struct wlr_renderer_state *state) {
+	size_t quads = state->batch.quads;
+	if (quads == 0) {
+		return;
+	}
+	state->batch.quads = 0;
+
+	gles2_bind_vertex_buffers(state->vbo, state->ibo);
+	// Orphan the previous storage so we don't wait on draws still using it
+	GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(state->batch.verts),
+		NULL, GL_STREAM_DRAW));
+	GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, 0,
+		quads * 4 * sizeof(struct gles2_vertex), state->batch.verts));
+
+	gles2_use_program(state->batch.program);
+	if (state->batch.tex_id) {
+		gles2_active_texture(GL_TEXTURE0);
+		gles2_bind_texture(state->batch.target, state->batch.tex_id);
+	}
+	GL_CALL(glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, 0));
+	gles2_count_draw(quads);
+}
+
+/**
+ * Queues a unit quad transformed by the matrix. Quads are only drawn when the
+ * shader or texture changes, or when rendering ends; outside of begin and end
+ * they are drawn right away. With inverted_y, the texture is sampled upside
+ * down.
+ */
+static void push_quad(struct wlr_renderer_state *state, GLuint program,
+		GLenum target, GLuint tex_id, bool inverted_y,
+		const float (*matrix)[16], const float color[4]) {
+	if (state->batch.quads > 0 && (state->batch.program != program
+			|| state->batch.target != target
+			|| state->batch.tex_id != tex_id
+			|| state->batch.quads == GLES2_BATCH_MAX_QUADS)) {
+		flush_batch(state);
+	}
+	state->batch.program = program;
+	state->batch.target = target;
+	state->batch.tex_id = tex_id;
+
+	static const GLfloat corners[4][2] = {
+		{ 0, 0 }, // top left
+		{ 1, 0 }, // top right
+		{ 1, 1 }, // bottom right
+		{ 0, 1 }, // bottom left
+	};
+	const float *m = *matrix;
+	struct gles2_vertex *verts = &state->batch.verts[state->batch.quads * 4];
+	for (size_t i = 0; i < 4; ++i) {
+		GLfloat x = corners[i][0], y = corners[i][1];
+		verts[i].x = m[0] * x + m[1] * y + m[3];
+		verts[i].y = m[4] * x + m[5] * y + m[7];
+		verts[i].s = x;
+		verts[i].t = inverted_y ? 1 - y : y;
+		memcpy(verts[i].color, color, sizeof(verts[i].color));
+	}
+	++state->batch.quads;
+
+	if (!state->output) {
+		flush_batch(state);
+	}
+}
+
 static void wlr_gles2_begin(struct wlr_renderer_state *state,
 		struct wlr_output *output) {
-	// TODO: let users customize the clear color?
-	GL_CALL(glClearColor(0.25f, 0.25f, 0.25f, 1));
-	GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+	state->output = output;
 	int32_t width = output->width;
 	int32_t height = output->height;
-	GL_CALL(glViewport(0, 0, width, height));
+	gles2_state_begin();
+	gles2_viewport(0, 0, width, height);
 
 	// enable transparency
-	GL_CALL(glEnable(GL_BLEND));
-	GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+	gles2_set_blend(true);
+	gles2_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	state->blending = true;
 
 	// Note: maybe we should save output projection and remove some of the need
 	// for users to sling matricies themselves
 }
 
 static void wlr_gles2_end(struct wlr_renderer_state *state) {
-	// no-op
+	flush_batch(state);
+	gles2_set_scissor(false);
+	gles2_state_end();
+	state->output = NULL;
 }
 
-static struct wlr_texture *wlr_gles2_texture_init(struct wlr_renderer_state *state) {
-	return gles2_texture_init(state->egl);
+static void wlr_gles2_clear(struct wlr_renderer_state *state,
+		const float (*color)[4]) {
+	flush_batch(state);
+	GL_CALL(glClearColor((*color)[0], (*color)[1], (*color)[2], (*color)[3]));
+	GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
 }
 
-static void draw_quad() {
-	GLfloat verts[] = {
-		1, 0, // top right
-		0, 0, // top left
-		1, 1, // bottom right
-		0, 1, // bottom left
-	};
-	GLfloat texcoord[] = {
-		1, 0, // top right
-		0, 0, // top left
-		1, 1, // bottom right
-		0, 1, // bottom left
-	};
+static void wlr_gles2_scissor(struct wlr_renderer_state *state,
+		pixman_box32_t *box) {
+	flush_batch(state);
+	if (!box || !state->output) {
+		gles2_set_scissor(false);
+		return;
+	}
 
-	GL_CALL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts));
-	GL_CALL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoord));
+	// Project the corners like the vertices are, so the box follows the
+	// output transform. The result is in GL window coordinates.
+	struct wlr_output *output = state->output;
+	const float *m = output->transform_matrix;
+	const float corners[2][2] = {{box->x1, box->y1}, {box->x2, box->y2}};
+	float x1 = output->width, y1 = output->height, x2 = 0, y2 = 0;
+	for (int i = 0; i < 2; ++i) {
+		float cx = m[0] * corners[i][0] + m[1] * corners[i][1] + m[3];
+		float cy = m[4] * corners[i][0] + m[5] * corners[i][1] + m[7];
+		float x = (cx + 1) / 2 * output->width;
+		float y = (cy + 1) / 2 * output->height;
+		x1 = x < x1 ? x : x1;
+		y1 = y < y1 ? y : y1;
+		x2 = x > x2 ? x : x2;
+		y2 = y > y2 ? y : y2;
+	}
 
-	GL_CALL(glEnableVertexAttribArray(0));
-	GL_CALL(glEnableVertexAttribArray(1));
+	gles2_set_scissor(true);
+	GL_CALL(glScissor(x1, y1, x2 - x1, y2 - y1));
+}
 
-	GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+static void wlr_gles2_set_blending(struct wlr_renderer_state *state,
+		bool blending) {
+	if (state->blending == blending) {
+		return;
+	}
+	flush_batch(state);
+	gles2_set_blend(blending);
+	state->blending = blending;
+}
 
-	GL_CALL(glDisableVertexAttribArray(0));
-	GL_CALL(glDisableVertexAttribArray(1));
+static struct wlr_texture *wlr_gles2_texture_init(struct wlr_renderer_state *state) {
+	return gles2_texture_init(state);
 }
 
 static bool wlr_gles2_render_texture(struct wlr_renderer_state *state,
@@ -179,28 +304,22 @@ static bool wlr_gles2_render_texture(struct wlr_renderer_state *state,
 		return false;
 	}
 
-	wlr_texture_bind(texture);
-	GL_CALL(glUniformMatrix4fv(0, 1, GL_FALSE, *matrix));
+	struct wlr_texture_state *tex = texture->state;
 	// TODO: source alpha from somewhere else I guess
-	GL_CALL(glUniform1f(2, 1.0f));
-	draw_quad();
+	push_quad(state, *tex->pixel_format->shader, tex->target, tex->tex_id,
+		tex->inverted_y, matrix, (float[]){ 1, 1, 1, 1 });
 	return true;
 }
 
 static void wlr_gles2_render_quad(struct wlr_renderer_state *state,
 		const float (*color)[4], const float (*matrix)[16]) {
-	GL_CALL(glUseProgram(shaders.quad));
-	GL_CALL(glUniformMatrix4fv(0, 1, GL_TRUE, *matrix));
-	GL_CALL(glUniform4f(1, (*color)[0], (*color)[1], (*color)[2], (*color)[3]));
-	draw_quad();
+	push_quad(state, shaders.quad, GL_TEXTURE_2D, 0, false, matrix, *color);
 }
 
 static void wlr_gles2_render_ellipse(struct wlr_renderer_state *state,
 		const float (*color)[4], const float (*matrix)[16]) {
-	GL_CALL(glUseProgram(shaders.ellipse));
-	GL_CALL(glUniformMatrix4fv(0, 1, GL_TRUE, *matrix));
-	GL_CALL(glUniform4f(1, (*color)[0], (*color)[1], (*color)[2], (*color)[3]));
-	draw_quad();
+	push_quad(state, shaders.ellipse, GL_TEXTURE_2D, 0, false, matrix,
+		*color);
 }
 
 static const enum wl_shm_format *wlr_gles2_formats(
@@ -221,28 +340,68 @@ static bool wlr_gles2_buffer_is_drm(struct wlr_renderer_state *state,
 	return wlr_egl_query_buffer(state->egl, buffer, EGL_TEXTURE_FORMAT, &format);
 }
 
+static bool wlr_gles2_drm_buffer_get_size(struct wlr_renderer_state *state,
+		struct wl_resource *buffer, int *width, int *height) {
+	return wlr_egl_query_buffer(state->egl, buffer, EGL_WIDTH, width) &&
+		wlr_egl_query_buffer(state->egl, buffer, EGL_HEIGHT, height);
+}
+
 static void wlr_gles2_destroy(struct wlr_renderer_state *state) {
+	gles2_forget_buffer(state->vbo);
+	gles2_forget_buffer(state->ibo);
+	GL_CALL(glDeleteBuffers(1, &state->vbo));
+	GL_CALL(glDeleteBuffers(1, &state->ibo));
+	if (state->pbo) {
+		GL_CALL(glDeleteBuffers(1, &state->pbo));
+	}
 	free(state);
 }
 
 static struct wlr_renderer_impl wlr_renderer_impl = {
 	.begin = wlr_gles2_begin,
 	.end = wlr_gles2_end,
+	.clear = wlr_gles2_clear,
+	.scissor = wlr_gles2_scissor,
+	.set_blending = wlr_gles2_set_blending,
 	.texture_init = wlr_gles2_texture_init,
 	.render_with_matrix = wlr_gles2_render_texture,
 	.render_quad = wlr_gles2_render_quad,
 	.render_ellipse = wlr_gles2_render_ellipse,
 	.formats = wlr_gles2_formats,
 	.buffer_is_drm = wlr_gles2_buffer_is_drm,
+	.drm_buffer_get_size = wlr_gles2_drm_buffer_get_size,
 	.destroy = wlr_gles2_destroy
 };
 
 struct wlr_renderer *wlr_gles2_renderer_init(struct wlr_backend *backend) {
 	init_globals();
+	gles2_init_debug();
 	struct wlr_egl *egl = wlr_backend_get_egl(backend);
 	struct wlr_renderer_state *state = calloc(1, sizeof(struct wlr_renderer_state));
 	struct wlr_renderer *renderer = wlr_renderer_init(state, &wlr_renderer_impl);
 	state->renderer = renderer;
 	state->egl = egl;
+
+	// Every quad is two triangles, so the indices never change
+	GLushort indices[GLES2_BATCH_MAX_QUADS * 6];
+	for (GLushort i = 0; i < GLES2_BATCH_MAX_QUADS; ++i) {
+		GLushort *quad = &indices[i * 6];
+		quad[0] = i * 4;
+		quad[1] = i * 4 + 1;
+		quad[2] = i * 4 + 2;
+		quad[3] = i * 4;
+		quad[4] = i * 4 + 2;
+		quad[5] = i * 4 + 3;
+	}
+	GL_CALL(glGenBuffers(1, &state->vbo));
+	GL_CALL(glGenBuffers(1, &state->ibo));
+	GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->ibo));
+	GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+		GL_STATIC_DRAW));
+	GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+	if (glMapBufferRangeEXT) {
+		GL_CALL(glGenBuffers(1, &state->pbo));
+	}
 	return renderer;
 }
@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <wlr/render/gles2.h>
+#include "render/gles2.h"
+
+#define GLES2_STATE_UNKNOWN ((GLuint)-1)
+
+static struct wlr_gles2_stats stats;
+
+#define STATE_CALL(func) do { GL_CALL(func); ++stats.state_calls; } while (0)
+
+/*
+ * Mirror of the GL state the renderer changes. Other code (backends, the
+ * software cursor) changes GL state behind our back, so the mirror is only
+ * trusted between gles2_state_begin and gles2_state_end. Outside of that,
+ * every change is passed through to GL.
+ */
+static struct {
+	bool tracking;
+	GLuint program;
+	GLenum active_unit;
+	GLuint tex_2d, tex_external; // Bound to the active unit
+	GLuint vbo, ibo;
+	int blend, scissor; // -1 when unknown
+	GLenum blend_src, blend_dst;
+	GLint viewport[4];
+} cache;
+
+void gles2_state_begin(void) {
+	cache.tracking = true;
+	cache.program = GLES2_STATE_UNKNOWN;
+	cache.active_unit = GL_NONE;
+	cache.tex_2d = cache.tex_external = GLES2_STATE_UNKNOWN;
+	cache.vbo = cache.ibo = GLES2_STATE_UNKNOWN;
+	cache.blend = cache.scissor = -1;
+	cache.blend_src = cache.blend_dst = GL_NONE;
+	cache.viewport[2] = cache.viewport[3] = -1;
+}
+
+void gles2_state_end(void) {
+	cache.tracking = false;
+}
+
+void gles2_use_program(GLuint program) {
+	if (cache.tracking && cache.program == program) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glUseProgram(program));
+	cache.program = program;
+}
+
+void gles2_active_texture(GLenum unit) {
+	if (cache.tracking && cache.active_unit == unit) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glActiveTexture(unit));
+	cache.active_unit = unit;
+	cache.tex_2d = cache.tex_external = GLES2_STATE_UNKNOWN;
+}
+
+void gles2_bind_texture(GLenum target, GLuint tex_id) {
+	GLuint *bound = target == GL_TEXTURE_EXTERNAL_OES ?
+		&cache.tex_external : &cache.tex_2d;
+	if (cache.tracking && *bound == tex_id) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glBindTexture(target, tex_id));
+	*bound = tex_id;
+}
+
+void gles2_forget_texture(GLuint tex_id) {
+	// Deleting a texture unbinds it, and its name may be handed out again
+	if (cache.tex_2d == tex_id) {
+		cache.tex_2d = 0;
+	}
+	if (cache.tex_external == tex_id) {
+		cache.tex_external = 0;
+	}
+}
+
+void gles2_bind_vertex_buffers(GLuint vbo, GLuint ibo) {
+	if (cache.tracking && cache.vbo == vbo && cache.ibo == ibo) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+	STATE_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+
+	// The pointers refer to the buffer bound when they're set, so they only
+	// need to be set again when it changes
+	STATE_CALL(glVertexAttribPointer(GLES2_ATTRIB_POS, 2, GL_FLOAT, GL_FALSE,
+		sizeof(struct gles2_vertex), (void *)offsetof(struct gles2_vertex, x)));
+	STATE_CALL(glVertexAttribPointer(GLES2_ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE,
+		sizeof(struct gles2_vertex), (void *)offsetof(struct gles2_vertex, s)));
+	STATE_CALL(glVertexAttribPointer(GLES2_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE,
+		sizeof(struct gles2_vertex), (void *)offsetof(struct gles2_vertex, color)));
+	STATE_CALL(glEnableVertexAttribArray(GLES2_ATTRIB_POS));
+	STATE_CALL(glEnableVertexAttribArray(GLES2_ATTRIB_TEXCOORD));
+	STATE_CALL(glEnableVertexAttribArray(GLES2_ATTRIB_COLOR));
+	cache.vbo = vbo;
+	cache.ibo = ibo;
+}
+
+void gles2_forget_buffer(GLuint buffer) {
+	if (cache.vbo == buffer || cache.ibo == buffer) {
+		cache.vbo = cache.ibo = GLES2_STATE_UNKNOWN;
+	}
+}
+
+void gles2_set_blend(bool enabled) {
+	if (cache.tracking && cache.blend == (int)enabled) {
+		++stats.skipped_calls;
+		return;
+	}
+	if (enabled) {
+		STATE_CALL(glEnable(GL_BLEND));
+	} else {
+		STATE_CALL(glDisable(GL_BLEND));
+	}
+	cache.blend = enabled;
+}
+
+void gles2_blend_func(GLenum src, GLenum dst) {
+	if (cache.tracking && cache.blend_src == src && cache.blend_dst == dst) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glBlendFunc(src, dst));
+	cache.blend_src = src;
+	cache.blend_dst = dst;
+}
+
+void gles2_set_scissor(bool enabled) {
+	if (cache.tracking && cache.scissor == (int)enabled) {
+		++stats.skipped_calls;
+		return;
+	}
+	if (enabled) {
+		STATE_CALL(glEnable(GL_SCISSOR_TEST));
+	} else {
+		STATE_CALL(glDisable(GL_SCISSOR_TEST));
+	}
+	cache.scissor = enabled;
+}
+
+void gles2_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	if (cache.tracking && cache.viewport[0] == x && cache.viewport[1] == y
+			&& cache.viewport[2] == width && cache.viewport[3] == height) {
+		++stats.skipped_calls;
+		return;
+	}
+	STATE_CALL(glViewport(x, y, width, height));
+	cache.viewport[0] = x;
+	cache.viewport[1] = y;
+	cache.viewport[2] = width;
+	cache.viewport[3] = height;
+}
+
+void gles2_count_draw(size_t quads) {
+	++stats.draw_calls;
+	stats.quads += quads;
+}
+
+void wlr_gles2_get_stats(struct wlr_gles2_stats *out) {
+	*out = stats;
+}
+
+void wlr_gles2_reset_stats(void) {
+	stats = (struct wlr_gles2_stats){ 0 };
+}
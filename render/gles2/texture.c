@@ -9,6 +9,7 @@
 #include <wlr/render.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/matrix.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
 #include <wlr/util/log.h>
 #include "render/gles2.h"
 
@@ -25,10 +26,27 @@ static void gles2_texture_ensure_texture(struct wlr_texture_state *surface) {
 	if (surface->tex_id) {
 		return;
 	}
+	GLenum target = surface->target;
 	GL_CALL(glGenTextures(1, &surface->tex_id));
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, surface->tex_id));
-	GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-	GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	gles2_bind_texture(target, surface->tex_id);
+	GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GL_CALL(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GL_CALL(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	GL_CALL(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+}
+
+static void gles2_texture_set_target(struct wlr_texture_state *texture,
+		GLenum target) {
+	if (texture->target == target) {
+		return;
+	}
+	// A texture name can't change its target once it has been bound
+	if (texture->tex_id) {
+		gles2_forget_texture(texture->tex_id);
+		GL_CALL(glDeleteTextures(1, &texture->tex_id));
+		texture->tex_id = 0;
+	}
+	texture->target = target;
 }
 
 static bool gles2_texture_upload_pixels(struct wlr_texture_state *texture,
@@ -44,9 +62,11 @@ static bool gles2_texture_upload_pixels(struct wlr_texture_state *texture,
 	texture->wlr_texture->height = height;
 	texture->wlr_texture->format = format;
 	texture->pixel_format = fmt;
+	texture->inverted_y = false;
 
+	gles2_texture_set_target(texture, GL_TEXTURE_2D);
 	gles2_texture_ensure_texture(texture);
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex_id));
+	gles2_bind_texture(GL_TEXTURE_2D, texture->tex_id);
 	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride));
 	GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, width, height, 0,
 			fmt->gl_format, fmt->gl_type, pixels));
@@ -67,7 +87,7 @@ static bool gles2_texture_update_pixels(struct wlr_texture_state *texture,
 				width, height, pixels);
 	}
 	const struct pixel_format *fmt = texture->pixel_format;
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex_id));
+	gles2_bind_texture(GL_TEXTURE_2D, texture->tex_id);
 	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride));
 	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x));
 	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y));
@@ -78,6 +98,75 @@ static bool gles2_texture_update_pixels(struct wlr_texture_state *texture,
 	return true;
 }
 
+/**
+ * Copies the rectangle into the renderer's staging buffer and uploads it from
+ * there. The texture upload then happens asynchronously, and the client buffer
+ * can be released as soon as this returns.
+ */
+static bool gles2_texture_upload_pbo(struct wlr_texture_state *texture,
+		const uint8_t *pixels, int stride, int x, int y,
+		int width, int height) {
+	GLuint pbo = texture->renderer->pbo;
+	if (!pbo) {
+		return false;
+	}
+
+	const struct pixel_format *fmt = texture->pixel_format;
+	size_t bytes_per_pixel = fmt->bpp / 8;
+	size_t row_size = width * bytes_per_pixel;
+	size_t size = row_size * height;
+
+	GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, pbo));
+	// Orphan the old storage, so we don't wait on uploads still reading it
+	GL_CALL(glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, size, NULL, GL_STREAM_DRAW));
+	uint8_t *dst = GL_CALL(glMapBufferRangeEXT(GL_PIXEL_UNPACK_BUFFER_NV, 0,
+		size, GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_BUFFER_BIT_EXT));
+	if (!dst) {
+		GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0));
+		return false;
+	}
+
+	const uint8_t *src = pixels + y * stride + x * bytes_per_pixel;
+	for (int i = 0; i < height; ++i) {
+		memcpy(dst + i * row_size, src + i * stride, row_size);
+	}
+	if (!glUnmapBufferOES(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		// The buffer contents got lost, e.g. on a mode switch
+		GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0));
+		return false;
+	}
+
+	gles2_bind_texture(GL_TEXTURE_2D, texture->tex_id);
+	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
+	GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height,
+			fmt->gl_format, fmt->gl_type, NULL));
+	GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0));
+	return true;
+}
+
+static void gles2_texture_write_shm(struct wlr_texture_state *texture,
+		struct wl_shm_buffer *buffer, int x, int y, int width, int height) {
+	const struct pixel_format *fmt = texture->pixel_format;
+	uint8_t *pixels = wl_shm_buffer_get_data(buffer);
+	int stride = wl_shm_buffer_get_stride(buffer);
+	if (gles2_texture_upload_pbo(texture, pixels, stride,
+			x, y, width, height)) {
+		return;
+	}
+
+	int pitch = stride / (fmt->bpp / 8);
+	gles2_bind_texture(GL_TEXTURE_2D, texture->tex_id);
+	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y));
+	GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height,
+			fmt->gl_format, fmt->gl_type, pixels));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
+	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
+}
+
 static bool gles2_texture_upload_shm(struct wlr_texture_state *texture,
 		uint32_t format, struct wl_shm_buffer *buffer) {
 	const struct pixel_format *fmt = gl_format_for_wl_format(format);
@@ -86,22 +175,27 @@ static bool gles2_texture_upload_shm(struct wlr_texture_state *texture,
 		return false;
 	}
 	wl_shm_buffer_begin_access(buffer);
-	uint8_t *pixels = wl_shm_buffer_get_data(buffer);
 	int width = wl_shm_buffer_get_width(buffer);
 	int height = wl_shm_buffer_get_height(buffer);
-	int pitch = wl_shm_buffer_get_stride(buffer) / (fmt->bpp / 8);
+	bool realloc = !texture->wlr_texture->valid
+		|| texture->target != GL_TEXTURE_2D
+		|| texture->wlr_texture->width != width
+		|| texture->wlr_texture->height != height
+		|| texture->wlr_texture->format != format;
 	texture->wlr_texture->width = width;
 	texture->wlr_texture->height = height;
 	texture->wlr_texture->format = format;
 	texture->pixel_format = fmt;
+	texture->inverted_y = false;
 
+	gles2_texture_set_target(texture, GL_TEXTURE_2D);
 	gles2_texture_ensure_texture(texture);
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex_id));
-	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
-	GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, width, height, 0,
-				fmt->gl_format, fmt->gl_type, pixels));
+	if (realloc) {
+		gles2_bind_texture(GL_TEXTURE_2D, texture->tex_id);
+		GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, fmt->gl_format, width, height, 0,
+					fmt->gl_format, fmt->gl_type, NULL));
+	}
+	gles2_texture_write_shm(texture, buffer, 0, 0, width, height);
 
 	texture->wlr_texture->valid = true;
 	wl_shm_buffer_end_access(buffer);
@@ -115,24 +209,13 @@ static bool gles2_texture_update_shm(struct wlr_texture_state *texture,
 	// upload strategy if not
 	assert(texture);
 	if (!texture->wlr_texture->valid
+			|| texture->target != GL_TEXTURE_2D
 			|| texture->wlr_texture->format != format
 		/*	|| unpack not supported */) {
 		return gles2_texture_upload_shm(texture, format, buffer);
 	}
-	const struct pixel_format *fmt = texture->pixel_format;
 	wl_shm_buffer_begin_access(buffer);
-	uint8_t *pixels = wl_shm_buffer_get_data(buffer);
-	int pitch = wl_shm_buffer_get_stride(buffer) / (fmt->bpp / 8);
-
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex_id));
-	GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y));
-	GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height,
-			fmt->gl_format, fmt->gl_type, pixels));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0));
-	GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0));
-
+	gles2_texture_write_shm(texture, buffer, x, y, width, height);
 	wl_shm_buffer_end_access(buffer);
 
 	return true;
@@ -175,8 +258,8 @@ static bool gles2_texture_upload_drm(struct wlr_texture_state *tex,
 		return false;
 	}
 
+	gles2_texture_set_target(tex, target);
 	gles2_texture_ensure_texture(tex);
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, tex->tex_id));
 
 	EGLint attribs[] = { EGL_WAYLAND_PLANE_WL, 0, EGL_NONE };
 
@@ -191,15 +274,50 @@ static bool gles2_texture_upload_drm(struct wlr_texture_state *tex,
  		return false;
 	}
 
-	GL_CALL(glActiveTexture(GL_TEXTURE0));
-	GL_CALL(glBindTexture(target, tex->tex_id));
+	gles2_active_texture(GL_TEXTURE0);
+	gles2_bind_texture(target, tex->tex_id);
 	GL_CALL(glEGLImageTargetTexture2DOES(target, tex->image));
 	tex->wlr_texture->valid = true;
 	tex->pixel_format = pf;
+	tex->inverted_y = false;
 
 	return true;
 }
 
+static bool gles2_texture_upload_dmabuf(struct wlr_texture_state *tex,
+		struct wl_resource *dmabuf_resource) {
+	if (!glEGLImageTargetTexture2DOES) {
+		return false;
+	}
+
+	struct wlr_dmabuf_buffer *dmabuf =
+		wlr_dmabuf_buffer_from_buffer_resource(dmabuf_resource);
+	if (tex->image) {
+		wlr_egl_destroy_image(tex->egl, tex->image);
+	}
+	tex->image = wlr_egl_create_image_from_dmabuf(tex->egl,
+		&dmabuf->attributes);
+	if (!tex->image) {
+		wlr_log(L_ERROR, "failed to create egl image: %s", egl_error());
+		return false;
+	}
+
+	tex->wlr_texture->width = dmabuf->attributes.width;
+	tex->wlr_texture->height = dmabuf->attributes.height;
+
+	// The external target can sample any format the driver imports,
+	// including multi-planar YUV, with the conversion done by the driver
+	gles2_texture_set_target(tex, GL_TEXTURE_EXTERNAL_OES);
+	gles2_texture_ensure_texture(tex);
+	gles2_active_texture(GL_TEXTURE0);
+	gles2_bind_texture(GL_TEXTURE_EXTERNAL_OES, tex->tex_id);
+	GL_CALL(glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, tex->image));
+	tex->pixel_format = &external_pixel_format;
+	tex->inverted_y = wlr_dmabuf_buffer_has_inverted_y(dmabuf);
+	tex->wlr_texture->valid = true;
+	return true;
+}
+
 static void gles2_texture_get_matrix(struct wlr_texture_state *texture,
 		float (*matrix)[16], const float (*projection)[16], int x, int y) {
 	struct wlr_texture *_texture = texture->wlr_texture;
@@ -213,15 +331,14 @@ static void gles2_texture_get_matrix(struct wlr_texture_state *texture,
 }
 
 static void gles2_texture_bind(struct wlr_texture_state *texture) {
-	GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->tex_id));
-	GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-	GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-	GL_CALL(glUseProgram(*texture->pixel_format->shader));
+	gles2_bind_texture(texture->target, texture->tex_id);
+	gles2_use_program(*texture->pixel_format->shader);
 }
 
 static void gles2_texture_destroy(struct wlr_texture_state *texture) {
 	wl_signal_emit(&texture->wlr_texture->destroy_signal, texture->wlr_texture);
 	if (texture->tex_id) {
+		gles2_forget_texture(texture->tex_id);
 		GL_CALL(glDeleteTextures(1, &texture->tex_id));
 	}
 
@@ -238,16 +355,19 @@ static struct wlr_texture_impl wlr_texture_impl = {
 	.upload_shm = gles2_texture_upload_shm,
 	.update_shm = gles2_texture_update_shm,
 	.upload_drm = gles2_texture_upload_drm,
+	.upload_dmabuf = gles2_texture_upload_dmabuf,
 	.get_matrix = gles2_texture_get_matrix,
 	.bind = gles2_texture_bind,
 	.destroy = gles2_texture_destroy,
 };
 
-struct wlr_texture *gles2_texture_init(struct wlr_egl *egl) {
+struct wlr_texture *gles2_texture_init(struct wlr_renderer_state *renderer) {
 	struct wlr_texture_state *state = calloc(sizeof(struct wlr_texture_state), 1);
 	struct wlr_texture *texture = wlr_texture_init(state, &wlr_texture_impl);
 	state->wlr_texture = texture;
-	state->egl = egl;
+	state->renderer = renderer;
+	state->egl = renderer->egl;
+	state->target = GL_TEXTURE_2D;
 	wl_signal_init(&texture->destroy_signal);
 	return texture;
 }
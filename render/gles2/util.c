@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
 #include <wlr/util/log.h>
 #include "render/gles2.h"
 
@@ -36,3 +38,48 @@ bool _gles2_flush_errors(const char *file, int line) {
 	}
 	return failure;
 }
+
+static PFNGLDEBUGMESSAGECALLBACKKHRPROC glDebugMessageCallbackKHR = NULL;
+
+static void gles2_log_debug(GLenum source, GLenum type, GLuint id,
+		GLenum severity, GLsizei length, const GLchar *msg, const void *user) {
+	log_importance_t importance;
+	switch (severity) {
+	case GL_DEBUG_SEVERITY_HIGH_KHR:
+	case GL_DEBUG_SEVERITY_MEDIUM_KHR:
+		importance = L_ERROR;
+		break;
+	case GL_DEBUG_SEVERITY_LOW_KHR:
+		importance = L_INFO;
+		break;
+	default:
+		importance = L_DEBUG;
+		break;
+	}
+	_wlr_log(importance, "[GLES2] %s", msg);
+}
+
+void gles2_init_debug(void) {
+	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+	if (!exts || !strstr(exts, "GL_KHR_debug")) {
+		wlr_log(L_INFO, "GL_KHR_debug not supported, "
+			"GL errors will only be reported in debug builds");
+		return;
+	}
+
+	if (!glDebugMessageCallbackKHR) {
+		glDebugMessageCallbackKHR = (PFNGLDEBUGMESSAGECALLBACKKHRPROC)
+			eglGetProcAddress("glDebugMessageCallbackKHR");
+		if (!glDebugMessageCallbackKHR) {
+			return;
+		}
+	}
+
+	// The callback and its state are per context
+	glEnable(GL_DEBUG_OUTPUT_KHR);
+#ifdef WLR_GL_DEBUG
+	// Report errors from within the offending call
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+#endif
+	glDebugMessageCallbackKHR(gles2_log_debug, NULL);
+}
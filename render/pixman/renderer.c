@@ -0,0 +1,339 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wayland-server-protocol.h>
+#include <wlr/render.h>
+#include <wlr/render/interface.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+/*
+ * Projects a point of the unit quad through a render matrix, giving target
+ * pixel coordinates. Matrices map to GL clip space, which has y pointing up.
+ */
+static void project(struct wlr_renderer_state *state, const float *m,
+		double u, double v, double *x, double *y) {
+	int width = pixman_image_get_width(state->target);
+	int height = pixman_image_get_height(state->target);
+	*x = (m[0] * u + m[1] * v + m[3] + 1) * width / 2;
+	*y = (1 - (m[4] * u + m[5] * v + m[7])) * height / 2;
+}
+
+/*
+ * Gets the target pixels covered by the transformed unit quad, restricted to
+ * the scissor box. Returns false if nothing is left.
+ */
+static bool quad_get_box(struct wlr_renderer_state *state,
+		const float (*matrix)[16], pixman_box32_t *box) {
+	static const double corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+	double x1 = INFINITY, y1 = INFINITY, x2 = -INFINITY, y2 = -INFINITY;
+	for (int i = 0; i < 4; ++i) {
+		double x, y;
+		project(state, *matrix, corners[i][0], corners[i][1], &x, &y);
+		x1 = fmin(x1, x);
+		y1 = fmin(y1, y);
+		x2 = fmax(x2, x);
+		y2 = fmax(y2, y);
+	}
+
+	pixman_box32_t clip = {
+		0, 0,
+		pixman_image_get_width(state->target),
+		pixman_image_get_height(state->target),
+	};
+	if (state->scissored) {
+		clip = state->scissor;
+	}
+	// Round inwards by a fraction so exact pixel edges don't bleed
+	box->x1 = fmax(floor(x1 + 1.0 / 256), clip.x1);
+	box->y1 = fmax(floor(y1 + 1.0 / 256), clip.y1);
+	box->x2 = fmin(ceil(x2 - 1.0 / 256), clip.x2);
+	box->y2 = fmin(ceil(y2 - 1.0 / 256), clip.y2);
+	return box->x1 < box->x2 && box->y1 < box->y2;
+}
+
+static pixman_color_t color_from_floats(const float (*color)[4]) {
+	// pixman works with premultiplied alpha
+	float a = (*color)[3];
+	return (pixman_color_t){
+		.red = (*color)[0] * a * 0xFFFF,
+		.green = (*color)[1] * a * 0xFFFF,
+		.blue = (*color)[2] * a * 0xFFFF,
+		.alpha = a * 0xFFFF,
+	};
+}
+
+static void wlr_pixman_begin(struct wlr_renderer_state *state,
+		struct wlr_output *output) {
+	if (!state->target) {
+		wlr_log(L_ERROR, "No buffer bound to the pixman renderer");
+	}
+	state->output = output;
+	state->op = PIXMAN_OP_OVER;
+	state->scissored = false;
+}
+
+static void wlr_pixman_end(struct wlr_renderer_state *state) {
+	state->output = NULL;
+}
+
+static void wlr_pixman_clear(struct wlr_renderer_state *state,
+		const float (*color)[4]) {
+	if (!state->target) {
+		return;
+	}
+	pixman_box32_t box = {
+		0, 0,
+		pixman_image_get_width(state->target),
+		pixman_image_get_height(state->target),
+	};
+	if (state->scissored) {
+		box = state->scissor;
+	}
+	pixman_color_t pcolor = color_from_floats(color);
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, state->target, &pcolor, 1, &box);
+}
+
+static void wlr_pixman_scissor(struct wlr_renderer_state *state,
+		pixman_box32_t *box) {
+	if (!box || !state->output || !state->target) {
+		state->scissored = false;
+		return;
+	}
+
+	// Boxes are in output-local coordinates, so they follow the output
+	// transform like everything else
+	const float *m = state->output->transform_matrix;
+	float matrix[16] = {
+		[0] = m[0] * (box->x2 - box->x1),
+		[1] = m[1] * (box->y2 - box->y1),
+		[3] = m[0] * box->x1 + m[1] * box->y1 + m[3],
+		[4] = m[4] * (box->x2 - box->x1),
+		[5] = m[5] * (box->y2 - box->y1),
+		[7] = m[4] * box->x1 + m[5] * box->y1 + m[7],
+	};
+	state->scissored = false;
+	if (!quad_get_box(state, &matrix, &state->scissor)) {
+		state->scissor = (pixman_box32_t){0, 0, 0, 0};
+	}
+	state->scissored = true;
+}
+
+static void wlr_pixman_set_blending(struct wlr_renderer_state *state,
+		bool blending) {
+	state->op = blending ? PIXMAN_OP_OVER : PIXMAN_OP_SRC;
+}
+
+static struct wlr_texture *wlr_pixman_texture_init(
+		struct wlr_renderer_state *state) {
+	return pixman_texture_init();
+}
+
+static bool wlr_pixman_render_texture(struct wlr_renderer_state *state,
+		struct wlr_texture *texture, const float (*matrix)[16]) {
+	if (!texture || !texture->valid) {
+		wlr_log(L_ERROR, "attempt to render invalid texture");
+		return false;
+	}
+	pixman_box32_t box;
+	if (!state->target || !quad_get_box(state, matrix, &box)) {
+		return true;
+	}
+
+	// pixman wants to know where each target pixel samples the texture,
+	// which is the inverse of the quad's mapping scaled to texels
+	const float *m = *matrix;
+	int width = pixman_image_get_width(state->target);
+	int height = pixman_image_get_height(state->target);
+	struct pixman_f_transform to_target = {{
+		{ m[0] * width / 2, m[1] * width / 2, (m[3] + 1) * width / 2 },
+		{ -m[4] * height / 2, -m[5] * height / 2, (1 - m[7]) * height / 2 },
+		{ 0, 0, 1 },
+	}};
+	struct pixman_f_transform to_quad, to_texels = {{
+		{ texture->width, 0, 0 },
+		{ 0, texture->height, 0 },
+		{ 0, 0, 1 },
+	}};
+	if (!pixman_f_transform_invert(&to_quad, &to_target)) {
+		return false;
+	}
+	struct pixman_f_transform ftransform;
+	pixman_f_transform_multiply(&ftransform, &to_texels, &to_quad);
+	struct pixman_transform transform;
+	pixman_transform_from_pixman_f_transform(&transform, &ftransform);
+
+	// Unscaled, unrotated draws at whole pixel offsets are plain blits
+	pixman_image_t *image = texture->state->image;
+	bool blit = ftransform.m[0][0] == 1 && ftransform.m[0][1] == 0 &&
+		ftransform.m[1][0] == 0 && ftransform.m[1][1] == 1 &&
+		ftransform.m[0][2] == floor(ftransform.m[0][2]) &&
+		ftransform.m[1][2] == floor(ftransform.m[1][2]);
+	pixman_image_set_transform(image, &transform);
+	pixman_image_set_filter(image,
+		blit ? PIXMAN_FILTER_NEAREST : PIXMAN_FILTER_BILINEAR, NULL, 0);
+	pixman_image_composite32(state->op, image, NULL, state->target,
+		box.x1, box.y1, 0, 0, box.x1, box.y1,
+		box.x2 - box.x1, box.y2 - box.y1);
+	pixman_image_set_transform(image, NULL);
+	return true;
+}
+
+static void wlr_pixman_render_quad(struct wlr_renderer_state *state,
+		const float (*color)[4], const float (*matrix)[16]) {
+	pixman_box32_t box;
+	if (!state->target || !quad_get_box(state, matrix, &box)) {
+		return;
+	}
+	pixman_color_t pcolor = color_from_floats(color);
+	pixman_image_fill_boxes(state->op, state->target, &pcolor, 1, &box);
+}
+
+static void wlr_pixman_render_ellipse(struct wlr_renderer_state *state,
+		const float (*color)[4], const float (*matrix)[16]) {
+	pixman_box32_t box;
+	if (!state->target || !quad_get_box(state, matrix, &box)) {
+		return;
+	}
+
+	// Coverage mask with one span per row, relative to the full ellipse
+	double x1, y1, x2, y2;
+	project(state, *matrix, 0, 0, &x1, &y1);
+	project(state, *matrix, 1, 1, &x2, &y2);
+	double cx = (x1 + x2) / 2, cy = (y1 + y2) / 2;
+	double rx = fabs(x2 - x1) / 2, ry = fabs(y2 - y1) / 2;
+	int width = box.x2 - box.x1, height = box.y2 - box.y1;
+	pixman_box32_t *spans = calloc(height, sizeof(pixman_box32_t));
+	pixman_image_t *mask =
+		pixman_image_create_bits(PIXMAN_a8, width, height, NULL, 0);
+	pixman_color_t pcolor = color_from_floats(color);
+	pixman_image_t *src = pixman_image_create_solid_fill(&pcolor);
+	if (!spans || !mask || !src || ry == 0) {
+		goto out;
+	}
+	int n = 0;
+	for (int y = 0; y < height; ++y) {
+		double dy = (box.y1 + y + 0.5 - cy) / ry;
+		if (fabs(dy) >= 1) {
+			continue;
+		}
+		double dx = rx * sqrt(1 - dy * dy);
+		spans[n].x1 = fmax(round(cx - dx) - box.x1, 0);
+		spans[n].x2 = fmin(round(cx + dx) - box.x1, width);
+		spans[n].y1 = y;
+		spans[n].y2 = y + 1;
+		if (spans[n].x1 < spans[n].x2) {
+			++n;
+		}
+	}
+	if (state->op == PIXMAN_OP_SRC) {
+		// Without blending the color replaces what is inside the ellipse,
+		// like the GLES2 shader discarding the fragments outside of it
+		for (int i = 0; i < n; ++i) {
+			spans[i].x1 += box.x1;
+			spans[i].x2 += box.x1;
+			spans[i].y1 += box.y1;
+			spans[i].y2 += box.y1;
+		}
+		pixman_image_fill_boxes(PIXMAN_OP_SRC, state->target, &pcolor,
+			n, spans);
+		goto out;
+	}
+	static const pixman_color_t opaque = { 0, 0, 0, 0xFFFF };
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, mask, &opaque, n, spans);
+	pixman_image_composite32(state->op, src, mask, state->target,
+		0, 0, 0, 0, box.x1, box.y1, width, height);
+
+out:
+	if (src) {
+		pixman_image_unref(src);
+	}
+	if (mask) {
+		pixman_image_unref(mask);
+	}
+	free(spans);
+}
+
+static const enum wl_shm_format *wlr_pixman_formats(
+		struct wlr_renderer_state *state, size_t *len) {
+	static enum wl_shm_format formats[] = {
+		WL_SHM_FORMAT_ARGB8888,
+		WL_SHM_FORMAT_XRGB8888,
+		WL_SHM_FORMAT_ABGR8888,
+		WL_SHM_FORMAT_XBGR8888,
+	};
+	*len = sizeof(formats) / sizeof(formats[0]);
+	return formats;
+}
+
+static bool wlr_pixman_buffer_is_drm(struct wlr_renderer_state *state,
+		struct wl_resource *buffer) {
+	return false;
+}
+
+static void wlr_pixman_destroy(struct wlr_renderer_state *state) {
+	if (state->target) {
+		pixman_image_unref(state->target);
+	}
+	free(state);
+}
+
+static struct wlr_renderer_impl wlr_renderer_impl = {
+	.begin = wlr_pixman_begin,
+	.end = wlr_pixman_end,
+	.clear = wlr_pixman_clear,
+	.scissor = wlr_pixman_scissor,
+	.set_blending = wlr_pixman_set_blending,
+	.texture_init = wlr_pixman_texture_init,
+	.render_with_matrix = wlr_pixman_render_texture,
+	.render_quad = wlr_pixman_render_quad,
+	.render_ellipse = wlr_pixman_render_ellipse,
+	.formats = wlr_pixman_formats,
+	.buffer_is_drm = wlr_pixman_buffer_is_drm,
+	.destroy = wlr_pixman_destroy,
+};
+
+struct wlr_renderer *wlr_pixman_renderer_init(void) {
+	struct wlr_renderer_state *state =
+		calloc(1, sizeof(struct wlr_renderer_state));
+	if (!state) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return NULL;
+	}
+	struct wlr_renderer *renderer = wlr_renderer_init(state, &wlr_renderer_impl);
+	if (!renderer) {
+		free(state);
+		return NULL;
+	}
+	state->renderer = renderer;
+	state->op = PIXMAN_OP_OVER;
+	return renderer;
+}
+
+bool wlr_pixman_renderer_bind_buffer(struct wlr_renderer *renderer,
+		void *data, enum wl_shm_format format, int width, int height,
+		int stride) {
+	struct wlr_renderer_state *state = renderer->state;
+	pixman_image_t *target = NULL;
+	if (data) {
+		pixman_format_code_t pformat = pixman_format_for_wl_format(format);
+		if (!pformat) {
+			wlr_log(L_ERROR, "Unsupported format for the render target");
+			return false;
+		}
+		target = pixman_image_create_bits_no_clear(pformat,
+			width, height, data, stride);
+		if (!target) {
+			wlr_log(L_ERROR, "Failed to wrap the render target");
+			return false;
+		}
+	}
+	if (state->target) {
+		pixman_image_unref(state->target);
+	}
+	state->target = target;
+	state->scissored = false;
+	return true;
+}
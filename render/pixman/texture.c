@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <wayland-server.h>
+#include <wlr/render.h>
+#include <wlr/render/interface.h>
+#include <wlr/render/matrix.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+pixman_format_code_t pixman_format_for_wl_format(enum wl_shm_format fmt) {
+	switch (fmt) {
+	case WL_SHM_FORMAT_ARGB8888:
+		return PIXMAN_a8r8g8b8;
+	case WL_SHM_FORMAT_XRGB8888:
+		return PIXMAN_x8r8g8b8;
+	case WL_SHM_FORMAT_ABGR8888:
+		return PIXMAN_a8b8g8r8;
+	case WL_SHM_FORMAT_XBGR8888:
+		return PIXMAN_x8b8g8r8;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Makes sure the texture has its own storage of the given format and size.
+ * Client pixels are copied into it, since SHM buffers are released as soon
+ * as they have been uploaded.
+ */
+static bool pixman_texture_ensure_image(struct wlr_texture_state *texture,
+		enum wl_shm_format format, int width, int height) {
+	struct wlr_texture *_texture = texture->wlr_texture;
+	pixman_format_code_t pformat = pixman_format_for_wl_format(format);
+	if (!pformat) {
+		wlr_log(L_ERROR, "No supported pixel format for this texture");
+		return false;
+	}
+	if (texture->image && _texture->format == format &&
+			_texture->width == width && _texture->height == height) {
+		return true;
+	}
+
+	pixman_image_t *image =
+		pixman_image_create_bits_no_clear(pformat, width, height, NULL, 0);
+	if (!image) {
+		wlr_log(L_ERROR, "Failed to allocate texture image");
+		return false;
+	}
+	if (texture->image) {
+		pixman_image_unref(texture->image);
+	}
+	texture->image = image;
+	_texture->format = format;
+	_texture->width = width;
+	_texture->height = height;
+	_texture->valid = true;
+	return true;
+}
+
+/*
+ * Copies a rectangle from client memory holding a buffer_width x
+ * buffer_height image with the given stride in pixels.
+ */
+static bool pixman_texture_copy(struct wlr_texture_state *texture,
+		enum wl_shm_format format, int stride, int buffer_width,
+		int buffer_height, int x, int y, int width, int height,
+		const void *pixels) {
+	pixman_image_t *src = pixman_image_create_bits(
+		pixman_format_for_wl_format(format), buffer_width, buffer_height,
+		(uint32_t *)pixels, stride * 4);
+	if (!src) {
+		wlr_log(L_ERROR, "Failed to wrap texture pixels");
+		return false;
+	}
+	pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, texture->image,
+		x, y, 0, 0, x, y, width, height);
+	pixman_image_unref(src);
+	return true;
+}
+
+static bool pixman_texture_upload_pixels(struct wlr_texture_state *texture,
+		enum wl_shm_format format, int stride, int width, int height,
+		const unsigned char *pixels) {
+	if (!pixman_texture_ensure_image(texture, format, width, height)) {
+		return false;
+	}
+	return pixman_texture_copy(texture, format, stride, width, height,
+		0, 0, width, height, pixels);
+}
+
+static bool pixman_texture_update_pixels(struct wlr_texture_state *texture,
+		enum wl_shm_format format, int stride, int x, int y,
+		int width, int height, const unsigned char *pixels) {
+	struct wlr_texture *_texture = texture->wlr_texture;
+	if (!texture->image || _texture->format != format) {
+		return pixman_texture_upload_pixels(texture, format, stride,
+			x + width, y + height, pixels);
+	}
+	return pixman_texture_copy(texture, format, stride, x + width, y + height,
+		x, y, width, height, pixels);
+}
+
+static bool pixman_texture_upload_shm(struct wlr_texture_state *texture,
+		uint32_t format, struct wl_shm_buffer *buffer) {
+	int width = wl_shm_buffer_get_width(buffer);
+	int height = wl_shm_buffer_get_height(buffer);
+	if (!pixman_texture_ensure_image(texture, format, width, height)) {
+		return false;
+	}
+	wl_shm_buffer_begin_access(buffer);
+	bool ok = pixman_texture_copy(texture, format,
+		wl_shm_buffer_get_stride(buffer) / 4, width, height,
+		0, 0, width, height, wl_shm_buffer_get_data(buffer));
+	wl_shm_buffer_end_access(buffer);
+	return ok;
+}
+
+static bool pixman_texture_update_shm(struct wlr_texture_state *texture,
+		uint32_t format, int x, int y, int width, int height,
+		struct wl_shm_buffer *buffer) {
+	struct wlr_texture *_texture = texture->wlr_texture;
+	int buffer_width = wl_shm_buffer_get_width(buffer);
+	int buffer_height = wl_shm_buffer_get_height(buffer);
+	if (!texture->image || _texture->format != format ||
+			_texture->width != buffer_width ||
+			_texture->height != buffer_height) {
+		return pixman_texture_upload_shm(texture, format, buffer);
+	}
+	wl_shm_buffer_begin_access(buffer);
+	bool ok = pixman_texture_copy(texture, format,
+		wl_shm_buffer_get_stride(buffer) / 4, buffer_width, buffer_height,
+		x, y, width, height, wl_shm_buffer_get_data(buffer));
+	wl_shm_buffer_end_access(buffer);
+	return ok;
+}
+
+static bool pixman_texture_upload_drm(struct wlr_texture_state *texture,
+		struct wl_resource *buf) {
+	wlr_log(L_ERROR, "DRM buffers can't be used with the pixman renderer");
+	return false;
+}
+
+static void pixman_texture_get_matrix(struct wlr_texture_state *texture,
+		float (*matrix)[16], const float (*projection)[16], int x, int y) {
+	struct wlr_texture *_texture = texture->wlr_texture;
+	float world[16];
+	wlr_matrix_identity(matrix);
+	wlr_matrix_translate(&world, x, y, 0);
+	wlr_matrix_mul(matrix, &world, matrix);
+	wlr_matrix_scale(&world, _texture->width, _texture->height, 1);
+	wlr_matrix_mul(matrix, &world, matrix);
+	wlr_matrix_mul(projection, matrix, matrix);
+}
+
+static void pixman_texture_bind(struct wlr_texture_state *texture) {
+	// Nothing to bind, images are passed to pixman on each draw
+}
+
+static void pixman_texture_destroy(struct wlr_texture_state *texture) {
+	wl_signal_emit(&texture->wlr_texture->destroy_signal, texture->wlr_texture);
+	if (texture->image) {
+		pixman_image_unref(texture->image);
+	}
+	free(texture);
+}
+
+static struct wlr_texture_impl wlr_texture_impl = {
+	.upload_pixels = pixman_texture_upload_pixels,
+	.update_pixels = pixman_texture_update_pixels,
+	.upload_shm = pixman_texture_upload_shm,
+	.update_shm = pixman_texture_update_shm,
+	.upload_drm = pixman_texture_upload_drm,
+	.get_matrix = pixman_texture_get_matrix,
+	.bind = pixman_texture_bind,
+	.destroy = pixman_texture_destroy,
+};
+
+struct wlr_texture *pixman_texture_init(void) {
+	struct wlr_texture_state *state = calloc(sizeof(struct wlr_texture_state), 1);
+	if (!state) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return NULL;
+	}
+	struct wlr_texture *texture = wlr_texture_init(state, &wlr_texture_impl);
+	state->wlr_texture = texture;
+	wl_signal_init(&texture->destroy_signal);
+	return texture;
+}
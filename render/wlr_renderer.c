@@ -23,6 +23,20 @@ void wlr_renderer_end(struct wlr_renderer *r) {
 	r->impl->end(r->state);
 }
 
+void wlr_renderer_clear(struct wlr_renderer *r, const float (*color)[4]) {
+	r->impl->clear(r->state, color);
+}
+
+void wlr_renderer_scissor(struct wlr_renderer *r, pixman_box32_t *box) {
+	r->impl->scissor(r->state, box);
+}
+
+void wlr_renderer_set_blending(struct wlr_renderer *r, bool blending) {
+	if (r->impl->set_blending) {
+		r->impl->set_blending(r->state, blending);
+	}
+}
+
 struct wlr_texture *wlr_render_texture_init(struct wlr_renderer *r) {
 	return r->impl->texture_init(r->state);
 }
@@ -51,3 +65,11 @@ bool wlr_renderer_buffer_is_drm(struct wlr_renderer *r,
 		struct wl_resource *buffer) {
 	return r->impl->buffer_is_drm(r->state, buffer);
 }
+
+bool wlr_renderer_drm_buffer_get_size(struct wlr_renderer *r,
+		struct wl_resource *buffer, int *width, int *height) {
+	if (!r->impl->drm_buffer_get_size) {
+		return false;
+	}
+	return r->impl->drm_buffer_get_size(r->state, buffer, width, height);
+}
@@ -48,6 +48,14 @@ bool wlr_texture_upload_drm(struct wlr_texture *texture,
 	return texture->impl->upload_drm(texture->state, drm_buffer);
 }
 
+bool wlr_texture_upload_dmabuf(struct wlr_texture *texture,
+		struct wl_resource *dmabuf_resource) {
+	if (!texture->impl->upload_dmabuf) {
+		return false;
+	}
+	return texture->impl->upload_dmabuf(texture->state, dmabuf_resource);
+}
+
 void wlr_texture_get_matrix(struct wlr_texture *texture,
 		float (*matrix)[16], const float (*projection)[16], int x, int y) {
 	texture->impl->get_matrix(texture->state, matrix, projection, x, y);
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "backend/drm-util.h"
+
+/*
+ * Times match_obj on synthetic possible_crtcs masks, the way outputs are
+ * matched with CRTCs. Each problem starts from the previous solution, like a
+ * hotplug would.
+ */
+
+#define PROBLEMS 64
+#define MIN_TIME_NS 200000000 // per size
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Connectors can usually be driven by a few CRTCs, here each one can use a
+ * CRTC with a probability of 1/density
+ */
+static void make_masks(size_t num_outputs, size_t num_crtcs, int density,
+		uint32_t *masks) {
+	for (size_t o = 0; o < num_outputs; ++o) {
+		masks[o] = 0;
+		for (size_t c = 0; c < num_crtcs; ++c) {
+			if (rng() % density == 0) {
+				masks[o] |= 1u << c;
+			}
+		}
+	}
+}
+
+static void bench(size_t num_outputs, size_t num_crtcs, int density) {
+	uint32_t (*masks)[num_outputs] = calloc(PROBLEMS, sizeof(*masks));
+	uint32_t (*crtcs)[num_crtcs] = calloc(PROBLEMS, sizeof(*crtcs));
+	uint32_t *out = calloc(num_crtcs, sizeof(*out));
+	if (!masks || !crtcs || !out) {
+		fprintf(stderr, "Allocation failed\n");
+		exit(1);
+	}
+
+	size_t matched = 0;
+	for (size_t i = 0; i < PROBLEMS; ++i) {
+		make_masks(num_outputs, num_crtcs, density, masks[i]);
+		for (size_t c = 0; c < num_crtcs; ++c) {
+			crtcs[i][c] = UNMATCHED;
+		}
+		// Start from a solution to a slightly different problem
+		matched += match_obj(num_outputs, masks[i], num_crtcs, crtcs[i], out);
+		masks[i][rng() % num_outputs] = rng() & (UINT32_MAX >> (32 - num_crtcs));
+		for (size_t c = 0; c < num_crtcs; ++c) {
+			uint32_t o = out[c];
+			crtcs[i][c] = o != UNMATCHED && masks[i][o] & (1u << c) ?
+				o : UNMATCHED;
+		}
+	}
+
+	size_t calls = 0;
+	int64_t start = now_ns(), elapsed;
+	do {
+		for (size_t i = 0; i < PROBLEMS; ++i) {
+			match_obj(num_outputs, masks[i], num_crtcs, crtcs[i], out);
+		}
+		calls += PROBLEMS;
+		elapsed = now_ns() - start;
+	} while (elapsed < MIN_TIME_NS);
+
+	printf("%2zu outputs %2zu crtcs 1/%d: %9.1f ns/call, %.2f matched\n",
+		num_outputs, num_crtcs, density, (double)elapsed / calls,
+		(double)matched / PROBLEMS);
+
+	free(out);
+	free(crtcs);
+	free(masks);
+}
+
+int main(void) {
+	static const struct {
+		size_t outputs, crtcs;
+	} sizes[] = {
+		{ 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 4 }, { 4, 6 },
+		{ 6, 6 }, { 8, 8 }, { 12, 16 }, { 16, 16 }, { 16, 32 },
+	};
+	static const int densities[] = { 1, 2, 4 };
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		for (size_t j = 0; j < sizeof(densities) / sizeof(densities[0]); ++j) {
+			bench(sizes[i].outputs, sizes[i].crtcs, densities[j]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "backend/drm-util.h"
+
+/*
+ * Compares match_obj with an exhaustive search over every assignment, on
+ * random problems small enough to enumerate.
+ */
+
+#define MAX_OBJS 6
+#define MAX_RES 6
+#define ITERATIONS 100000
+
+struct problem {
+	size_t num_objs, num_res;
+	uint32_t objs[MAX_OBJS];
+	uint32_t res[MAX_RES];
+};
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+	// xorshift32, so the problems are the same everywhere
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void make_problem(struct problem *p) {
+	p->num_objs = rng() % (MAX_OBJS + 1);
+	p->num_res = rng() % (MAX_RES + 1);
+	for (size_t o = 0; o < p->num_objs; ++o) {
+		p->objs[o] = rng() & ((1u << p->num_res) - 1);
+	}
+
+	// A valid previous solution, with some resources left alone
+	bool taken[MAX_OBJS] = {0};
+	for (size_t r = 0; r < p->num_res; ++r) {
+		uint32_t o = p->num_objs ? rng() % p->num_objs : 0;
+		switch (rng() % 4) {
+		case 0:
+			p->res[r] = SKIP;
+			break;
+		case 1:
+			p->res[r] = UNMATCHED;
+			break;
+		default:
+			if (p->num_objs == 0 || taken[o] || !(p->objs[o] & (1u << r))) {
+				p->res[r] = UNMATCHED;
+			} else {
+				p->res[r] = o;
+				taken[o] = true;
+			}
+		}
+	}
+}
+
+static size_t count_changes(const struct problem *p, const uint32_t *out) {
+	size_t changes = 0;
+	for (size_t r = 0; r < p->num_res; ++r) {
+		if (p->res[r] != UNMATCHED && p->res[r] != SKIP &&
+				p->res[r] != out[r]) {
+			++changes;
+		}
+	}
+	return changes;
+}
+
+static bool is_valid(const struct problem *p, const uint32_t *out,
+		size_t score) {
+	bool taken[MAX_OBJS] = {0};
+	size_t matched = 0;
+	for (size_t r = 0; r < p->num_res; ++r) {
+		if (p->res[r] == SKIP || out[r] == SKIP) {
+			if (p->res[r] != out[r]) {
+				return false;
+			}
+			continue;
+		}
+		if (out[r] == UNMATCHED) {
+			continue;
+		}
+		if (out[r] >= p->num_objs || taken[out[r]] ||
+				!(p->objs[out[r]] & (1u << r))) {
+			return false;
+		}
+		taken[out[r]] = true;
+		++matched;
+	}
+	return matched == score;
+}
+
+struct search {
+	const struct problem *p;
+	bool taken[MAX_OBJS];
+	size_t best_score, best_changes;
+};
+
+static void search(struct search *s, size_t r, size_t score, size_t changes) {
+	const struct problem *p = s->p;
+	if (r == p->num_res) {
+		if (score > s->best_score ||
+				(score == s->best_score && changes < s->best_changes)) {
+			s->best_score = score;
+			s->best_changes = changes;
+		}
+		return;
+	}
+	if (p->res[r] == SKIP) {
+		search(s, r + 1, score, changes);
+		return;
+	}
+
+	bool had_match = p->res[r] != UNMATCHED;
+	search(s, r + 1, score, changes + had_match);
+	for (size_t o = 0; o < p->num_objs; ++o) {
+		if (s->taken[o] || !(p->objs[o] & (1u << r))) {
+			continue;
+		}
+		s->taken[o] = true;
+		search(s, r + 1, score + 1,
+			changes + (had_match && p->res[r] != o));
+		s->taken[o] = false;
+	}
+}
+
+static void print_problem(const struct problem *p, const uint32_t *out) {
+	for (size_t o = 0; o < p->num_objs; ++o) {
+		fprintf(stderr, "obj %zu: possible 0x%x\n", o, p->objs[o]);
+	}
+	for (size_t r = 0; r < p->num_res; ++r) {
+		fprintf(stderr, "res %zu: was %d, now %d\n", r,
+			(int)p->res[r], (int)out[r]);
+	}
+}
+
+int main(void) {
+	for (int i = 0; i < ITERATIONS; ++i) {
+		struct problem p;
+		make_problem(&p);
+
+		uint32_t out[MAX_RES];
+		size_t score = match_obj(p.num_objs, p.objs, p.num_res, p.res, out);
+		if (!is_valid(&p, out, score)) {
+			fprintf(stderr, "problem %d: invalid solution\n", i);
+			print_problem(&p, out);
+			return 1;
+		}
+
+		struct search s = { .p = &p, .best_changes = SIZE_MAX };
+		search(&s, 0, 0, 0);
+		size_t changes = count_changes(&p, out);
+		if (score != s.best_score || changes != s.best_changes) {
+			fprintf(stderr, "problem %d: %zu matches and %zu changes, "
+				"expected %zu and %zu\n", i, score, changes,
+				s.best_score, s.best_changes);
+			print_problem(&p, out);
+			return 1;
+		}
+	}
+	return 0;
+}
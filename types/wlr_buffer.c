@@ -0,0 +1,55 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/log.h>
+
+struct buffer_locks {
+	size_t count;
+	struct wl_listener destroy;
+};
+
+static void handle_buffer_destroy(struct wl_listener *listener, void *data) {
+	struct buffer_locks *locks = wl_container_of(listener, locks, destroy);
+	wl_list_remove(&locks->destroy.link);
+	free(locks);
+}
+
+static struct buffer_locks *buffer_get_locks(struct wl_resource *buffer) {
+	struct wl_listener *listener =
+		wl_resource_get_destroy_listener(buffer, handle_buffer_destroy);
+	if (!listener) {
+		return NULL;
+	}
+	struct buffer_locks *locks;
+	return wl_container_of(listener, locks, destroy);
+}
+
+void wlr_buffer_lock(struct wl_resource *buffer) {
+	struct buffer_locks *locks = buffer_get_locks(buffer);
+	if (!locks) {
+		locks = calloc(1, sizeof(struct buffer_locks));
+		if (!locks) {
+			wlr_log_errno(L_ERROR, "Allocation failed");
+			return;
+		}
+		locks->destroy.notify = handle_buffer_destroy;
+		wl_resource_add_destroy_listener(buffer, &locks->destroy);
+	}
+	++locks->count;
+}
+
+void wlr_buffer_unlock(struct wl_resource *buffer) {
+	struct buffer_locks *locks = buffer_get_locks(buffer);
+	if (!locks) {
+		return;
+	}
+	assert(locks->count > 0);
+	if (--locks->count > 0) {
+		return;
+	}
+
+	wl_resource_queue_event(buffer, WL_BUFFER_RELEASE);
+	wl_list_remove(&locks->destroy.link);
+	free(locks);
+}
@@ -0,0 +1,377 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+#include <wayland-server.h>
+#include <wlr/egl.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
+#include <wlr/util/log.h>
+#include "linux-dmabuf-unstable-v1-protocol.h"
+
+static void wl_buffer_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface wl_buffer_impl = {
+	wl_buffer_destroy,
+};
+
+bool wlr_dmabuf_resource_is_buffer(struct wl_resource *buffer_resource) {
+	return wl_resource_instance_of(buffer_resource, &wl_buffer_interface,
+		&wl_buffer_impl);
+}
+
+struct wlr_dmabuf_buffer *wlr_dmabuf_buffer_from_buffer_resource(
+		struct wl_resource *buffer_resource) {
+	assert(wlr_dmabuf_resource_is_buffer(buffer_resource));
+	return wl_resource_get_user_data(buffer_resource);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface linux_buffer_params_impl;
+
+static struct wlr_dmabuf_buffer *wlr_dmabuf_buffer_from_params_resource(
+		struct wl_resource *params_resource) {
+	assert(wl_resource_instance_of(params_resource,
+		&zwp_linux_buffer_params_v1_interface, &linux_buffer_params_impl));
+	return wl_resource_get_user_data(params_resource);
+}
+
+static void linux_dmabuf_buffer_destroy(struct wlr_dmabuf_buffer *buffer) {
+	for (int i = 0; i < WLR_LINUX_DMABUF_MAX_PLANES; ++i) {
+		if (buffer->attributes.fd[i] != -1) {
+			close(buffer->attributes.fd[i]);
+		}
+	}
+	free(buffer);
+}
+
+static void params_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void params_add(struct wl_client *client,
+		struct wl_resource *params_resource, int32_t fd,
+		uint32_t plane_idx, uint32_t offset, uint32_t stride,
+		uint32_t modifier_hi, uint32_t modifier_lo) {
+	struct wlr_dmabuf_buffer *buffer =
+		wlr_dmabuf_buffer_from_params_resource(params_resource);
+	if (!buffer) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+			"params was already used to create a wl_buffer");
+		close(fd);
+		return;
+	}
+
+	if (plane_idx >= WLR_LINUX_DMABUF_MAX_PLANES) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+			"plane index %u > %u", plane_idx, WLR_LINUX_DMABUF_MAX_PLANES);
+		close(fd);
+		return;
+	}
+
+	if (buffer->attributes.fd[plane_idx] != -1) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+			"a dmabuf with id %d has already been added for plane %u",
+			buffer->attributes.fd[plane_idx], plane_idx);
+		close(fd);
+		return;
+	}
+
+	buffer->attributes.fd[plane_idx] = fd;
+	buffer->attributes.offset[plane_idx] = offset;
+	buffer->attributes.stride[plane_idx] = stride;
+	buffer->attributes.modifier[plane_idx] =
+		((uint64_t)modifier_hi << 32) | modifier_lo;
+	buffer->attributes.n_planes++;
+}
+
+static void handle_buffer_destroy(struct wl_resource *buffer_resource) {
+	struct wlr_dmabuf_buffer *buffer =
+		wlr_dmabuf_buffer_from_buffer_resource(buffer_resource);
+	linux_dmabuf_buffer_destroy(buffer);
+}
+
+bool wlr_dmabuf_buffer_has_inverted_y(struct wlr_dmabuf_buffer *dmabuf) {
+	return dmabuf->attributes.flags & ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT;
+}
+
+static void params_create_common(struct wl_client *client,
+		struct wl_resource *params_resource, uint32_t buffer_id,
+		int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+	if (!wl_resource_get_user_data(params_resource)) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+			"params was already used to create a wl_buffer");
+		return;
+	}
+	struct wlr_dmabuf_buffer *buffer =
+		wlr_dmabuf_buffer_from_params_resource(params_resource);
+
+	// The buffer is owned by the wl_buffer from now on, or freed below
+	wl_resource_set_user_data(params_resource, NULL);
+
+	if (!buffer->attributes.n_planes) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+			"no dmabuf has been added to the params");
+		goto err_out;
+	}
+
+	// Planes must be added without gaps
+	for (int i = 0; i < buffer->attributes.n_planes; ++i) {
+		if (buffer->attributes.fd[i] == -1) {
+			wl_resource_post_error(params_resource,
+				ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+				"no dmabuf has been added for plane %d", i);
+			goto err_out;
+		}
+	}
+
+	buffer->attributes.width = width;
+	buffer->attributes.height = height;
+	buffer->attributes.format = format;
+	buffer->attributes.flags = flags;
+
+	if (width < 1 || height < 1) {
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+			"invalid width %d or height %d", width, height);
+		goto err_out;
+	}
+
+	for (int i = 0; i < buffer->attributes.n_planes; ++i) {
+		uint32_t plane_offset = buffer->attributes.offset[i];
+		uint32_t plane_stride = buffer->attributes.stride[i];
+		if ((uint64_t)plane_offset + plane_stride > UINT32_MAX) {
+			wl_resource_post_error(params_resource,
+				ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+				"size overflow for plane %d", i);
+			goto err_out;
+		}
+		if (i == 0 && (uint64_t)plane_offset +
+				(uint64_t)plane_stride * height > UINT32_MAX) {
+			wl_resource_post_error(params_resource,
+				ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+				"size overflow for plane %d", i);
+			goto err_out;
+		}
+
+		// Not all dmabufs can be seeked, only check the ones that can
+		off_t size = lseek(buffer->attributes.fd[i], 0, SEEK_END);
+		if (size == -1) {
+			continue;
+		}
+		if (plane_offset >= size || plane_offset + plane_stride > size
+				|| (i == 0 && plane_offset +
+					(uint64_t)plane_stride * height > (uint64_t)size)) {
+			wl_resource_post_error(params_resource,
+				ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+				"invalid offset %u or stride %u for plane %d",
+				plane_offset, plane_stride, i);
+			goto err_out;
+		}
+	}
+
+	if (flags & ~ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT) {
+		wlr_log(L_ERROR, "Unsupported dmabuf flags %x", flags);
+		goto err_failed;
+	}
+
+	if (!wlr_egl_check_import_dmabuf(buffer->egl, &buffer->attributes)) {
+		goto err_failed;
+	}
+
+	buffer->buffer_resource = wl_resource_create(client, &wl_buffer_interface,
+		1, buffer_id);
+	if (!buffer->buffer_resource) {
+		wl_resource_post_no_memory(params_resource);
+		goto err_out;
+	}
+	wl_resource_set_implementation(buffer->buffer_resource,
+		&wl_buffer_impl, buffer, handle_buffer_destroy);
+
+	// create_immed doesn't get a created event
+	if (buffer_id == 0) {
+		zwp_linux_buffer_params_v1_send_created(params_resource,
+			buffer->buffer_resource);
+	}
+	return;
+
+err_failed:
+	if (buffer_id == 0) {
+		zwp_linux_buffer_params_v1_send_failed(params_resource);
+	} else {
+		// The protocol leaves a failed create_immed up to the compositor,
+		// rather than handing out a broken wl_buffer we kill the client
+		wl_resource_post_error(params_resource,
+			ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+			"importing the supplied dmabufs failed");
+	}
+err_out:
+	linux_dmabuf_buffer_destroy(buffer);
+}
+
+static void params_create(struct wl_client *client,
+		struct wl_resource *params_resource,
+		int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+	params_create_common(client, params_resource, 0, width, height, format,
+		flags);
+}
+
+static void params_create_immed(struct wl_client *client,
+		struct wl_resource *params_resource, uint32_t buffer_id,
+		int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+	params_create_common(client, params_resource, buffer_id, width, height,
+		format, flags);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface linux_buffer_params_impl = {
+	params_destroy,
+	params_add,
+	params_create,
+	params_create_immed,
+};
+
+static void handle_params_destroy(struct wl_resource *params_resource) {
+	// Only free the buffer if it hasn't been handed to a wl_buffer
+	struct wlr_dmabuf_buffer *buffer =
+		wlr_dmabuf_buffer_from_params_resource(params_resource);
+	if (buffer) {
+		linux_dmabuf_buffer_destroy(buffer);
+	}
+}
+
+static void linux_dmabuf_create_params(struct wl_client *client,
+		struct wl_resource *linux_dmabuf_resource, uint32_t params_id) {
+	struct wlr_linux_dmabuf *linux_dmabuf =
+		wl_resource_get_user_data(linux_dmabuf_resource);
+
+	uint32_t version = wl_resource_get_version(linux_dmabuf_resource);
+	struct wlr_dmabuf_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (!buffer) {
+		goto err;
+	}
+
+	for (int i = 0; i < WLR_LINUX_DMABUF_MAX_PLANES; ++i) {
+		buffer->attributes.fd[i] = -1;
+	}
+	buffer->egl = linux_dmabuf->egl;
+
+	buffer->params_resource = wl_resource_create(client,
+		&zwp_linux_buffer_params_v1_interface, version, params_id);
+	if (!buffer->params_resource) {
+		goto err_free;
+	}
+	wl_resource_set_implementation(buffer->params_resource,
+		&linux_buffer_params_impl, buffer, handle_params_destroy);
+	return;
+
+err_free:
+	free(buffer);
+err:
+	wl_resource_post_no_memory(linux_dmabuf_resource);
+}
+
+static void linux_dmabuf_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface linux_dmabuf_impl = {
+	linux_dmabuf_destroy,
+	linux_dmabuf_create_params,
+};
+
+static void linux_dmabuf_send_formats(struct wlr_linux_dmabuf *linux_dmabuf,
+		struct wl_resource *resource, uint32_t version) {
+	struct wlr_egl *egl = linux_dmabuf->egl;
+	int *formats = NULL;
+	int num_formats = wlr_egl_get_dmabuf_formats(egl, &formats);
+	if (num_formats < 0) {
+		return;
+	}
+
+	for (int i = 0; i < num_formats; ++i) {
+		uint64_t *modifiers = NULL;
+		int num_modifiers = wlr_egl_get_dmabuf_modifiers(egl, formats[i],
+			&modifiers);
+		if (num_modifiers < 0) {
+			continue;
+		}
+
+		if (version < ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
+			zwp_linux_dmabuf_v1_send_format(resource, formats[i]);
+		} else if (num_modifiers == 0) {
+			// The format can only be used with implicit modifiers
+			uint64_t mod = DRM_FORMAT_MOD_INVALID;
+			zwp_linux_dmabuf_v1_send_modifier(resource, formats[i],
+				mod >> 32, mod & 0xFFFFFFFF);
+		} else {
+			for (int j = 0; j < num_modifiers; ++j) {
+				zwp_linux_dmabuf_v1_send_modifier(resource, formats[i],
+					modifiers[j] >> 32, modifiers[j] & 0xFFFFFFFF);
+			}
+		}
+		free(modifiers);
+	}
+	free(formats);
+}
+
+static void linux_dmabuf_resource_destroy(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void linux_dmabuf_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_linux_dmabuf *linux_dmabuf = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwp_linux_dmabuf_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &linux_dmabuf_impl,
+		linux_dmabuf, linux_dmabuf_resource_destroy);
+	wl_list_insert(&linux_dmabuf->wl_resources, wl_resource_get_link(resource));
+
+	linux_dmabuf_send_formats(linux_dmabuf, resource, version);
+}
+
+struct wlr_linux_dmabuf *wlr_linux_dmabuf_create(struct wl_display *display,
+		struct wlr_egl *egl) {
+	struct wlr_linux_dmabuf *linux_dmabuf =
+		calloc(1, sizeof(struct wlr_linux_dmabuf));
+	if (!linux_dmabuf) {
+		wlr_log(L_ERROR, "could not create linux dmabuf v1");
+		return NULL;
+	}
+	linux_dmabuf->egl = egl;
+	wl_list_init(&linux_dmabuf->wl_resources);
+
+	struct wl_global *wl_global = wl_global_create(display,
+		&zwp_linux_dmabuf_v1_interface, 3, linux_dmabuf, linux_dmabuf_bind);
+	if (!wl_global) {
+		wlr_log(L_ERROR, "could not create linux dmabuf v1 wl global");
+		free(linux_dmabuf);
+		return NULL;
+	}
+	linux_dmabuf->wl_global = wl_global;
+	return linux_dmabuf;
+}
+
+void wlr_linux_dmabuf_destroy(struct wlr_linux_dmabuf *linux_dmabuf) {
+	if (!linux_dmabuf) {
+		return;
+	}
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &linux_dmabuf->wl_resources) {
+		wl_resource_destroy(resource);
+	}
+	wl_global_destroy(linux_dmabuf->wl_global);
+	free(linux_dmabuf);
+}
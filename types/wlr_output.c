@@ -1,4 +1,6 @@
+#define _POSIX_C_SOURCE 199309L
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tgmath.h>
@@ -12,6 +14,13 @@
 #include <wlr/render/gles2.h>
 #include <wlr/render.h>
 
+// Time left to the GPU and the page flip once a frame has been submitted
+#define FRAME_SCHEDULE_MARGIN 2000000 // ns
+
+static int64_t timespec_to_nsec(const struct timespec *t) {
+	return (int64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
 static void wl_output_send_to_resource(struct wl_resource *resource) {
 	assert(resource);
 	struct wlr_output *output = wl_resource_get_user_data(resource);
@@ -84,12 +93,29 @@ struct wl_global *wlr_output_create_global(
 	struct wl_global *wl_global = wl_global_create(display,
 		&wl_output_interface, 3, wlr_output, wl_output_bind);
 	wlr_output->wl_global = wl_global;
+	wlr_output->display = display;
 	wl_list_init(&wlr_output->wl_resources);
 	return wl_global;
 }
 
+// The contents of all buffers are unknown, repaint everything
+static void wlr_output_reset_damage(struct wlr_output *output) {
+	int width, height;
+	wlr_output_effective_resolution(output, &width, &height);
+
+	for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_HISTORY; ++i) {
+		pixman_region32_fini(&output->damage_history[i]);
+		pixman_region32_init_rect(&output->damage_history[i],
+			0, 0, width, height);
+	}
+	pixman_region32_fini(&output->damage);
+	pixman_region32_init_rect(&output->damage, 0, 0, width, height);
+}
+
 void wlr_output_update_matrix(struct wlr_output *output) {
 	wlr_matrix_texture(output->transform_matrix, output->width, output->height, output->transform);
+	// The size or orientation changed, so the damage is meaningless
+	wlr_output_reset_damage(output);
 }
 
 struct wlr_output *wlr_output_create(struct wlr_output_impl *impl,
@@ -100,7 +126,13 @@ struct wlr_output *wlr_output_create(struct wlr_output_impl *impl,
 	output->modes = list_create();
 	output->transform = WL_OUTPUT_TRANSFORM_NORMAL;
 	wl_signal_init(&output->events.frame);
+	wl_signal_init(&output->events.present);
 	wl_signal_init(&output->events.resolution);
+	wl_signal_init(&output->events.destroy);
+	pixman_region32_init(&output->damage);
+	for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_HISTORY; ++i) {
+		pixman_region32_init(&output->damage_history[i]);
+	}
 	return output;
 }
 
@@ -127,6 +159,8 @@ void wlr_output_transform(struct wlr_output *output,
 
 bool wlr_output_set_cursor(struct wlr_output *output,
 		const uint8_t *buf, int32_t stride, uint32_t width, uint32_t height) {
+	wlr_output_schedule_frame(output);
+
 	if (output->impl->set_cursor && output->impl->set_cursor(output->state, buf,
 			stride, width, height)) {
 		output->cursor.is_sw = false;
@@ -159,6 +193,9 @@ bool wlr_output_move_cursor(struct wlr_output *output, int x, int y) {
 	output->cursor.x = x;
 	output->cursor.y = y;
 
+	// Some backends only apply cursor changes along with the next frame
+	wlr_output_schedule_frame(output);
+
 	if (output->cursor.is_sw) {
 		return true;
 	}
@@ -175,6 +212,14 @@ void wlr_output_destroy(struct wlr_output *output) {
 		return;
 	}
 
+	wl_signal_emit(&output->events.destroy, output);
+	if (output->idle_frame) {
+		wl_event_source_remove(output->idle_frame);
+	}
+	if (output->frame_scheduler.timer) {
+		wl_event_source_remove(output->frame_scheduler.timer);
+	}
+
 	output->impl->destroy(output->state);
 	for (size_t i = 0; output->modes && i < output->modes->length; ++i) {
 		struct wlr_output_mode *mode = output->modes->items[i];
@@ -182,6 +227,10 @@ void wlr_output_destroy(struct wlr_output *output) {
 		free(mode);
 	}
 	list_free(output->modes);
+	pixman_region32_fini(&output->damage);
+	for (size_t i = 0; i < WLR_OUTPUT_DAMAGE_HISTORY; ++i) {
+		pixman_region32_fini(&output->damage_history[i]);
+	}
 	free(output);
 }
 
@@ -201,6 +250,33 @@ void wlr_output_make_current(struct wlr_output *output) {
 	output->impl->make_current(output->state);
 }
 
+static void frame_scheduler_add_render_time(struct wlr_output *output,
+		int64_t render_time) {
+	if (render_time > INT_MAX) {
+		render_time = INT_MAX;
+	}
+	output->frame_scheduler.render_time[output->frame_scheduler.render_time_idx] =
+		render_time;
+	output->frame_scheduler.render_time_idx =
+		(output->frame_scheduler.render_time_idx + 1) % WLR_OUTPUT_RENDER_HISTORY;
+	if (output->frame_scheduler.render_time_count < WLR_OUTPUT_RENDER_HISTORY) {
+		++output->frame_scheduler.render_time_count;
+	}
+}
+
+// Records how long the compositor took from the frame event to submitting
+static void frame_scheduler_end_frame(struct wlr_output *output) {
+	if (!output->frame_scheduler.rendering) {
+		return;
+	}
+	output->frame_scheduler.rendering = false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	frame_scheduler_add_render_time(output, timespec_to_nsec(&now) -
+		timespec_to_nsec(&output->frame_scheduler.frame_start));
+}
+
 void wlr_output_swap_buffers(struct wlr_output *output) {
 	if (output->cursor.is_sw) {
 		glViewport(0, 0, output->width, output->height);
@@ -213,4 +289,243 @@ void wlr_output_swap_buffers(struct wlr_output *output) {
 	}
 
 	output->impl->swap_buffers(output->state);
+	output->frame_pending = true;
+	frame_scheduler_end_frame(output);
+
+	output->damage_history_idx = (output->damage_history_idx +
+		WLR_OUTPUT_DAMAGE_HISTORY - 1) % WLR_OUTPUT_DAMAGE_HISTORY;
+	pixman_region32_copy(&output->damage_history[output->damage_history_idx],
+		&output->damage);
+	pixman_region32_clear(&output->damage);
+}
+
+void wlr_output_skip_frame(struct wlr_output *output) {
+	output->frame_pending = output->impl->skip_frame &&
+		output->impl->skip_frame(output->state);
+	output->frame_scheduler.rendering = false;
+	output->frame_scheduler.delayed = false;
+}
+
+bool wlr_output_enable_adaptive_sync(struct wlr_output *output, bool enable) {
+	if (!output->impl->set_adaptive_sync) {
+		return !enable;
+	}
+	return output->impl->set_adaptive_sync(output->state, enable);
+}
+
+void wlr_output_set_frame_scheduling(struct wlr_output *output, bool enable) {
+	if (output->frame_scheduler.enabled == enable) {
+		return;
+	}
+	output->frame_scheduler.enabled = enable;
+	output->frame_scheduler.rendering = false;
+	output->frame_scheduler.delayed = false;
+	output->frame_scheduler.render_time_idx = 0;
+	output->frame_scheduler.render_time_count = 0;
+}
+
+void wlr_output_send_present(struct wlr_output *output, struct timespec *when,
+		unsigned seq, uint32_t flags) {
+	struct wlr_output_event_present event = {
+		.output = output,
+		.seq = seq,
+		.flags = flags,
+	};
+	if (when) {
+		event.when = *when;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &event.when);
+		event.flags &= ~WLR_OUTPUT_PRESENT_HW_CLOCK;
+	}
+	if (output->current_mode && output->current_mode->refresh > 0) {
+		event.refresh = 1000000000000LL / output->current_mode->refresh;
+	}
+
+	// A delayed frame which didn't make the vblank it was scheduled for
+	// counts as taking a whole refresh, so that the next frames are rendered
+	// early until it leaves the history
+	if (output->frame_scheduler.delayed && output->frame_scheduler.refresh > 0 &&
+			timespec_to_nsec(&event.when) -
+			timespec_to_nsec(&output->frame_scheduler.last_present) >
+			output->frame_scheduler.refresh * 3 / 2) {
+		wlr_log(L_DEBUG, "Output %s missed a vblank, rendering earlier",
+			output->name);
+		frame_scheduler_add_render_time(output, output->frame_scheduler.refresh);
+	}
+	output->frame_scheduler.delayed = false;
+	output->frame_scheduler.last_present = event.when;
+	output->frame_scheduler.refresh = event.refresh;
+	output->frame_scheduler.has_present = true;
+
+	wl_signal_emit(&output->events.present, &event);
+}
+
+static void emit_frame(struct wlr_output *output) {
+	output->frame_pending = false;
+	if (output->frame_scheduler.enabled) {
+		clock_gettime(CLOCK_MONOTONIC, &output->frame_scheduler.frame_start);
+		output->frame_scheduler.rendering = true;
+	}
+	wl_signal_emit(&output->events.frame, output);
+}
+
+static int handle_frame_timer(void *data) {
+	struct wlr_output *output = data;
+	output->frame_scheduler.delayed = true;
+	emit_frame(output);
+	return 0;
+}
+
+// Returns how many milliseconds the frame event can be held back so that the
+// frame is still ready for the vblank following the last presentation
+static int frame_scheduler_get_delay(struct wlr_output *output) {
+	// With adaptive sync the display waits for the frame anyway
+	if (!output->frame_scheduler.enabled || output->adaptive_sync ||
+			!output->frame_scheduler.has_present ||
+			output->frame_scheduler.refresh <= 0 ||
+			output->frame_scheduler.render_time_count == 0) {
+		return 0;
+	}
+
+	// Expect the worst of the recent frames
+	int render_time = 0;
+	for (size_t i = 0; i < output->frame_scheduler.render_time_count; ++i) {
+		if (output->frame_scheduler.render_time[i] > render_time) {
+			render_time = output->frame_scheduler.render_time[i];
+		}
+	}
+
+	int64_t deadline = timespec_to_nsec(&output->frame_scheduler.last_present) +
+		output->frame_scheduler.refresh - render_time - FRAME_SCHEDULE_MARGIN;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t delay = deadline - timespec_to_nsec(&now);
+
+	// Timers have millisecond granularity, round towards rendering earlier
+	return delay > 0 ? delay / 1000000 : 0;
+}
+
+void wlr_output_send_frame(struct wlr_output *output) {
+	int delay = frame_scheduler_get_delay(output);
+	output->frame_scheduler.has_present = false;
+
+	if (delay > 0 && output->display) {
+		if (!output->frame_scheduler.timer) {
+			struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+			output->frame_scheduler.timer =
+				wl_event_loop_add_timer(ev, handle_frame_timer, output);
+		}
+		if (output->frame_scheduler.timer) {
+			// Nothing else may start a frame in the meantime
+			output->frame_pending = true;
+			wl_event_source_timer_update(output->frame_scheduler.timer, delay);
+			return;
+		}
+	}
+
+	emit_frame(output);
+}
+
+static void handle_idle_frame(void *data) {
+	struct wlr_output *output = data;
+	output->idle_frame = NULL;
+	if (!output->frame_pending) {
+		wlr_output_send_frame(output);
+	}
+}
+
+void wlr_output_schedule_frame(struct wlr_output *output) {
+	if (output->frame_pending || output->idle_frame || !output->display) {
+		return;
+	}
+
+	struct wl_event_loop *ev = wl_display_get_event_loop(output->display);
+	output->idle_frame = wl_event_loop_add_idle(ev, handle_idle_frame, output);
+}
+
+void wlr_output_add_damage(struct wlr_output *output,
+		pixman_region32_t *damage) {
+	int width, height;
+	wlr_output_effective_resolution(output, &width, &height);
+
+	pixman_region32_union(&output->damage, &output->damage, damage);
+	pixman_region32_intersect_rect(&output->damage, &output->damage,
+		0, 0, width, height);
+	if (pixman_region32_not_empty(damage)) {
+		wlr_output_schedule_frame(output);
+	}
+}
+
+void wlr_output_add_damage_whole(struct wlr_output *output) {
+	int width, height;
+	wlr_output_effective_resolution(output, &width, &height);
+
+	pixman_region32_union_rect(&output->damage, &output->damage,
+		0, 0, width, height);
+	wlr_output_schedule_frame(output);
+}
+
+bool wlr_output_get_frame_damage(struct wlr_output *output,
+		pixman_region32_t *damage) {
+	if (!pixman_region32_not_empty(&output->damage)) {
+		return false;
+	}
+
+	int width, height;
+	wlr_output_effective_resolution(output, &width, &height);
+
+	int age = -1;
+	if (output->impl->get_buffer_age) {
+		age = output->impl->get_buffer_age(output->state);
+	}
+
+	// An age of 0 means the contents are undefined
+	if (age <= 0 || age > WLR_OUTPUT_DAMAGE_HISTORY + 1) {
+		pixman_region32_fini(damage);
+		pixman_region32_init_rect(damage, 0, 0, width, height);
+		return true;
+	}
+
+	// The back buffer misses the changes of the last age - 1 frames
+	pixman_region32_copy(damage, &output->damage);
+	for (int i = 0; i < age - 1; ++i) {
+		size_t idx = (output->damage_history_idx + i) % WLR_OUTPUT_DAMAGE_HISTORY;
+		pixman_region32_union(damage, damage, &output->damage_history[idx]);
+	}
+	pixman_region32_intersect_rect(damage, damage, 0, 0, width, height);
+	return true;
+}
+
+bool wlr_output_present_buffer(struct wlr_output *output,
+		struct wl_resource *buffer) {
+	// The software cursor and output transforms need composition
+	if (!output->impl->present_buffer || output->cursor.is_sw ||
+			output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		return false;
+	}
+
+	if (!output->impl->present_buffer(output->state, buffer)) {
+		return false;
+	}
+	output->frame_pending = true;
+	frame_scheduler_end_frame(output);
+
+	// None of our own buffers have the client's contents
+	wlr_output_reset_damage(output);
+	pixman_region32_clear(&output->damage);
+	return true;
+}
+
+size_t wlr_output_assign_overlays(struct wlr_output *output,
+		size_t count, struct wlr_output_overlay *overlays) {
+	for (size_t i = 0; i < count; ++i) {
+		overlays[i].accepted = false;
+	}
+
+	if (!output->impl->assign_overlays ||
+			output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		return 0;
+	}
+
+	return output->impl->assign_overlays(output->state, count, overlays);
 }
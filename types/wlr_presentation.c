@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 199309L
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_presentation.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+#include "presentation-time-protocol.h"
+
+#define PRESENTATION_VERSION 1
+
+static void feedback_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_presentation_feedback *feedback =
+		wl_resource_get_user_data(resource);
+	wl_list_remove(&feedback->surface_destroy.link);
+	if (!feedback->output) {
+		wl_list_remove(&feedback->surface_commit.link);
+	} else {
+		wl_list_remove(&feedback->output_present.link);
+		wl_list_remove(&feedback->output_destroy.link);
+	}
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+/*
+ * Feedback objects are one-shot, they go away after the first event.
+ */
+static void feedback_destroy(struct wlr_presentation_feedback *feedback) {
+	wl_resource_destroy(feedback->resource);
+}
+
+static void feedback_send_discarded(
+		struct wlr_presentation_feedback *feedback) {
+	wp_presentation_feedback_send_discarded(feedback->resource);
+	feedback_destroy(feedback);
+}
+
+static void feedback_send_presented(struct wlr_presentation_feedback *feedback,
+		struct wlr_output_event_present *event) {
+	struct wl_client *client = wl_resource_get_client(feedback->resource);
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &event->output->wl_resources) {
+		if (wl_resource_get_client(resource) == client) {
+			wp_presentation_feedback_send_sync_output(feedback->resource,
+				resource);
+		}
+	}
+
+	uint64_t tv_sec = event->when.tv_sec;
+	// The flags are defined to match the protocol's
+	wp_presentation_feedback_send_presented(feedback->resource,
+		tv_sec >> 32, tv_sec & 0xFFFFFFFF, event->when.tv_nsec,
+		event->refresh, 0, event->seq, event->flags);
+	feedback_destroy(feedback);
+}
+
+static void feedback_handle_surface_commit(struct wl_listener *listener,
+		void *data) {
+	struct wlr_presentation_feedback *feedback =
+		wl_container_of(listener, feedback, surface_commit);
+	if (feedback->committed) {
+		// Replaced before it ever made it to the screen
+		feedback_send_discarded(feedback);
+		return;
+	}
+	feedback->committed = true;
+}
+
+static void feedback_handle_surface_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_presentation_feedback *feedback =
+		wl_container_of(listener, feedback, surface_destroy);
+	feedback_send_discarded(feedback);
+}
+
+static void feedback_handle_output_present(struct wl_listener *listener,
+		void *data) {
+	struct wlr_presentation_feedback *feedback =
+		wl_container_of(listener, feedback, output_present);
+	feedback_send_presented(feedback, data);
+}
+
+static void feedback_handle_output_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_presentation_feedback *feedback =
+		wl_container_of(listener, feedback, output_destroy);
+	feedback_send_discarded(feedback);
+}
+
+static void presentation_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void presentation_handle_feedback(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *surface_resource,
+		uint32_t id) {
+	struct wlr_presentation *presentation =
+		wl_resource_get_user_data(resource);
+	struct wlr_surface *surface = wl_resource_get_user_data(surface_resource);
+
+	struct wlr_presentation_feedback *feedback =
+		calloc(1, sizeof(struct wlr_presentation_feedback));
+	if (!feedback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	feedback->resource = wl_resource_create(client,
+		&wp_presentation_feedback_interface, 1, id);
+	if (!feedback->resource) {
+		free(feedback);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(feedback->resource, NULL, feedback,
+		feedback_handle_resource_destroy);
+
+	feedback->presentation = presentation;
+	feedback->surface = surface;
+	// Feedback is about the next commit of the surface
+	feedback->surface_commit.notify = feedback_handle_surface_commit;
+	wl_signal_add(&surface->signals.commit, &feedback->surface_commit);
+	feedback->surface_destroy.notify = feedback_handle_surface_destroy;
+	wl_resource_add_destroy_listener(surface_resource,
+		&feedback->surface_destroy);
+	wl_list_insert(&presentation->feedbacks, &feedback->link);
+}
+
+static const struct wp_presentation_interface presentation_impl = {
+	.destroy = presentation_handle_destroy,
+	.feedback = presentation_handle_feedback,
+};
+
+static void presentation_handle_resource_destroy(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void presentation_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_presentation *presentation = data;
+	assert(client && presentation);
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_presentation_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &presentation_impl,
+		presentation, presentation_handle_resource_destroy);
+	wl_list_insert(&presentation->resources, wl_resource_get_link(resource));
+
+	wp_presentation_send_clock_id(resource, (uint32_t)presentation->clock);
+}
+
+struct wlr_presentation *wlr_presentation_create(struct wl_display *display) {
+	struct wlr_presentation *presentation =
+		calloc(1, sizeof(struct wlr_presentation));
+	if (!presentation) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	// Outputs report their timestamps with this clock
+	presentation->clock = CLOCK_MONOTONIC;
+	wl_list_init(&presentation->resources);
+	wl_list_init(&presentation->feedbacks);
+
+	presentation->wl_global = wl_global_create(display,
+		&wp_presentation_interface, PRESENTATION_VERSION, presentation,
+		presentation_bind);
+	if (!presentation->wl_global) {
+		free(presentation);
+		return NULL;
+	}
+	return presentation;
+}
+
+void wlr_presentation_destroy(struct wlr_presentation *presentation) {
+	if (!presentation) {
+		return;
+	}
+	struct wlr_presentation_feedback *feedback, *tmp_feedback;
+	wl_list_for_each_safe(feedback, tmp_feedback, &presentation->feedbacks,
+			link) {
+		feedback_send_discarded(feedback);
+	}
+	struct wl_resource *resource, *tmp_resource;
+	wl_resource_for_each_safe(resource, tmp_resource,
+			&presentation->resources) {
+		wl_resource_destroy(resource);
+	}
+	wl_global_destroy(presentation->wl_global);
+	free(presentation);
+}
+
+void wlr_presentation_surface_sampled_on_output(
+		struct wlr_presentation *presentation, struct wlr_surface *surface,
+		struct wlr_output *output) {
+	struct wlr_presentation_feedback *feedback;
+	wl_list_for_each(feedback, &presentation->feedbacks, link) {
+		if (feedback->surface != surface || !feedback->committed ||
+				feedback->output) {
+			continue;
+		}
+		// Further commits don't matter anymore, this content is on its way
+		// to the screen
+		wl_list_remove(&feedback->surface_commit.link);
+		feedback->output = output;
+		feedback->output_present.notify = feedback_handle_output_present;
+		wl_signal_add(&output->events.present, &feedback->output_present);
+		feedback->output_destroy.notify = feedback_handle_output_destroy;
+		wl_signal_add(&output->events.destroy, &feedback->output_destroy);
+	}
+}
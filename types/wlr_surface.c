@@ -1,21 +1,54 @@
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <wayland-server.h>
 #include <wlr/util/log.h>
 #include <wlr/egl.h>
 #include <wlr/render/interface.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_surface.h>
+#include <wlr/types/wlr_linux_dmabuf.h>
 
 static void surface_destroy(struct wl_client *client, struct wl_resource *resource) {
 	wl_resource_destroy(resource);
 }
 
+static void state_set_buffer(struct wlr_surface_state *state,
+		struct wl_resource *buffer) {
+	if (state->buffer) {
+		wl_list_remove(&state->buffer_destroy.link);
+	}
+	state->buffer = buffer;
+	if (buffer) {
+		wl_resource_add_destroy_listener(buffer, &state->buffer_destroy);
+	}
+}
+
+static void pending_handle_buffer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_surface_state *state =
+		wl_container_of(listener, state, buffer_destroy);
+	wl_list_remove(&state->buffer_destroy.link);
+	state->buffer = NULL;
+}
+
+static void current_handle_buffer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_surface *surface =
+		wl_container_of(listener, surface, current.buffer_destroy);
+	wl_list_remove(&surface->current.buffer_destroy.link);
+	surface->current.buffer = NULL;
+	surface->buffer_locked = false;
+}
+
 static void surface_attach(struct wl_client *client,
 		struct wl_resource *resource,
 		struct wl_resource *buffer, int32_t sx, int32_t sy) {
 	struct wlr_surface *surface = wl_resource_get_user_data(resource);
 	surface->pending.invalid |= WLR_SURFACE_INVALID_BUFFER;
-	surface->pending.buffer = buffer;
+	surface->pending.sx = sx;
+	surface->pending.sy = sy;
+	state_set_buffer(&surface->pending, buffer);
 }
 
 static void surface_damage(struct wl_client *client,
@@ -59,7 +92,8 @@ static void surface_frame(struct wl_client *client,
 	wl_resource_set_implementation(cb->resource,
 			NULL, cb, destroy_frame_callback);
 
-	wl_list_insert(surface->frame_callback_list.prev, &cb->link);
+	// Callbacks only become current on the next commit
+	wl_list_insert(surface->pending.frame_callback_list.prev, &cb->link);
 }
 
 static void surface_set_opaque_region(struct wl_client *client,
@@ -90,87 +124,451 @@ static void surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static bool transform_is_rotated(enum wl_output_transform transform) {
+	return transform % 2 == 1;
+}
+
+static enum wl_output_transform transform_invert(
+		enum wl_output_transform transform) {
+	if (transform == WL_OUTPUT_TRANSFORM_90) {
+		return WL_OUTPUT_TRANSFORM_270;
+	} else if (transform == WL_OUTPUT_TRANSFORM_270) {
+		return WL_OUTPUT_TRANSFORM_90;
+	}
+	// Flips and half turns are their own inverse
+	return transform;
+}
+
+/*
+ * Scales a region, rounding outwards so that damage never shrinks.
+ */
+static void region_scale(pixman_region32_t *dst, pixman_region32_t *src,
+		float scale) {
+	if (scale == 1) {
+		pixman_region32_copy(dst, src);
+		return;
+	}
+
+	int n;
+	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &n);
+	pixman_box32_t *dst_rects = malloc(n * sizeof(pixman_box32_t));
+	if (dst_rects == NULL) {
+		return;
+	}
+	for (int i = 0; i < n; ++i) {
+		dst_rects[i].x1 = floorf(src_rects[i].x1 * scale);
+		dst_rects[i].y1 = floorf(src_rects[i].y1 * scale);
+		dst_rects[i].x2 = ceilf(src_rects[i].x2 * scale);
+		dst_rects[i].y2 = ceilf(src_rects[i].y2 * scale);
+	}
+	pixman_region32_fini(dst);
+	pixman_region32_init_rects(dst, dst_rects, n);
+	free(dst_rects);
+}
+
+/*
+ * Applies a transform to a region lying within a width x height box.
+ */
+static void region_transform(pixman_region32_t *dst, pixman_region32_t *src,
+		enum wl_output_transform transform, int width, int height) {
+	if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		pixman_region32_copy(dst, src);
+		return;
+	}
+
+	int n;
+	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &n);
+	pixman_box32_t *dst_rects = malloc(n * sizeof(pixman_box32_t));
+	if (dst_rects == NULL) {
+		return;
+	}
+	for (int i = 0; i < n; ++i) {
+		pixman_box32_t r = src_rects[i];
+		pixman_box32_t *d = &dst_rects[i];
+		switch (transform) {
+		case WL_OUTPUT_TRANSFORM_NORMAL:
+			*d = r;
+			break;
+		case WL_OUTPUT_TRANSFORM_90:
+			d->x1 = height - r.y2;
+			d->y1 = r.x1;
+			d->x2 = height - r.y1;
+			d->y2 = r.x2;
+			break;
+		case WL_OUTPUT_TRANSFORM_180:
+			d->x1 = width - r.x2;
+			d->y1 = height - r.y2;
+			d->x2 = width - r.x1;
+			d->y2 = height - r.y1;
+			break;
+		case WL_OUTPUT_TRANSFORM_270:
+			d->x1 = r.y1;
+			d->y1 = width - r.x2;
+			d->x2 = r.y2;
+			d->y2 = width - r.x1;
+			break;
+		case WL_OUTPUT_TRANSFORM_FLIPPED:
+			d->x1 = width - r.x2;
+			d->y1 = r.y1;
+			d->x2 = width - r.x1;
+			d->y2 = r.y2;
+			break;
+		case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+			d->x1 = height - r.y2;
+			d->y1 = width - r.x2;
+			d->x2 = height - r.y1;
+			d->y2 = width - r.x1;
+			break;
+		case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+			d->x1 = r.x1;
+			d->y1 = height - r.y2;
+			d->x2 = r.x2;
+			d->y2 = height - r.y1;
+			break;
+		case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+			d->x1 = r.y1;
+			d->y1 = r.x1;
+			d->x2 = r.y2;
+			d->y2 = r.x2;
+			break;
+		}
+	}
+	pixman_region32_fini(dst);
+	pixman_region32_init_rects(dst, dst_rects, n);
+	free(dst_rects);
+}
+
+static bool surface_buffer_get_size(struct wlr_surface *surface,
+		struct wl_resource *buffer, int *width, int *height) {
+	struct wl_shm_buffer *shm_buf = wl_shm_buffer_get(buffer);
+	if (shm_buf) {
+		*width = wl_shm_buffer_get_width(shm_buf);
+		*height = wl_shm_buffer_get_height(shm_buf);
+		return true;
+	}
+	if (wlr_dmabuf_resource_is_buffer(buffer)) {
+		struct wlr_dmabuf_buffer *dmabuf =
+			wlr_dmabuf_buffer_from_buffer_resource(buffer);
+		*width = dmabuf->attributes.width;
+		*height = dmabuf->attributes.height;
+		return true;
+	}
+	return wlr_renderer_drm_buffer_get_size(surface->renderer, buffer,
+		width, height);
+}
+
+static void surface_update_size(struct wlr_surface *surface) {
+	struct wlr_surface_state *current = &surface->current;
+	int width = 0, height = 0;
+	if (current->buffer && !surface_buffer_get_size(surface, current->buffer,
+			&width, &height)) {
+		wlr_log(L_ERROR, "Unable to get the size of the attached buffer");
+	}
+	current->buffer_width = width;
+	current->buffer_height = height;
+
+	if (transform_is_rotated(current->transform)) {
+		int tmp = width;
+		width = height;
+		height = tmp;
+	}
+	current->width = width / current->scale;
+	current->height = height / current->scale;
+}
+
+/*
+ * Turns the pending damage into the current one: surface_damage only covers
+ * this commit, while buffer_damage keeps piling up until the next flush.
+ */
+static void surface_update_damage(struct wlr_surface *surface,
+		int old_width, int old_height) {
+	struct wlr_surface_state *current = &surface->current;
+	struct wlr_surface_state *pending = &surface->pending;
+
+	pixman_region32_t buffer_damage;
+	pixman_region32_init(&buffer_damage);
+
+	pixman_region32_clear(&current->surface_damage);
+	pixman_region32_copy(&current->surface_damage, &pending->surface_damage);
+	region_transform(&buffer_damage, &pending->buffer_damage,
+		transform_invert(current->transform),
+		current->buffer_width, current->buffer_height);
+	region_scale(&buffer_damage, &buffer_damage, 1.0f / current->scale);
+	pixman_region32_union(&current->surface_damage,
+		&current->surface_damage, &buffer_damage);
+	// On a resize, the area the surface vacated is damaged too
+	pixman_region32_t extents;
+	pixman_region32_init_rect(&extents, 0, 0, current->width, current->height);
+	if (current->width != old_width || current->height != old_height) {
+		pixman_region32_union_rect(&extents, &extents,
+			0, 0, old_width, old_height);
+		pixman_region32_union(&current->surface_damage,
+			&current->surface_damage, &extents);
+	}
+	pixman_region32_intersect(&current->surface_damage,
+		&current->surface_damage, &extents);
+	pixman_region32_fini(&extents);
+
+	region_scale(&buffer_damage, &pending->surface_damage, current->scale);
+	region_transform(&buffer_damage, &buffer_damage, current->transform,
+		current->width * current->scale, current->height * current->scale);
+	pixman_region32_union(&buffer_damage, &buffer_damage,
+		&pending->buffer_damage);
+	pixman_region32_union(&current->buffer_damage, &current->buffer_damage,
+		&buffer_damage);
+	pixman_region32_intersect_rect(&current->buffer_damage,
+		&current->buffer_damage, 0, 0,
+		current->buffer_width, current->buffer_height);
+
+	pixman_region32_fini(&buffer_damage);
+}
+
+static void buffer_texture_destroy(struct wlr_surface_buffer_texture *entry) {
+	if (entry->buffer) {
+		wl_list_remove(&entry->buffer_destroy.link);
+	}
+	wl_list_remove(&entry->link);
+	wlr_texture_destroy(entry->texture);
+	free(entry);
+}
+
+static void handle_buffer_texture_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_surface_buffer_texture *entry =
+		wl_container_of(listener, entry, buffer_destroy);
+	wl_list_remove(&entry->buffer_destroy.link);
+	entry->buffer = NULL;
+	// Keep showing the last contents until the client attaches a new buffer
+	if (entry->texture != entry->surface->texture) {
+		buffer_texture_destroy(entry);
+	}
+}
+
+static void surface_prune_buffer_textures(struct wlr_surface *surface) {
+	size_t n = 0;
+	struct wlr_surface_buffer_texture *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &surface->buffer_textures, link) {
+		if (entry->texture == surface->texture) {
+			++n;
+			continue;
+		}
+		if (!entry->buffer || n >= WLR_SURFACE_BUFFER_TEXTURES) {
+			buffer_texture_destroy(entry);
+			continue;
+		}
+		++n;
+	}
+}
+
+/*
+ * A NULL buffer unmaps the surface: nothing is left to show, so the last
+ * contents must not keep being drawn.
+ */
+static void surface_unmap_texture(struct wlr_surface *surface) {
+	surface->texture = surface->shm_texture;
+	surface->shm_texture->valid = false;
+	surface_prune_buffer_textures(surface);
+}
+
 static void surface_commit(struct wl_client *client,
 		struct wl_resource *resource) {
 	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+	struct wlr_surface_state *current = &surface->current;
+	struct wlr_surface_state *pending = &surface->pending;
+	int old_width = current->width, old_height = current->height;
 
-	if ((surface->pending.invalid & WLR_SURFACE_INVALID_BUFFER)) {
-		surface->current.buffer = surface->pending.buffer;
+	if ((pending->invalid & WLR_SURFACE_INVALID_BUFFER)) {
+		// Lock the new buffer first, a client may re-attach the same one
+		if (pending->buffer) {
+			wlr_buffer_lock(pending->buffer);
+		}
+		if (current->buffer && surface->buffer_locked) {
+			wlr_buffer_unlock(current->buffer);
+		}
+		surface->buffer_locked = pending->buffer != NULL;
+		current->sx = pending->sx;
+		current->sy = pending->sy;
+		state_set_buffer(current, pending->buffer);
+		state_set_buffer(pending, NULL);
+		if (!current->buffer) {
+			surface_unmap_texture(surface);
+		}
+	}
+	if ((pending->invalid & WLR_SURFACE_INVALID_SCALE)) {
+		current->scale = pending->scale;
 	}
-	if ((surface->pending.invalid & WLR_SURFACE_INVALID_SURFACE_DAMAGE)) {
-		// TODO: Sort out buffer damage too
-		pixman_region32_union(&surface->current.surface_damage,
-				&surface->current.surface_damage,
-				&surface->pending.surface_damage);
-		// TODO: Surface sizing is complicated
-		//pixman_region32_intersect_rect(&surface->current.surface_damage,
-		//		&surface->current.surface_damage,
-		//		0, 0, surface->width, surface->height);
-		pixman_region32_clear(&surface->pending.surface_damage);
+	if ((pending->invalid & WLR_SURFACE_INVALID_TRANSFORM)) {
+		current->transform = pending->transform;
 	}
-	// TODO: Commit other changes
+	if ((pending->invalid & (WLR_SURFACE_INVALID_BUFFER |
+			WLR_SURFACE_INVALID_SCALE | WLR_SURFACE_INVALID_TRANSFORM))) {
+		surface_update_size(surface);
+	}
+	surface_update_damage(surface, old_width, old_height);
+	if ((pending->invalid & WLR_SURFACE_INVALID_OPAQUE_REGION)) {
+		pixman_region32_copy(&current->opaque, &pending->opaque);
+	}
+	if ((pending->invalid & WLR_SURFACE_INVALID_INPUT_REGION)) {
+		pixman_region32_copy(&current->input, &pending->input);
+	}
+	wl_list_insert_list(current->frame_callback_list.prev,
+		&pending->frame_callback_list);
+	wl_list_init(&pending->frame_callback_list);
 
-	surface->pending.invalid = 0;
+	current->invalid = pending->invalid;
+	pixman_region32_clear(&pending->surface_damage);
+	pixman_region32_clear(&pending->buffer_damage);
+	pending->invalid = 0;
 	// TODO: add the invalid bitfield to this callback
 	wl_signal_emit(&surface->signals.commit, surface);
 }
 
-void wlr_surface_flush_damage(struct wlr_surface *surface) {
-	if (!surface->current.buffer) {
-		if (surface->texture->valid) {
-			// TODO: Detach buffers
+static struct wlr_texture *surface_get_buffer_texture(
+		struct wlr_surface *surface, struct wl_resource *buffer) {
+	struct wlr_surface_buffer_texture *entry;
+	wl_list_for_each(entry, &surface->buffer_textures, link) {
+		if (entry->buffer == buffer) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&surface->buffer_textures, &entry->link);
+			return entry->texture;
 		}
+	}
+
+	struct wlr_texture *texture = wlr_render_texture_init(surface->renderer);
+	if (!texture) {
+		return NULL;
+	}
+	bool imported = false;
+	if (wlr_dmabuf_resource_is_buffer(buffer)) {
+		imported = wlr_texture_upload_dmabuf(texture, buffer);
+	} else if (wlr_renderer_buffer_is_drm(surface->renderer, buffer)) {
+		imported = wlr_texture_upload_drm(texture, buffer);
+	} else {
+		wlr_log(L_INFO, "Unknown buffer handle attached");
+	}
+	if (!imported) {
+		wlr_texture_destroy(texture);
+		return NULL;
+	}
+
+	entry = calloc(1, sizeof(struct wlr_surface_buffer_texture));
+	if (!entry) {
+		wlr_log_errno(L_ERROR, "Allocation failed");
+		wlr_texture_destroy(texture);
+		return NULL;
+	}
+	entry->surface = surface;
+	entry->buffer = buffer;
+	entry->texture = texture;
+	entry->buffer_destroy.notify = handle_buffer_texture_destroy;
+	wl_resource_add_destroy_listener(buffer, &entry->buffer_destroy);
+	wl_list_insert(&surface->buffer_textures, &entry->link);
+	return texture;
+}
+
+static void surface_release_buffer(struct wlr_surface *surface) {
+	if (surface->buffer_locked) {
+		wlr_buffer_unlock(surface->current.buffer);
+		surface->buffer_locked = false;
+	}
+}
+
+void wlr_surface_flush_damage(struct wlr_surface *surface) {
+	struct wlr_surface_state *current = &surface->current;
+	if (!current->buffer) {
+		// Unmapped on commit, see surface_unmap_texture
 		return;
 	}
-	struct wl_shm_buffer *buffer = wl_shm_buffer_get(surface->current.buffer);
+	struct wl_shm_buffer *buffer = wl_shm_buffer_get(current->buffer);
 	if (!buffer) {
-		if (wlr_renderer_buffer_is_drm(surface->renderer, surface->pending.buffer)) {
-			wlr_texture_upload_drm(surface->texture, surface->pending.buffer);
-			goto release;
-		} else {
-			wlr_log(L_INFO, "Unknown buffer handle attached");
+		// GPU buffers are sampled directly, there is nothing to copy. They
+		// stay locked until replaced, implicit fencing on the dmabuf keeps
+		// the client from drawing into it while we read from it.
+		struct wlr_texture *texture =
+			surface_get_buffer_texture(surface, current->buffer);
+		if (!texture) {
 			return;
 		}
+		surface->texture = texture;
+		surface_prune_buffer_textures(surface);
+		pixman_region32_clear(&current->buffer_damage);
+		return;
 	}
-	pixman_region32_t damage = surface->current.surface_damage;
-	if (!pixman_region32_not_empty(&damage)) {
+	if (!surface->buffer_locked) {
+		// Already copied and released, nothing new can be read from it
+		pixman_region32_clear(&current->buffer_damage);
+		return;
+	}
+	uint32_t format = wl_shm_buffer_get_format(buffer);
+	if (surface->texture != surface->shm_texture ||
+			!surface->texture->valid ||
+			surface->texture->width != current->buffer_width ||
+			surface->texture->height != current->buffer_height) {
+		// The SHM texture missed everything drawn while GPU buffers were
+		// attached or the surface was unmapped, or has the wrong size, so
+		// damage alone won't do
+		surface->texture = surface->shm_texture;
+		surface_prune_buffer_textures(surface);
+		wlr_texture_upload_shm(surface->texture, format, buffer);
 		goto release;
 	}
 	int n;
-	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &n);
-	uint32_t format = wl_shm_buffer_get_format(buffer);
+	pixman_box32_t *rects =
+		pixman_region32_rectangles(&current->buffer_damage, &n);
 	for (int i = 0; i < n; ++i) {
 		pixman_box32_t rect = rects[i];
 		if (!wlr_texture_update_shm(surface->texture, format,
-				rect.x1, rect.y1, 
+				rect.x1, rect.y1,
 				rect.x2 - rect.x1,
 				rect.y2 - rect.y1,
 				buffer)) {
 			break;
 		}
 	}
-	pixman_region32_fini(&surface->current.surface_damage);
-	pixman_region32_init(&surface->current.surface_damage);
 release:
-	wl_resource_queue_event(surface->current.buffer, WL_BUFFER_RELEASE);
+	pixman_region32_clear(&current->buffer_damage);
+	// The pixels live in our texture now, the client can have it back
+	surface_release_buffer(surface);
 }
 
 static void surface_set_buffer_transform(struct wl_client *client,
 		struct wl_resource *resource, int transform) {
-	wlr_log(L_DEBUG, "TODO: surface surface buffer transform");
+	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+	if (transform < WL_OUTPUT_TRANSFORM_NORMAL ||
+			transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+		wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_TRANSFORM,
+			"Specified transform value (%d) is invalid", transform);
+		return;
+	}
+	surface->pending.invalid |= WLR_SURFACE_INVALID_TRANSFORM;
+	surface->pending.transform = transform;
 }
 
 static void surface_set_buffer_scale(struct wl_client *client,
 		struct wl_resource *resource,
 		int32_t scale) {
-	wlr_log(L_DEBUG, "TODO: surface set buffer scale");
+	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+	if (scale <= 0) {
+		wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE,
+			"Specified scale value (%d) is not positive", scale);
+		return;
+	}
+	surface->pending.invalid |= WLR_SURFACE_INVALID_SCALE;
+	surface->pending.scale = scale;
 }
 
 static void surface_damage_buffer(struct wl_client *client,
 		struct wl_resource *resource,
 		int32_t x, int32_t y, int32_t width,
 		int32_t height) {
-	wlr_log(L_DEBUG, "TODO: surface damage buffer");
+	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+	if (width < 0 || height < 0) {
+		return;
+	}
+	surface->pending.invalid |= WLR_SURFACE_INVALID_BUFFER_DAMAGE;
+	pixman_region32_union_rect(&surface->pending.buffer_damage,
+				   &surface->pending.buffer_damage,
+				   x, y, width, height);
 }
 
 const struct wl_surface_interface surface_interface = {
@@ -186,14 +584,40 @@ const struct wl_surface_interface surface_interface = {
 	surface_damage_buffer
 };
 
-static void destroy_surface(struct wl_resource *resource) {
-	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+static void surface_state_init(struct wlr_surface_state *state) {
+	state->scale = 1;
+	state->transform = WL_OUTPUT_TRANSFORM_NORMAL;
+	pixman_region32_init(&state->surface_damage);
+	pixman_region32_init(&state->buffer_damage);
+	pixman_region32_init(&state->opaque);
+	pixman_region32_init_rect(&state->input,
+			INT32_MIN, INT32_MIN, UINT32_MAX, UINT32_MAX);
+	wl_list_init(&state->frame_callback_list);
+}
 
-	wlr_texture_destroy(surface->texture);
+static void surface_state_finish(struct wlr_surface_state *state) {
+	state_set_buffer(state, NULL);
 	struct wlr_frame_callback *cb, *next;
-	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link) {
+	wl_list_for_each_safe(cb, next, &state->frame_callback_list, link) {
 		wl_resource_destroy(cb->resource);
 	}
+	pixman_region32_fini(&state->surface_damage);
+	pixman_region32_fini(&state->buffer_damage);
+	pixman_region32_fini(&state->opaque);
+	pixman_region32_fini(&state->input);
+}
+
+static void destroy_surface(struct wl_resource *resource) {
+	struct wlr_surface *surface = wl_resource_get_user_data(resource);
+
+	surface_release_buffer(surface);
+	surface_state_finish(&surface->pending);
+	surface_state_finish(&surface->current);
+	struct wlr_surface_buffer_texture *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &surface->buffer_textures, link) {
+		buffer_texture_destroy(entry);
+	}
+	wlr_texture_destroy(surface->shm_texture);
 
 	free(surface);
 }
@@ -201,11 +625,20 @@ static void destroy_surface(struct wl_resource *resource) {
 struct wlr_surface *wlr_surface_create(struct wl_resource *res,
 		struct wlr_renderer *renderer) {
 	struct wlr_surface *surface = calloc(1, sizeof(struct wlr_surface));
+	if (!surface) {
+		wl_resource_post_no_memory(res);
+		return NULL;
+	}
 	surface->renderer = renderer;
-	surface->texture = wlr_render_texture_init(renderer);
+	surface->shm_texture = wlr_render_texture_init(renderer);
+	surface->texture = surface->shm_texture;
+	wl_list_init(&surface->buffer_textures);
 	surface->resource = res;
+	surface_state_init(&surface->current);
+	surface_state_init(&surface->pending);
+	surface->current.buffer_destroy.notify = current_handle_buffer_destroy;
+	surface->pending.buffer_destroy.notify = pending_handle_buffer_destroy;
 	wl_signal_init(&surface->signals.commit);
-	wl_list_init(&surface->frame_callback_list);
 	wl_resource_set_implementation(res, &surface_interface,
 			surface, destroy_surface);
 	return surface;
@@ -0,0 +1,424 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "xcursor/cache.h"
+
+#define CACHE_MAGIC 0x6378726c // "lrxc"
+#define CACHE_VERSION 2
+#define CACHE_MAX_IMAGE_SIZE 0x7fff
+
+// The theme can't be cached, the file only remembers that
+#define CACHE_FLAG_UNCACHEABLE 1
+
+struct cache_header {
+	uint32_t magic, version;
+	int32_t size;
+	uint32_t flags;
+	uint32_t file_size;
+	uint32_t theme, library_path; // into the string table
+	uint32_t stamp_count, stamps;
+	uint32_t cursor_count, cursors;
+	uint32_t image_count, images;
+	uint32_t strings, strings_size;
+	uint32_t pixels, pixels_size;
+	uint32_t pad; // keeps the stamps after the header aligned
+};
+
+// Modification time of a theme file or directory, sec is -1 if it's missing
+struct cache_stamp {
+	int64_t sec, nsec;
+	uint32_t path; // into the string table
+	uint32_t pad;
+};
+
+// Theme files whose modification invalidates the cache, for each directory
+static const char *stamp_files[] = { "", "cursors", "index.theme" };
+#define STAMPS_PER_DIR (sizeof(stamp_files) / sizeof(stamp_files[0]))
+
+static void get_stamp(const char *path, int64_t *sec, int64_t *nsec) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		*sec = -1;
+		*nsec = 0;
+		return;
+	}
+	*sec = st.st_mtim.tv_sec;
+	*nsec = st.st_mtim.tv_nsec;
+}
+
+static bool check_range(const struct cache_header *header, uint64_t offset,
+		uint64_t count, uint64_t elem_size, uint64_t align) {
+	return offset % align == 0 && offset <= header->file_size &&
+		count * elem_size <= header->file_size - offset;
+}
+
+static const char *get_string(const struct xcursor_cache *cache,
+		uint32_t offset) {
+	const struct cache_header *header = cache->data;
+	if (offset >= header->strings_size) {
+		return NULL;
+	}
+	return (const char *)cache->data + header->strings + offset;
+}
+
+static bool check_cache(struct xcursor_cache *cache, const char *theme,
+		int size) {
+	const struct cache_header *header = cache->data;
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION
+			|| header->file_size != cache->size || header->size != size) {
+		return false;
+	}
+
+	if (!check_range(header, header->stamps, header->stamp_count,
+				sizeof(struct cache_stamp), 8)
+			|| !check_range(header, header->cursors, header->cursor_count,
+				sizeof(struct xcursor_cache_cursor), 4)
+			|| !check_range(header, header->images, header->image_count,
+				sizeof(struct xcursor_cache_image), 4)
+			|| !check_range(header, header->pixels, header->pixels_size, 1, 4)
+			|| !check_range(header, header->strings, header->strings_size, 1, 1)
+			|| header->strings_size == 0) {
+		return false;
+	}
+	// Every string ends before the table does
+	const char *strings = (const char *)cache->data + header->strings;
+	if (strings[header->strings_size - 1] != '\0') {
+		return false;
+	}
+
+	const char *cache_theme = get_string(cache, header->theme);
+	const char *library_path = get_string(cache, header->library_path);
+	if (!cache_theme || strcmp(cache_theme, theme) != 0 || !library_path
+			|| strcmp(library_path, xcursor_library_path()) != 0) {
+		return false;
+	}
+
+	cache->uncacheable = header->flags & CACHE_FLAG_UNCACHEABLE;
+	cache->cursors = (const void *)((const uint8_t *)cache->data +
+		header->cursors);
+	cache->cursor_count = header->cursor_count;
+	cache->images = (const void *)((const uint8_t *)cache->data +
+		header->images);
+
+	for (uint32_t i = 0; i < header->cursor_count; ++i) {
+		const struct xcursor_cache_cursor *cursor = &cache->cursors[i];
+		if (!get_string(cache, cursor->name) || cursor->image_count == 0
+				|| cursor->images > header->image_count
+				|| cursor->image_count >
+					header->image_count - cursor->images) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->image_count; ++i) {
+		const struct xcursor_cache_image *image = &cache->images[i];
+		uint64_t pixels = image->pixels;
+		if (image->width > CACHE_MAX_IMAGE_SIZE
+				|| image->height > CACHE_MAX_IMAGE_SIZE
+				|| pixels % 4 != 0 || pixels < header->pixels
+				|| pixels + (uint64_t)image->width * image->height * 4 >
+					(uint64_t)header->pixels + header->pixels_size) {
+			return false;
+		}
+	}
+
+	// Done last, so the cost of the stat calls is only paid for good caches
+	const struct cache_stamp *stamps = (const void *)((const uint8_t *)
+		cache->data + header->stamps);
+	for (uint32_t i = 0; i < header->stamp_count; ++i) {
+		const char *path = get_string(cache, stamps[i].path);
+		if (!path) {
+			return false;
+		}
+		int64_t sec, nsec;
+		get_stamp(path, &sec, &nsec);
+		if (sec != stamps[i].sec || nsec != stamps[i].nsec) {
+			wlr_log(L_DEBUG, "Cursor theme cache is stale, %s changed", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool xcursor_cache_open(struct xcursor_cache *cache, const char *path,
+		const char *theme, int size) {
+	memset(cache, 0, sizeof(*cache));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct cache_header)
+			|| st.st_size > UINT32_MAX) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	cache->data = data;
+	cache->size = st.st_size;
+
+	if (!check_cache(cache, theme, size)) {
+		xcursor_cache_close(cache);
+		return false;
+	}
+	return true;
+}
+
+void xcursor_cache_close(struct xcursor_cache *cache) {
+	if (cache->data) {
+		munmap(cache->data, cache->size);
+	}
+	memset(cache, 0, sizeof(*cache));
+}
+
+const char *xcursor_cache_cursor_name(struct xcursor_cache *cache,
+		const struct xcursor_cache_cursor *cursor) {
+	return get_string(cache, cursor->name);
+}
+
+const struct xcursor_cache_image *xcursor_cache_cursor_images(
+		struct xcursor_cache *cache, const struct xcursor_cache_cursor *cursor) {
+	return &cache->images[cursor->images];
+}
+
+const uint8_t *xcursor_cache_image_pixels(struct xcursor_cache *cache,
+		const struct xcursor_cache_image *image) {
+	return (const uint8_t *)cache->data + image->pixels;
+}
+
+struct string_table {
+	char *data;
+	size_t len, cap;
+};
+
+static bool string_table_add(struct string_table *table, const char *str,
+		uint32_t *offset) {
+	size_t len = strlen(str) + 1;
+	if (table->len + len > table->cap) {
+		size_t cap = table->cap ? table->cap * 2 : 4096;
+		while (cap < table->len + len) {
+			cap *= 2;
+		}
+		char *data = realloc(table->data, cap);
+		if (!data) {
+			return false;
+		}
+		table->data = data;
+		table->cap = cap;
+	}
+	memcpy(table->data + table->len, str, len);
+	*offset = table->len;
+	table->len += len;
+	return true;
+}
+
+static bool write_file(const char *path, const void *data, size_t size) {
+	size_t tmp_len = strlen(path) + sizeof(".XXXXXX");
+	char *tmp = malloc(tmp_len);
+	if (!tmp) {
+		return false;
+	}
+	snprintf(tmp, tmp_len, "%s.XXXXXX", path);
+
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		wlr_log_errno(L_ERROR, "Failed to create %s", tmp);
+		free(tmp);
+		return false;
+	}
+
+	const uint8_t *p = data;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			wlr_log_errno(L_ERROR, "Failed to write %s", tmp);
+			goto error;
+		}
+		p += n;
+		size -= n;
+	}
+	// Readers only ever see the old or the complete new file
+	if (fchmod(fd, 0644) < 0 || rename(tmp, path) < 0) {
+		wlr_log_errno(L_ERROR, "Failed to replace %s", path);
+		goto error;
+	}
+	close(fd);
+	free(tmp);
+	return true;
+
+error:
+	close(fd);
+	unlink(tmp);
+	free(tmp);
+	return false;
+}
+
+static bool write_cache(const char *path, const char *theme, int size,
+		const char **dirs, size_t dir_count,
+		XcursorImages **cursors, size_t cursor_count, uint32_t flags) {
+	bool ret = false;
+	struct string_table strings = {0};
+	struct cache_stamp *stamps = NULL;
+	uint8_t *data = NULL;
+
+	struct cache_header header = {
+		.magic = CACHE_MAGIC,
+		.version = CACHE_VERSION,
+		.size = size,
+		.flags = flags,
+		.stamp_count = dir_count * STAMPS_PER_DIR,
+		.cursor_count = cursor_count,
+	};
+	if (!string_table_add(&strings, theme, &header.theme)
+			|| !string_table_add(&strings, xcursor_library_path(),
+				&header.library_path)) {
+		goto out;
+	}
+
+	// The cursors have been read by now, so a theme that is modified while
+	// the cache is built might only be noticed on its next change
+	stamps = calloc(header.stamp_count, sizeof(*stamps));
+	if (header.stamp_count && !stamps) {
+		goto out;
+	}
+	for (size_t i = 0; i < dir_count; ++i) {
+		for (size_t j = 0; j < STAMPS_PER_DIR; ++j) {
+			struct cache_stamp *stamp = &stamps[i * STAMPS_PER_DIR + j];
+			size_t len = strlen(dirs[i]) + 1 + strlen(stamp_files[j]) + 1;
+			char *file = malloc(len);
+			if (!file) {
+				goto out;
+			}
+			snprintf(file, len, "%s/%s", dirs[i], stamp_files[j]);
+			get_stamp(file, &stamp->sec, &stamp->nsec);
+			bool added = string_table_add(&strings, file, &stamp->path);
+			free(file);
+			if (!added) {
+				goto out;
+			}
+		}
+	}
+
+	uint64_t pixels_size = 0;
+	for (size_t i = 0; i < cursor_count; ++i) {
+		header.image_count += cursors[i]->nimage;
+		for (int j = 0; j < cursors[i]->nimage; ++j) {
+			XcursorImage *image = cursors[i]->images[j];
+			// The cache would never pass check_cache
+			if (image->width > CACHE_MAX_IMAGE_SIZE
+					|| image->height > CACHE_MAX_IMAGE_SIZE) {
+				wlr_log(L_ERROR, "Cursor '%s' of theme '%s' is too large "
+					"to be cached", cursors[i]->name, theme);
+				goto out;
+			}
+			pixels_size += (uint64_t)image->width * image->height * 4;
+		}
+	}
+
+	uint64_t offset = sizeof(struct cache_header);
+	header.stamps = offset;
+	offset += header.stamp_count * sizeof(struct cache_stamp);
+	header.cursors = offset;
+	offset += header.cursor_count * sizeof(struct xcursor_cache_cursor);
+	header.images = offset;
+	offset += (uint64_t)header.image_count * sizeof(struct xcursor_cache_image);
+	header.pixels = offset;
+	header.pixels_size = pixels_size;
+	offset += pixels_size;
+	header.strings = offset;
+
+	// Cursor names go last, so the offsets above can't move anymore
+	uint32_t *names = calloc(cursor_count, sizeof(*names));
+	if (cursor_count && !names) {
+		goto out;
+	}
+	for (size_t i = 0; i < cursor_count; ++i) {
+		if (!string_table_add(&strings, cursors[i]->name, &names[i])) {
+			free(names);
+			goto out;
+		}
+	}
+	header.strings_size = strings.len;
+	offset += strings.len;
+	if (offset > UINT32_MAX) {
+		wlr_log(L_ERROR, "Cursor theme '%s' is too large to be cached", theme);
+		free(names);
+		goto out;
+	}
+	header.file_size = offset;
+
+	data = calloc(1, header.file_size);
+	if (!data) {
+		free(names);
+		goto out;
+	}
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + header.stamps, stamps,
+		header.stamp_count * sizeof(struct cache_stamp));
+	memcpy(data + header.strings, strings.data, strings.len);
+
+	struct xcursor_cache_cursor *cache_cursors =
+		(void *)(data + header.cursors);
+	struct xcursor_cache_image *cache_images = (void *)(data + header.images);
+	uint32_t pixels = header.pixels;
+	uint32_t image_index = 0;
+	for (size_t i = 0; i < cursor_count; ++i) {
+		struct xcursor_cache_cursor *cursor = &cache_cursors[i];
+		cursor->name = names[i];
+		cursor->image_count = cursors[i]->nimage;
+		cursor->images = image_index;
+		for (int j = 0; j < cursors[i]->nimage; ++j) {
+			XcursorImage *image = cursors[i]->images[j];
+			struct xcursor_cache_image *cache_image =
+				&cache_images[image_index++];
+			cache_image->width = image->width;
+			cache_image->height = image->height;
+			cache_image->hotspot_x = image->xhot;
+			cache_image->hotspot_y = image->yhot;
+			cache_image->delay = image->delay;
+			cache_image->pixels = pixels;
+			size_t len = (size_t)image->width * image->height * 4;
+			memcpy(data + pixels, image->pixels, len);
+			pixels += len;
+			cursor->total_delay += image->delay;
+		}
+	}
+	free(names);
+
+	ret = write_file(path, data, header.file_size);
+
+out:
+	free(data);
+	free(stamps);
+	free(strings.data);
+	return ret;
+}
+
+bool xcursor_cache_write(const char *path, const char *theme, int size,
+		const char **dirs, size_t dir_count,
+		XcursorImages **cursors, size_t cursor_count) {
+	return write_cache(path, theme, size, dirs, dir_count,
+		cursors, cursor_count, 0);
+}
+
+bool xcursor_cache_write_uncacheable(const char *path, const char *theme,
+		int size, const char **dirs, size_t dir_count) {
+	return write_cache(path, theme, size, dirs, dir_count, NULL, 0,
+		CACHE_FLAG_UNCACHEABLE);
+}
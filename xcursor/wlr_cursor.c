@@ -27,17 +27,26 @@
 #include <wlr/render.h>
 #include <wlr/xcursor.h>
 #include <wlr/util/log.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "xcursor/xcursor.h"
+#include "xcursor/cache.h"
 
+/*
+ * The image buffers belong to the cursor's xcursor_images, to the theme
+ * cache or to the built-in cursor data, so they aren't freed here
+ */
 static void wlr_cursor_destroy(struct wlr_cursor *cursor) {
 	for (size_t i = 0; i < cursor->image_count; i++) {
-		free(cursor->images[i]->buffer);
 		free(cursor->images[i]);
 	}
+	XcursorImagesDestroy(cursor->xcursor_images);
 
 	free(cursor->images);
 	free(cursor->name);
@@ -50,7 +59,6 @@ static struct wlr_cursor *wlr_cursor_create_from_data(
 		struct cursor_metadata *metadata, struct wlr_cursor_theme *theme) {
 	struct wlr_cursor *cursor;
 	struct wlr_cursor_image *image;
-	int size;
 
 	cursor = malloc(sizeof(*cursor));
 	if (!cursor) {
@@ -65,6 +73,7 @@ static struct wlr_cursor *wlr_cursor_create_from_data(
 
 	cursor->name = strdup(metadata->name);
 	cursor->total_delay = 0;
+	cursor->xcursor_images = NULL;
 
 	image = malloc(sizeof(*image));
 	if (!image) {
@@ -72,27 +81,15 @@ static struct wlr_cursor *wlr_cursor_create_from_data(
 	}
 
 	cursor->images[0] = image;
-	image->buffer = NULL;
 	image->width = metadata->width;
 	image->height = metadata->height;
 	image->hotspot_x = metadata->hotspot_x;
 	image->hotspot_y = metadata->hotspot_y;
 	image->delay = 0;
-
-	size = metadata->width * metadata->height * sizeof(uint32_t);
-	image->buffer = malloc(size);
-
-	if (!image->buffer) {
-		goto err_free_image;
-	}
-
-	memcpy(image->buffer, cursor_data + metadata->offset, size);
+	image->buffer = (uint8_t *)(cursor_data + metadata->offset);
 
 	return cursor;
 
-err_free_image:
-	free(image);
-
 err_free_images:
 	free(cursor->name);
 	free(cursor->images);
@@ -102,50 +99,147 @@ err_free_cursor:
 	return NULL;
 }
 
-static void load_default_theme(struct wlr_cursor_theme *theme) {
-	uint32_t i;
+struct wlr_cursor_theme_entry {
+	char *name;
+	/* candidate files in lookup order, none for built-in and cached cursors */
+	char **paths;
+	size_t path_count;
+	struct cursor_metadata *metadata; /* only for the built-in cursors */
+	const struct xcursor_cache_cursor *cached; /* only for cached cursors */
+	struct wlr_cursor *cursor;
+	bool loaded;
+	uint32_t hash;
+	struct wlr_cursor_theme_entry *next;
+};
+
+static uint32_t hash_name(const char *name) {
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (; *name; ++name) {
+		hash ^= (uint8_t)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
 
-	free(theme->name);
-	theme->name = strdup("default");
+static struct wlr_cursor_theme_entry *theme_find_entry(
+		struct wlr_cursor_theme *theme, const char *name, uint32_t hash) {
+	if (theme->bucket_count == 0) {
+		return NULL;
+	}
+	struct wlr_cursor_theme_entry *entry =
+		theme->buckets[hash & (theme->bucket_count - 1)];
+	for (; entry; entry = entry->next) {
+		if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
 
-	theme->cursor_count = sizeof(cursor_metadata) / sizeof(cursor_metadata[0]);
-	theme->cursors = malloc(theme->cursor_count * sizeof(*theme->cursors));
+static bool theme_resize(struct wlr_cursor_theme *theme,
+		unsigned int bucket_count) {
+	struct wlr_cursor_theme_entry **buckets =
+		calloc(bucket_count, sizeof(*buckets));
+	if (!buckets) {
+		return false;
+	}
+	for (unsigned int i = 0; i < theme->bucket_count; ++i) {
+		struct wlr_cursor_theme_entry *entry = theme->buckets[i], *next;
+		for (; entry; entry = next) {
+			next = entry->next;
+			struct wlr_cursor_theme_entry **bucket =
+				&buckets[entry->hash & (bucket_count - 1)];
+			entry->next = *bucket;
+			*bucket = entry;
+		}
+	}
+	free(theme->buckets);
+	theme->buckets = buckets;
+	theme->bucket_count = bucket_count;
+	return true;
+}
 
-	if (theme->cursors == NULL) {
-		theme->cursor_count = 0;
-		return;
+/* Returns NULL if the name is already in the index, or on allocation failure */
+static struct wlr_cursor_theme_entry *theme_add_entry(
+		struct wlr_cursor_theme *theme, const char *name) {
+	uint32_t hash = hash_name(name);
+	if (theme_find_entry(theme, name, hash)) {
+		return NULL;
+	}
+	/* bucket_count stays a power of two, so the hash can be masked */
+	if (theme->cursor_count >= theme->bucket_count &&
+			!theme_resize(theme, theme->bucket_count ?
+				theme->bucket_count * 2 : 64)) {
+		return NULL;
 	}
 
-	for (i = 0; i < theme->cursor_count; ++i) {
-		theme->cursors[i] =
-			wlr_cursor_create_from_data(&cursor_metadata[i], theme);
+	struct wlr_cursor_theme_entry *entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		return NULL;
+	}
+	entry->name = strdup(name);
+	if (!entry->name) {
+		free(entry);
+		return NULL;
+	}
+	entry->hash = hash;
+
+	struct wlr_cursor_theme_entry **bucket =
+		&theme->buckets[hash & (theme->bucket_count - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	theme->cursor_count++;
+	return entry;
+}
 
-		if (theme->cursors[i] == NULL) {
-			break;
+static struct cursor_metadata *find_builtin_cursor(const char *name) {
+	size_t count = sizeof(cursor_metadata) / sizeof(cursor_metadata[0]);
+	for (size_t i = 0; i < count; ++i) {
+		if (strcmp(cursor_metadata[i].name, name) == 0) {
+			return &cursor_metadata[i];
+		}
+	}
+	return NULL;
+}
+
+static void load_default_theme(struct wlr_cursor_theme *theme) {
+	free(theme->name);
+	theme->name = strdup("default");
+
+	size_t count = sizeof(cursor_metadata) / sizeof(cursor_metadata[0]);
+	for (size_t i = 0; i < count; ++i) {
+		struct wlr_cursor_theme_entry *entry =
+			theme_add_entry(theme, cursor_metadata[i].name);
+		if (entry) {
+			entry->metadata = &cursor_metadata[i];
 		}
 	}
-	theme->cursor_count = i;
 }
 
+/* Takes ownership of the images, the cursor uses their pixels in place */
 static struct wlr_cursor *wlr_cursor_create_from_xcursor_images(
 		XcursorImages *images, struct wlr_cursor_theme *theme) {
 	struct wlr_cursor *cursor;
 	struct wlr_cursor_image *image;
-	int i, size;
+	int i;
 
 	cursor = malloc(sizeof(*cursor));
 	if (!cursor) {
+		XcursorImagesDestroy(images);
 		return NULL;
 	}
 
 	cursor->images = malloc(images->nimage * sizeof(cursor->images[0]));
 	if (!cursor->images) {
 		free(cursor);
+		XcursorImagesDestroy(images);
 		return NULL;
 	}
 
 	cursor->name = strdup(images->name);
 	cursor->total_delay = 0;
+	cursor->xcursor_images = images;
 
 	for (i = 0; i < images->nimage; i++) {
 		image = malloc(sizeof(*image));
@@ -153,70 +247,260 @@ static struct wlr_cursor *wlr_cursor_create_from_xcursor_images(
 			break;
 		}
 
-		image->buffer = NULL;
-
 		image->width = images->images[i]->width;
 		image->height = images->images[i]->height;
 		image->hotspot_x = images->images[i]->xhot;
 		image->hotspot_y = images->images[i]->yhot;
 		image->delay = images->images[i]->delay;
+		image->buffer = (uint8_t *)images->images[i]->pixels;
 
-		size = image->width * image->height * 4;
-		image->buffer = malloc(size);
-		if (!image->buffer) {
-			free(image);
-			break;
-		}
-
-		/* copy pixels to shm pool */
-		memcpy(image->buffer, images->images[i]->pixels, size);
 		cursor->total_delay += image->delay;
 		cursor->images[i] = image;
 	}
 	cursor->image_count = i;
 
 	if (cursor->image_count == 0) {
-		free(cursor->name);
-		free(cursor->images);
-		free(cursor);
+		wlr_cursor_destroy(cursor);
 		return NULL;
 	}
 
 	return cursor;
 }
 
-static void load_callback(XcursorImages *images, void *data) {
-	struct wlr_cursor_theme *theme = data;
+static struct wlr_cursor *wlr_cursor_create_from_cache(
+		struct xcursor_cache *cache, const struct xcursor_cache_cursor *cached,
+		const char *name) {
 	struct wlr_cursor *cursor;
+	const struct xcursor_cache_image *images =
+		xcursor_cache_cursor_images(cache, cached);
 
-	if (wlr_cursor_theme_get_cursor(theme, images->name)) {
-		XcursorImagesDestroy(images);
+	cursor = calloc(1, sizeof(*cursor));
+	if (!cursor) {
+		return NULL;
+	}
+
+	cursor->images = calloc(cached->image_count, sizeof(cursor->images[0]));
+	cursor->name = strdup(name);
+	if (!cursor->images || !cursor->name) {
+		wlr_cursor_destroy(cursor);
+		return NULL;
+	}
+	cursor->total_delay = cached->total_delay;
+
+	for (uint32_t i = 0; i < cached->image_count; i++) {
+		struct wlr_cursor_image *image = malloc(sizeof(*image));
+		if (!image) {
+			wlr_cursor_destroy(cursor);
+			return NULL;
+		}
+
+		image->width = images[i].width;
+		image->height = images[i].height;
+		image->hotspot_x = images[i].hotspot_x;
+		image->hotspot_y = images[i].hotspot_y;
+		image->delay = images[i].delay;
+		image->buffer = (uint8_t *)xcursor_cache_image_pixels(cache, &images[i]);
+
+		cursor->images[i] = image;
+		cursor->image_count++;
+	}
+
+	return cursor;
+}
+
+struct theme_scan {
+	struct wlr_cursor_theme *theme;
+	char **dirs;
+	size_t dir_count;
+};
+
+static void dir_callback(const char *dir, void *data) {
+	struct theme_scan *scan = data;
+
+	char **dirs = realloc(scan->dirs, (scan->dir_count + 1) * sizeof(*dirs));
+	if (!dirs) {
 		return;
 	}
+	scan->dirs = dirs;
+	if ((dirs[scan->dir_count] = strdup(dir))) {
+		scan->dir_count++;
+	}
+}
+
+static void scan_callback(const char *name, const char *path, void *data) {
+	struct theme_scan *scan = data;
+	struct wlr_cursor_theme *theme = scan->theme;
+
+	/*
+	 * Themes are scanned in lookup order. Every file is kept, so a later one
+	 * can stand in for an earlier one that fails to decode.
+	 */
+	struct wlr_cursor_theme_entry *entry =
+		theme_find_entry(theme, name, hash_name(name));
+	if (!entry) {
+		entry = theme_add_entry(theme, name);
+		if (!entry) {
+			return;
+		}
+	}
+
+	char **paths = realloc(entry->paths,
+		(entry->path_count + 1) * sizeof(*paths));
+	if (!paths) {
+		return;
+	}
+	entry->paths = paths;
+	if ((paths[entry->path_count] = strdup(path))) {
+		entry->path_count++;
+	}
+}
+
+/* Decodes the first candidate file of the entry that can be decoded */
+static XcursorImages *theme_load_entry_images(struct wlr_cursor_theme *theme,
+		struct wlr_cursor_theme_entry *entry) {
+	for (size_t i = 0; i < entry->path_count; ++i) {
+		XcursorImages *images =
+			xcursor_load_file(entry->paths[i], entry->name, theme->size);
+		if (images) {
+			return images;
+		}
+		wlr_log(L_ERROR, "Failed to load cursor '%s' from %s",
+				entry->name, entry->paths[i]);
+	}
+	return NULL;
+}
+
+static struct wlr_cursor *theme_load_entry(struct wlr_cursor_theme *theme,
+		struct wlr_cursor_theme_entry *entry) {
+	if (entry->metadata) {
+		return wlr_cursor_create_from_data(entry->metadata, theme);
+	}
+	if (entry->cached) {
+		return wlr_cursor_create_from_cache(theme->cache, entry->cached,
+			entry->name);
+	}
+
+	XcursorImages *images = theme_load_entry_images(theme, entry);
+	if (images) {
+		return wlr_cursor_create_from_xcursor_images(images, theme);
+	}
+
+	/* None of the files could be decoded, use the built-in cursor instead */
+	struct cursor_metadata *metadata = find_builtin_cursor(entry->name);
+	if (!metadata) {
+		return NULL;
+	}
+	wlr_log(L_INFO, "Using the built-in cursor '%s'", entry->name);
+	return wlr_cursor_create_from_data(metadata, theme);
+}
+
+static char *get_cache_path(const char *name, int size) {
+	const char *dir = getenv("WLR_CURSOR_CACHE");
+	if (!dir || !*dir || strchr(name, '/')) {
+		return NULL;
+	}
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		wlr_log_errno(L_ERROR, "Failed to create %s", dir);
+		return NULL;
+	}
+	// Otherwise every start would decode the whole theme for nothing
+	if (access(dir, W_OK) < 0) {
+		wlr_log_errno(L_ERROR, "Can't write cursor theme caches to %s", dir);
+		return NULL;
+	}
 
-	cursor = wlr_cursor_create_from_xcursor_images(images, theme);
+	int len = snprintf(NULL, 0, "%s/%s-%d.cache", dir, name, size);
+	char *path = malloc(len + 1);
+	if (path) {
+		snprintf(path, len + 1, "%s/%s-%d.cache", dir, name, size);
+	}
+	return path;
+}
 
-	if (cursor) {
-		theme->cursor_count++;
-		theme->cursors =
-			realloc(theme->cursors,
-				theme->cursor_count * sizeof(theme->cursors[0]));
+enum cache_result {
+	CACHE_LOADED,
+	CACHE_MISSING, // missing or out of date
+	CACHE_UNCACHEABLE, // the theme is known not to be cacheable
+};
+
+static enum cache_result theme_load_cache(struct wlr_cursor_theme *theme,
+		const char *path) {
+	struct xcursor_cache *cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		return CACHE_MISSING;
+	}
+	if (!xcursor_cache_open(cache, path, theme->name, theme->size)) {
+		free(cache);
+		return CACHE_MISSING;
+	}
+	if (cache->uncacheable) {
+		xcursor_cache_close(cache);
+		free(cache);
+		return CACHE_UNCACHEABLE;
+	}
+	theme->cache = cache;
+
+	for (uint32_t i = 0; i < cache->cursor_count; ++i) {
+		const struct xcursor_cache_cursor *cached = &cache->cursors[i];
+		struct wlr_cursor_theme_entry *entry = theme_add_entry(theme,
+			xcursor_cache_cursor_name(cache, cached));
+		if (entry) {
+			entry->cached = cached;
+		}
+	}
+	return CACHE_LOADED;
+}
+
+/*
+ * Decodes every cursor of the scanned theme and stores them in a cache. The
+ * cache can't stand for a built-in cursor, so a theme with a cursor that falls
+ * back to one isn't cached. That is recorded instead, so the theme is loaded
+ * lazily until it changes.
+ */
+static void theme_write_cache(struct wlr_cursor_theme *theme,
+		const char *path, struct theme_scan *scan) {
+	XcursorImages **cursors = calloc(theme->cursor_count, sizeof(*cursors));
+	if (!cursors) {
+		return;
+	}
 
-		if (theme->cursors == NULL) {
-			theme->cursor_count--;
-			free(cursor);
-		} else {
-			theme->cursors[theme->cursor_count - 1] = cursor;
+	size_t count = 0;
+	for (unsigned int i = 0; i < theme->bucket_count; i++) {
+		struct wlr_cursor_theme_entry *entry = theme->buckets[i];
+		for (; entry; entry = entry->next) {
+			XcursorImages *images = theme_load_entry_images(theme, entry);
+			if (images) {
+				cursors[count++] = images;
+			} else if (find_builtin_cursor(entry->name)) {
+				wlr_log(L_INFO, "Not caching cursor theme '%s', "
+					"'%s' can't be decoded", theme->name, entry->name);
+				xcursor_cache_write_uncacheable(path, theme->name,
+					theme->size, (const char **)scan->dirs, scan->dir_count);
+				goto out;
+			}
 		}
 	}
 
-	XcursorImagesDestroy(images);
+	if (xcursor_cache_write(path, theme->name, theme->size,
+			(const char **)scan->dirs, scan->dir_count, cursors, count)) {
+		wlr_log(L_INFO, "Wrote cursor theme cache %s", path);
+	} else {
+		// e.g. too large, don't try again on every start
+		xcursor_cache_write_uncacheable(path, theme->name, theme->size,
+			(const char **)scan->dirs, scan->dir_count);
+	}
+
+out:
+	for (size_t i = 0; i < count; i++) {
+		XcursorImagesDestroy(cursors[i]);
+	}
+	free(cursors);
 }
 
 struct wlr_cursor_theme *wlr_cursor_theme_load(const char *name, int size) {
 	struct wlr_cursor_theme *theme;
 
-	theme = malloc(sizeof(*theme));
+	theme = calloc(1, sizeof(*theme));
 	if (!theme) {
 		return NULL;
 	}
@@ -230,24 +514,33 @@ struct wlr_cursor_theme *wlr_cursor_theme_load(const char *name, int size) {
 		goto out_error_name;
 	}
 	theme->size = size;
-	theme->cursor_count = 0;
-	theme->cursors = NULL;
 
-	xcursor_load_theme(name, size, load_callback, theme);
+	char *cache_path = get_cache_path(name, size);
+	enum cache_result cached = cache_path ?
+		theme_load_cache(theme, cache_path) : CACHE_MISSING;
+	if (cached == CACHE_LOADED) {
+		wlr_log(L_DEBUG, "Using cursor theme cache %s", cache_path);
+	} else {
+		struct theme_scan scan = { .theme = theme };
+		xcursor_scan_theme(name, dir_callback, scan_callback, &scan);
+
+		if (cached == CACHE_MISSING && cache_path &&
+				theme->cursor_count > 0) {
+			theme_write_cache(theme, cache_path, &scan);
+		}
+		for (size_t i = 0; i < scan.dir_count; i++) {
+			free(scan.dirs[i]);
+		}
+		free(scan.dirs);
+	}
+	free(cache_path);
 
 	if (theme->cursor_count == 0) {
 		load_default_theme(theme);
 	}
 
-	wlr_log(L_DEBUG, "Loaded cursor theme '%s', available cursors:",
-			theme->name);
-	for (size_t i = 0; i < theme->cursor_count; ++i) {
-		struct wlr_cursor *c = theme->cursors[i];
-		struct wlr_cursor_image *i = c->images[0];
-		wlr_log(L_DEBUG, "%s (%u images) %dx%d+%d,%d",
-				c->name, c->image_count,
-				i->width, i->height, i->hotspot_x, i->hotspot_y);
-	}
+	wlr_log(L_DEBUG, "Loaded cursor theme '%s' with %u cursors",
+			theme->name, theme->cursor_count);
 
 	return theme;
 
@@ -257,28 +550,52 @@ out_error_name:
 }
 
 void wlr_cursor_theme_destroy(struct wlr_cursor_theme *theme) {
-	unsigned int i;
-
-	for (i = 0; i < theme->cursor_count; i++) {
-		wlr_cursor_destroy(theme->cursors[i]);
+	for (unsigned int i = 0; i < theme->bucket_count; i++) {
+		struct wlr_cursor_theme_entry *entry = theme->buckets[i], *next;
+		for (; entry; entry = next) {
+			next = entry->next;
+			if (entry->cursor) {
+				wlr_cursor_destroy(entry->cursor);
+			}
+			for (size_t j = 0; j < entry->path_count; j++) {
+				free(entry->paths[j]);
+			}
+			free(entry->paths);
+			free(entry->name);
+			free(entry);
+		}
 	}
 
+	if (theme->cache) {
+		xcursor_cache_close(theme->cache);
+		free(theme->cache);
+	}
 	free(theme->name);
-	free(theme->cursors);
+	free(theme->buckets);
 	free(theme);
 }
 
 struct wlr_cursor *wlr_cursor_theme_get_cursor(struct wlr_cursor_theme *theme,
 		   const char *name) {
-	unsigned int i;
+	struct wlr_cursor_theme_entry *entry =
+		theme_find_entry(theme, name, hash_name(name));
+	if (!entry) {
+		return NULL;
+	}
 
-	for (i = 0; i < theme->cursor_count; i++) {
-		if (strcmp(name, theme->cursors[i]->name) == 0) {
-			return theme->cursors[i];
+	if (!entry->loaded) {
+		/* Failures are remembered too, the files won't get any better */
+		entry->cursor = theme_load_entry(theme, entry);
+		entry->loaded = true;
+		if (entry->cursor) {
+			struct wlr_cursor_image *i = entry->cursor->images[0];
+			wlr_log(L_DEBUG, "Loaded cursor %s (%u images) %dx%d+%d,%d",
+					entry->cursor->name, entry->cursor->image_count,
+					i->width, i->height, i->hotspot_x, i->hotspot_y);
 		}
 	}
 
-	return NULL;
+	return entry->cursor;
 }
 
 static int wlr_cursor_frame_and_duration(struct wlr_cursor *cursor,
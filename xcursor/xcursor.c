@@ -26,9 +26,14 @@
 #define _DEFAULT_SOURCE
 #include "xcursor/xcursor.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
  * From libXcursor/include/X11/extensions/Xcursor.h
@@ -185,8 +190,9 @@ typedef struct _XcursorFile XcursorFile;
 struct _XcursorFile {
     void    *closure;
     int	    (*read)  (XcursorFile *file, unsigned char *buf, int len);
-    int	    (*write) (XcursorFile *file, unsigned char *buf, int len);
     int	    (*seek)  (XcursorFile *file, long offset, int whence);
+    /* pointer to len bytes at the current position, NULL if not in memory */
+    const unsigned char *(*map) (XcursorFile *file, size_t len);
 };
 
 typedef struct _XcursorComments {
@@ -284,7 +290,7 @@ _XcursorReadUInt (XcursorFile *file, XcursorUInt *u)
     *u = ((bytes[0] << 0) |
 	  (bytes[1] << 8) |
 	  (bytes[2] << 16) |
-	  (bytes[3] << 24));
+	  ((XcursorUInt) bytes[3] << 24));
     return XcursorTrue;
 }
 
@@ -466,6 +472,7 @@ _XcursorReadImage (XcursorFile		*file,
     XcursorImage	*image;
     int			n;
     XcursorPixel	*p;
+    const unsigned char	*mapped = NULL;
 
     if (!file || !fileHeader)
         return NULL;
@@ -483,13 +490,24 @@ _XcursorReadImage (XcursorFile		*file,
     if (!_XcursorReadUInt (file, &head.delay))
 	return NULL;
     /* sanity check data */
-    if (head.width >= 0x10000 || head.height > 0x10000)
+    if (head.width > XCURSOR_IMAGE_MAX_SIZE ||
+	head.height > XCURSOR_IMAGE_MAX_SIZE)
 	return NULL;
     if (head.width == 0 || head.height == 0)
 	return NULL;
     if (head.xhot > head.width || head.yhot > head.height)
 	return NULL;
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /*
+     * The pixels are stored in host order already, so they can be copied
+     * out of a mapped file as they are. Only the pages of the chosen size
+     * are then read in.
+     */
+    if (file->map)
+	mapped = (*file->map) (file, (size_t) head.width * head.height * 4);
+#endif
+
     /* Create the image and initialize it */
     image = XcursorImageCreate (head.width, head.height);
     if (image == NULL)
@@ -500,6 +518,11 @@ _XcursorReadImage (XcursorFile		*file,
     image->xhot = head.xhot;
     image->yhot = head.yhot;
     image->delay = head.delay;
+    if (mapped)
+    {
+	memcpy (image->pixels, mapped, (size_t) head.width * head.height * 4);
+	return image;
+    }
     n = image->width * image->height;
     p = image->pixels;
     while (n--)
@@ -561,45 +584,83 @@ XcursorXcFileLoadImages (XcursorFile *file, int size)
     return images;
 }
 
+/*
+ * Cursor files are read from a private read-only mapping, so the pixels
+ * of the chosen size are copied in one go and no other part is read in
+ */
+typedef struct _XcursorMap {
+    const unsigned char	*data;
+    size_t		size;
+    size_t		pos;
+} XcursorMap;
+
 static int
-_XcursorStdioFileRead (XcursorFile *file, unsigned char *buf, int len)
+_XcursorMapFileRead (XcursorFile *file, unsigned char *buf, int len)
 {
-    FILE    *f = file->closure;
-    return fread (buf, 1, len, f);
+    XcursorMap	*map = file->closure;
+    size_t	avail = map->size - map->pos;
+
+    if (len < 0)
+	return 0;
+    if ((size_t) len > avail)
+	len = avail;
+    memcpy (buf, map->data + map->pos, len);
+    map->pos += len;
+    return len;
 }
 
 static int
-_XcursorStdioFileWrite (XcursorFile *file, unsigned char *buf, int len)
+_XcursorMapFileSeek (XcursorFile *file, long offset, int whence)
 {
-    FILE    *f = file->closure;
-    return fwrite (buf, 1, len, f);
+    XcursorMap	*map = file->closure;
+    long	pos;
+
+    switch (whence)
+    {
+    case SEEK_SET:
+	pos = offset;
+	break;
+    case SEEK_CUR:
+	pos = (long) map->pos + offset;
+	break;
+    case SEEK_END:
+	pos = (long) map->size + offset;
+	break;
+    default:
+	return EOF;
+    }
+    if (pos < 0 || (size_t) pos > map->size)
+	return EOF;
+    map->pos = pos;
+    return 0;
 }
 
-static int
-_XcursorStdioFileSeek (XcursorFile *file, long offset, int whence)
+static const unsigned char *
+_XcursorMapFileMap (XcursorFile *file, size_t len)
 {
-    FILE    *f = file->closure;
-    return fseek (f, offset, whence);
+    XcursorMap	*map = file->closure;
+
+    if (len > map->size - map->pos)
+	return NULL;
+    return map->data + map->pos;
 }
 
 static void
-_XcursorStdioFileInitialize (FILE *stdfile, XcursorFile *file)
+_XcursorMapFileInitialize (XcursorMap *map, XcursorFile *file)
 {
-    file->closure = stdfile;
-    file->read = _XcursorStdioFileRead;
-    file->write = _XcursorStdioFileWrite;
-    file->seek = _XcursorStdioFileSeek;
+    file->closure = map;
+    file->read = _XcursorMapFileRead;
+    file->seek = _XcursorMapFileSeek;
+    file->map = _XcursorMapFileMap;
 }
 
 static XcursorImages *
-XcursorFileLoadImages (FILE *file, int size)
+XcursorMapLoadImages (void *data, size_t len, int size)
 {
-    XcursorFile	f;
+    XcursorMap		map = { .data = data, .size = len, .pos = 0 };
+    XcursorFile		f;
 
-    if (!file)
-        return NULL;
-
-    _XcursorStdioFileInitialize (file, &f);
+    _XcursorMapFileInitialize (&map, &f);
     return XcursorXcFileLoadImages (&f, size);
 }
 
@@ -839,6 +900,37 @@ XcursorScanTheme (const char *theme, const char *name)
     return f;
 }
 
+static XcursorImages *
+XcursorFdLoadImages (int fd, int size)
+{
+    struct stat	    st;
+    void	    *data;
+    XcursorImages   *images;
+
+    if (fstat (fd, &st) < 0 || st.st_size < XCURSOR_FILE_HEADER_LEN)
+	return NULL;
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+	return NULL;
+    /*
+     * The pixels are copied out before the file is unmapped. A mapping
+     * kept for as long as the cursors would raise SIGBUS once the file is
+     * truncated or rewritten in place, e.g. by a package upgrade.
+     */
+    images = XcursorMapLoadImages (data, st.st_size, size);
+    munmap (data, st.st_size);
+    return images;
+}
+
+static XcursorImages *
+XcursorFileLoadImages (FILE *file, int size)
+{
+    if (!file)
+        return NULL;
+
+    return XcursorFdLoadImages (fileno (file), size);
+}
+
 XcursorImages *
 XcursorLibraryLoadImages (const char *file, const char *theme, int size)
 {
@@ -863,15 +955,13 @@ XcursorLibraryLoadImages (const char *file, const char *theme, int size)
 }
 
 static void
-load_all_cursors_from_dir(const char *path, int size,
-			  void (*load_callback)(XcursorImages *, void *),
-			  void *user_data)
+scan_cursors_in_dir(const char *path,
+		    void (*scan_callback)(const char *, const char *, void *),
+		    void *user_data)
 {
-	FILE *f;
 	DIR *dir = opendir(path);
 	struct dirent *ent;
 	char *full;
-	XcursorImages *images;
 
 	if (!dir)
 		return;
@@ -885,49 +975,42 @@ load_all_cursors_from_dir(const char *path, int size,
 		if (!full)
 			continue;
 
-		f = fopen(full, "r");
-		if (!f) {
-			free(full);
-			continue;
-		}
-
-		images = XcursorFileLoadImages(f, size);
-
-		if (images) {
-			XcursorImagesSetName(images, ent->d_name);
-			load_callback(images, user_data);
-		}
-
-		fclose (f);
+		scan_callback(ent->d_name, full, user_data);
 		free(full);
 	}
 
 	closedir(dir);
 }
 
-/** Load all the cursor of a theme
+/** The colon separated list of directories themes are looked up in */
+const char *
+xcursor_library_path(void)
+{
+	return XcursorLibraryPath();
+}
+
+/** List the cursors of a theme
  *
- * This function loads all the cursor images of a given theme and its
- * inherited themes. Each cursor is loaded into an XcursorImages object
- * which is passed to the caller's load callback. If a cursor appears
- * more than once across all the inherited themes, the load callback
- * will be called multiple times, with possibly different XcursorImages
- * object which have the same name. The user is expected to destroy the
- * XcursorImages objects passed to the callback with
- * XcursorImagesDestroy().
+ * This function lists the cursor files of a given theme and its inherited
+ * themes, without opening them. Themes are visited in lookup order, so if a
+ * cursor appears more than once across all the inherited themes, the first
+ * call for its name is the one that should be used.
  *
- * \param theme The name of theme that should be loaded
- * \param size The desired size of the cursor images
- * \param load_callback A callback function that will be called
- * for each cursor loaded. The first parameter is the XcursorImages
- * object representing the loaded cursor and the second is a pointer
- * to data provided by the user.
- * \param user_data The data that should be passed to the load callback
+ * \param theme The name of theme that should be scanned
+ * \param dir_callback A callback function that will be called for each
+ * directory the theme or an inherited theme is looked up in, whether it
+ * exists or not, with the path and a pointer to data provided by the user.
+ * May be NULL.
+ * \param scan_callback A callback function that will be called for each
+ * cursor file, with the cursor name, the full path of the file and a pointer
+ * to data provided by the user. Both strings are only valid during the call.
+ * \param user_data The data that should be passed to the callbacks
  */
 void
-xcursor_load_theme(const char *theme, int size,
-		    void (*load_callback)(XcursorImages *, void *),
-		    void *user_data)
+xcursor_scan_theme(const char *theme,
+		   void (*dir_callback)(const char *, void *),
+		   void (*scan_callback)(const char *, const char *, void *),
+		   void *user_data)
 {
 	char *full, *dir;
 	char *inherits = NULL;
@@ -943,11 +1026,13 @@ xcursor_load_theme(const char *theme, int size,
 		if (!dir)
 			continue;
 
+		if (dir_callback)
+			dir_callback(dir, user_data);
+
 		full = _XcursorBuildFullname(dir, "cursors", "");
 
 		if (full) {
-			load_all_cursors_from_dir(full, size, load_callback,
-						  user_data);
+			scan_cursors_in_dir(full, scan_callback, user_data);
 			free(full);
 		}
 
@@ -963,8 +1048,36 @@ xcursor_load_theme(const char *theme, int size,
 	}
 
 	for (i = inherits; i; i = _XcursorNextPath(i))
-		xcursor_load_theme(i, size, load_callback, user_data);
+		xcursor_scan_theme(i, dir_callback, scan_callback, user_data);
 
 	if (inherits)
 		free(inherits);
 }
+
+/** Load a cursor file
+ *
+ * \param path The full path of the cursor file
+ * \param name The name to give the cursor
+ * \param size The desired size of the cursor images
+ * \return The images closest to the requested size, to be destroyed with
+ * XcursorImagesDestroy(), or NULL if the file can't be read. The file is
+ * mapped rather than read, and only the images of the chosen size are
+ * copied out of it.
+ */
+XcursorImages *
+xcursor_load_file(const char *path, const char *name, int size)
+{
+	XcursorImages *images;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	images = XcursorFdLoadImages(fd, size);
+	close(fd);
+	if (!images)
+		return NULL;
+
+	XcursorImagesSetName(images, name);
+	return images;
+}